@@ -0,0 +1,46 @@
+#pragma once
+
+#include <kernel/multiboot2.h>
+#include <kernel/smp.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Common header of every ACPI table
+typedef struct {
+    char signature[4];
+    uint32_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed)) acpi_sdt_header_t;
+
+// Multiple APIC Description Table
+typedef struct {
+    acpi_sdt_header_t header;
+    uint32_t lapic_address;
+    uint32_t flags;
+    uint8_t entries[];
+} __attribute__((packed)) acpi_madt_t;
+
+typedef struct {
+    uint8_t type;
+    uint8_t length;
+} __attribute__((packed)) acpi_madt_entry_t;
+
+#define ACPI_MADT_LAPIC 0
+
+typedef struct {
+    acpi_madt_entry_t header;
+    uint8_t processor_id;
+    uint8_t apic_id;
+    uint32_t flags;
+} __attribute__((packed)) acpi_madt_lapic_t;
+
+#define ACPI_MADT_LAPIC_ENABLED 1
+
+bool acpi_find_cpus(mb2_t* boot, smp_config_t* config);
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <kernel/fs.h>
+#include <kernel/timer.h>
+
+#include <stdint.h>
+
+#define BCACHE_BUCKETS 256
+// Blocks kept in memory, for all devices together
+#define BCACHE_MAX_BLOCKS 1024
+// How long a block may stay dirty, in timer ticks
+#define BCACHE_FLUSH_TICKS (5*TIMER_FREQ)
+// Most blocks read from or written to a device at once
+#define BCACHE_IO_BLOCKS 16
+
+/* A block device whose blocks go through the buffer cache. `fs` holds the
+ * device itself, for its functions to find it where they expect it.
+ */
+typedef struct bcache_t {
+    fs_t fs;
+    uint32_t block_size;
+    uint8_t* io_buffer; // Uncached, `BCACHE_IO_BLOCKS` blocks the device transfers with
+} bcache_t;
+
+void init_bcache();
+fs_device_t bcache_new(fs_device_t device, uint32_t block_size);
+void bcache_sync();
+void bcache_flush_old();
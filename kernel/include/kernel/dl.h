@@ -0,0 +1,60 @@
+#pragma once
+
+#include <kernel/elf.h>
+#include <kernel/fs.h>
+
+#include <list.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Where shared libraries are looked up
+#define DL_LIBRARY_DIR "/lib/"
+
+// Range of addresses libraries are loaded at, above the program's heap
+#define DL_BASE 0x40000000
+#define DL_END 0xB0000000
+
+// Bounds of the exec cache, see `dl.c`
+#define DL_CACHE_IMAGES 16
+#define DL_CACHE_PAGES 1024
+
+struct _proc_t;
+
+/* An executable or a shared library, with what's needed to link it.
+ */
+typedef struct {
+    char* name;
+    inode_t* inode;
+    elf_header_t header;
+    elf_program_header_t* segments;
+    uintptr_t base; // Added to the addresses of the file, zero for executables
+    elf_dynamic_t* dynamic;
+    uint32_t num_dynamic;
+    uint32_t* hash; // The symbol hash table, see `dl_find_symbol`
+    elf_symbol_t* symbols;
+    uint32_t num_symbols;
+    char* strings;
+    uint32_t strings_size;
+    elf_rel_t* rels;
+    uint32_t num_rels;
+    uintptr_t* values; // Address each relocation's symbol resolved to
+} dl_object_t;
+
+/* An executable and the libraries it needs, ready to be relocated. Images
+ * stay cached after use, see `dl_load`.
+ */
+typedef struct {
+    list_t objects; // The executable, then libraries in the order they're needed
+    uint32_t refs; // Execs using the image
+    bool cached;
+} dl_image_t;
+
+void init_dl();
+dl_image_t* dl_load(const char* path);
+void dl_relocate(dl_image_t* image, struct _proc_t* process);
+void dl_release(dl_image_t* image);
+uint8_t* dl_cache_get_page(inode_t* inode, uintptr_t page, bool map, uint32_t* generation);
+uint8_t* dl_cache_add_page(inode_t* inode, uintptr_t page, uint8_t* data, bool map,
+    uint32_t generation);
+void dl_cache_unmap_page(inode_t* inode, uintptr_t page, uintptr_t frame);
+void dl_invalidate(inode_t* inode);
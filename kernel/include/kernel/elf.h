@@ -0,0 +1,103 @@
+#pragma once
+
+#include <kernel/fs.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define ELF_MAGIC 0x464C457F // "\x7FELF", little-endian
+
+#define ELF_CLASS_32 1
+#define ELF_DATA_LSB 1
+#define ELF_TYPE_EXEC 2
+#define ELF_TYPE_DYN 3 // Shared objects
+#define ELF_MACHINE_386 3
+
+#define ELF_PT_LOAD 1
+#define ELF_PT_DYNAMIC 2
+
+#define ELF_PF_X 0x1
+#define ELF_PF_W 0x2
+#define ELF_PF_R 0x4
+
+// Tags of the dynamic section
+#define ELF_DT_NULL 0
+#define ELF_DT_NEEDED 1
+#define ELF_DT_PLTRELSZ 2
+#define ELF_DT_HASH 4
+#define ELF_DT_STRTAB 5
+#define ELF_DT_SYMTAB 6
+#define ELF_DT_STRSZ 10
+#define ELF_DT_REL 17
+#define ELF_DT_RELSZ 18
+#define ELF_DT_TEXTREL 22
+#define ELF_DT_JMPREL 23
+
+#define ELF_R_386_32 1
+#define ELF_R_386_PC32 2
+#define ELF_R_386_COPY 5
+#define ELF_R_386_GLOB_DAT 6
+#define ELF_R_386_JMP_SLOT 7
+#define ELF_R_386_RELATIVE 8
+
+#define ELF_R_SYM(info) ((info) >> 8)
+#define ELF_R_TYPE(info) ((info) & 0xFF)
+
+#define ELF_STB_LOCAL 0
+#define ELF_STB_WEAK 2
+#define ELF_ST_BIND(info) ((info) >> 4)
+
+#define ELF_SHN_UNDEF 0
+
+typedef struct {
+    uint32_t magic;
+    uint8_t class;
+    uint8_t data;
+    uint8_t ident_version;
+    uint8_t ident_pad[9];
+    uint16_t type;
+    uint16_t machine;
+    uint32_t version;
+    uint32_t entry;
+    uint32_t phoff;
+    uint32_t shoff;
+    uint32_t flags;
+    uint16_t ehsize;
+    uint16_t phentsize;
+    uint16_t phnum;
+    uint16_t shentsize;
+    uint16_t shnum;
+    uint16_t shstrndx;
+} __attribute__((packed)) elf_header_t;
+
+typedef struct {
+    uint32_t type;
+    uint32_t offset;
+    uint32_t vaddr;
+    uint32_t paddr;
+    uint32_t filesz;
+    uint32_t memsz;
+    uint32_t flags;
+    uint32_t align;
+} __attribute__((packed)) elf_program_header_t;
+
+typedef struct {
+    int32_t tag;
+    uint32_t value;
+} __attribute__((packed)) elf_dynamic_t;
+
+typedef struct {
+    uint32_t name;
+    uint32_t value;
+    uint32_t size;
+    uint8_t info;
+    uint8_t other;
+    uint16_t shndx;
+} __attribute__((packed)) elf_symbol_t;
+
+typedef struct {
+    uint32_t offset;
+    uint32_t info;
+} __attribute__((packed)) elf_rel_t;
+
+elf_program_header_t* elf_read_headers(inode_t* in, elf_header_t* header, uint16_t type);
@@ -5,6 +5,8 @@
 #include <stdint.h>
 
 void init_fpu();
+void fpu_init_cpu();
 void fpu_switch(process_t* prev, const process_t* next);
-void fpu_kernel_enter();
-void fpu_kernel_exit();
\ No newline at end of file
+void fpu_exit_process(process_t* proc);
+void fpu_kernel_begin();
+void fpu_kernel_end();
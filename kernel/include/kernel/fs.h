@@ -34,11 +34,26 @@ typedef struct folder_inode_t {
     list_t subfiles;
 } folder_inode_t;
 
+/* Where a listing of a directory is at, see `fs_getdents`. Zeroed, it starts
+ * at the first entry.
+ */
+typedef struct {
+    uint32_t index; // Number of entries listed so far
+    list_t* node; // That of the last entry listed, unless `generation` is stale
+    uint32_t generation;
+} fs_dir_cursor_t;
+
 typedef struct fs_device_t {
     void* underlying_device; // e.g. sata_device_t*, raw memory...
     void (*read_block)(struct fs_t*, uint32_t, uint8_t*);
     void (*write_block)(struct fs_t*, uint32_t, uint8_t*);
     void (*clear_block)(struct fs_t*, uint32_t);
+    // Reads `count` consecutive blocks, starting at the given one
+    void (*read_blocks)(struct fs_t*, uint32_t, uint32_t, uint8_t*);
+    // Writes `count` consecutive blocks, starting at the given one
+    void (*write_blocks)(struct fs_t*, uint32_t, uint32_t, uint8_t*);
+    // Optional, starts reading blocks like `read_blocks` that will be needed soon
+    void (*prefetch)(struct fs_t*, uint32_t, uint32_t);
 } fs_device_t;
 
 typedef struct fs_t {
@@ -46,10 +61,12 @@ typedef struct fs_t {
     fs_device_t device;
     uint32_t uid;
     uint32_t (*create)(struct fs_t*, const char*, uint32_t, uint32_t);
-    int32_t (*rename)(struct fs_t*, uint32_t, uint32_t, uint32_t);
+    int32_t (*rename)(struct fs_t*, uint32_t, uint32_t, uint32_t, const char*);
     int32_t (*unlink)(struct fs_t*, uint32_t, uint32_t);
     uint32_t (*read)(struct fs_t*, uint32_t, uint32_t, uint8_t*, uint32_t);
     uint32_t (*append)(struct fs_t*, uint32_t, uint8_t*, uint32_t);
+    // Optional, writes at an offset, growing the file if needed
+    uint32_t (*write)(struct fs_t*, uint32_t, uint32_t, uint8_t*, uint32_t);
     /* TODO: require null termination of entries */
     sos_directory_entry_t* (*readdir)(struct fs_t*, uint32_t, uint32_t);
     inode_t* (*get_fs_inode)(struct fs_t*, uint32_t);
@@ -60,16 +77,17 @@ typedef struct fs_t {
 typedef inode_t* (*fs_get_fs_inode_t)(struct fs_t*, uint32_t);
 typedef sos_directory_entry_t* (*fs_readdir_t)(struct fs_t*, uint32_t, uint32_t);
 typedef uint32_t (*fs_append_t)(struct fs_t*, uint32_t, uint8_t*, uint32_t);
+typedef uint32_t (*fs_write_t)(struct fs_t*, uint32_t, uint32_t, uint8_t*, uint32_t);
 typedef uint32_t (*fs_read_t)(struct fs_t*, uint32_t, uint32_t, uint8_t*, uint32_t);
 typedef int32_t (*fs_unlink_t)(struct fs_t*, uint32_t, uint32_t);
-typedef int32_t (*fs_rename_t)(struct fs_t*, uint32_t, uint32_t, uint32_t);
+typedef int32_t (*fs_rename_t)(struct fs_t*, uint32_t, uint32_t, uint32_t, const char*);
 typedef uint32_t (*fs_create_t)(struct fs_t*, const char*, uint32_t, uint32_t);
 typedef int32_t (*fs_close_t)(struct fs_t*, uint32_t);
 typedef int32_t (*fs_stat_t)(struct fs_t*, uint32_t, stat_t*);
 
 void init_fs(fs_t* fs);
 void fs_mount(const char* mount_point, fs_t* fs);
-char* fs_normalize_path(const char* p);
+bool fs_normalize_path(const char* p, char* np);
 inode_t* fs_open(const char* path, uint32_t mode);
 uint32_t fs_mkdir(const char* path, uint32_t mode);
 int32_t fs_unlink(const char* path);
@@ -77,5 +95,9 @@ int32_t fs_rename(const char* oldp, const char* newp);
 int32_t fs_close(inode_t* in);
 uint32_t fs_read(inode_t* in, uint32_t offset, uint8_t* buf, uint32_t size);
 uint32_t fs_write(inode_t* in, uint8_t* buf, uint32_t size);
-uint32_t fs_readdir(inode_t* in, uint32_t offset, sos_directory_entry_t* d_ent, uint32_t size);
-int32_t fs_stat(const char* path, stat_t* buf);
\ No newline at end of file
+uint32_t fs_pwrite(inode_t* in, uint32_t offset, uint8_t* buf, uint32_t size);
+uint32_t fs_readdir(inode_t* in, fs_dir_cursor_t* cursor, sos_directory_entry_t* d_ent, uint32_t size);
+uint32_t fs_getdents(inode_t* in, fs_dir_cursor_t* cursor, sos_dirent_t* buf, uint32_t size,
+    uint32_t flags);
+int32_t fs_stat(const char* path, stat_t* buf);
+void fs_sync();
\ No newline at end of file
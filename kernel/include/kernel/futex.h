@@ -0,0 +1,7 @@
+#pragma once
+
+#include <stdint.h>
+
+void init_futex();
+int32_t futex_wait(uint32_t* uaddr, uint32_t val);
+uint32_t futex_wake(uint32_t* uaddr, uint32_t count);
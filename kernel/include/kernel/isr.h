@@ -46,4 +46,7 @@ extern void isr28();
 extern void isr29();
 extern void isr30();
 extern void isr31();
-extern void isr48();
\ No newline at end of file
+extern void isr48();
+extern void isr240();
+extern void isr241();
+extern void isr255();
\ No newline at end of file
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define LAPIC_VECTOR_TIMER 0xF0
+#define LAPIC_VECTOR_TLB 0xF1
+#define LAPIC_VECTOR_SPURIOUS 0xFF
+
+// Register offsets
+#define LAPIC_ID 0x20
+#define LAPIC_TPR 0x80
+#define LAPIC_EOI 0xB0
+#define LAPIC_SVR 0xF0
+#define LAPIC_ESR 0x280
+#define LAPIC_ICR_LOW 0x300
+#define LAPIC_ICR_HIGH 0x310
+#define LAPIC_LVT_TIMER 0x320
+#define LAPIC_LVT_LINT0 0x350
+#define LAPIC_LVT_LINT1 0x360
+#define LAPIC_LVT_ERROR 0x370
+#define LAPIC_TIMER_INIT 0x380
+#define LAPIC_TIMER_CURRENT 0x390
+#define LAPIC_TIMER_DIV 0x3E0
+
+// Register bits
+#define LAPIC_SVR_ENABLE (1 << 8)
+#define LAPIC_LVT_MASKED (1 << 16)
+#define LAPIC_LVT_EXTINT (7 << 8)
+#define LAPIC_LVT_NMI (4 << 8)
+#define LAPIC_TIMER_PERIODIC (1 << 17)
+#define LAPIC_ICR_INIT (5 << 8)
+#define LAPIC_ICR_STARTUP (6 << 8)
+#define LAPIC_ICR_PENDING (1 << 12)
+#define LAPIC_ICR_ASSERT (1 << 14)
+
+bool lapic_available();
+void init_lapic(uintptr_t phys);
+void lapic_init_cpu(bool bsp);
+void lapic_timer_start();
+uint32_t lapic_id();
+void lapic_eoi();
+void lapic_send_ipi(uint32_t apic_id, uint32_t vector);
+void lapic_send_init(uint32_t apic_id);
+void lapic_send_startup(uint32_t apic_id, uintptr_t trampoline);
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <kernel/smp.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Intel's MultiProcessor Specification tables, which predate ACPI and are used
+ * as a fallback when no MADT can be found.
+ */
+
+typedef struct {
+    char signature[4]; // "_MP_"
+    uint32_t config;
+    uint8_t length; // In 16 bytes units
+    uint8_t revision;
+    uint8_t checksum;
+    uint8_t features[5];
+} __attribute__((packed)) mp_floating_pointer_t;
+
+typedef struct {
+    char signature[4]; // "PCMP"
+    uint16_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[8];
+    char product_id[12];
+    uint32_t oem_table;
+    uint16_t oem_table_size;
+    uint16_t entry_count;
+    uint32_t lapic_address;
+    uint16_t extended_length;
+    uint8_t extended_checksum;
+    uint8_t reserved;
+} __attribute__((packed)) mp_config_t;
+
+#define MP_ENTRY_PROCESSOR 0
+
+typedef struct {
+    uint8_t type;
+    uint8_t apic_id;
+    uint8_t apic_version;
+    uint8_t flags;
+    uint32_t signature;
+    uint32_t features;
+    uint32_t reserved[2];
+} __attribute__((packed)) mp_processor_t;
+
+#define MP_PROCESSOR_ENABLED 1
+
+bool mp_find_cpus(smp_config_t* config);
@@ -1,6 +1,9 @@
 #pragma once
 
+#include <kernel/dl.h>
 #include <kernel/fs.h>
+#include <kernel/spinlock.h>
+#include <kernel/uapi/uapi_syscall.h>
 
 #include <list.h>
 #include <stdint.h>
@@ -9,17 +12,44 @@
 #define PROC_STACK_PAGES 4
 #define PROC_KERNEL_STACK_PAGES 1
 #define PROC_MAX_FD 1024
+// Lowest descriptor handed out by `open` and `dup`: zero reports failures,
+// and standard streams are only set up explicitly
+#define PROC_FIRST_FD 3
 
+// Flags of `strace`: whether the process's system calls are logged, and
+// whether those of the processes it starts are, see `syscall_handler`
+#define PROC_STRACE 1
+#define PROC_STRACE_CHILDREN 2
+
+/* An open file, shared by the descriptors `dup` made and with the processes
+ * `exec` started.
+ */
 typedef struct {
-    uint32_t fd;
     inode_t* inode;
     uint32_t mode;
     uint32_t offset;
     uint32_t size;
-    uint32_t index; // If it's a directory, where we're at
+    fs_dir_cursor_t cursor; // If it's a directory, where we're at
     uint32_t refcount;
 } ft_entry_t;
 
+/* A part of a process's address space whose pages are only mapped when first
+ * touched, see `proc_handle_fault`. `[start, end)` is page-aligned; the
+ * `file_size` bytes at `vaddr` are read from `inode` at `offset`, and the rest
+ * is zeroed.
+ */
+typedef struct {
+    uintptr_t start;
+    uintptr_t end;
+    uint32_t flags; // Page flags to map with, `PAGE_SHARED` if read-only
+    inode_t* inode; // The VFS keeps it around as long as the file exists
+    uintptr_t vaddr;
+    uint32_t offset;
+    uint32_t file_size;
+    uintptr_t base; // Where the file's object is loaded, see `dl_object_t`
+    char* name; // File name of the object, for profiles
+} proc_region_t;
+
 // Add new members to the end to avoid messing with the offsets
 typedef struct _proc_t {
     uint32_t pid;
@@ -35,9 +65,48 @@ typedef struct _proc_t {
     uintptr_t initial_user_stack;
     uint32_t mem_len; // Size of program heap in bytes
     uint32_t sleep_ticks;
-    uint8_t fpu_registers[512];
-    list_t filetable;
-    char* cwd;
+    uint8_t fpu_registers[512] __attribute__((aligned(16)));
+    char cwd[MAX_PATH];
+    char name[SYS_PROC_NAME_LEN];
+    // Accounting, see `sys_proc_info_t`
+    uint32_t run_ticks;
+    uint32_t voluntary_switches;
+    uint32_t involuntary_switches;
+    uint32_t syscalls;
+    uint32_t page_faults;
+    uint32_t resident_pages;
+    // Set while a CPU runs the process or is about to; cleared by the context
+    // switch once its state is saved, see `proc.S`
+    volatile uint32_t on_cpu;
+    // Thread owning the address space, filetable and working directory that
+    // this one uses; the process itself for a main thread
+    struct _proc_t* leader;
+    // Threads still running with the leader's resources, leader included
+    uint32_t num_threads;
+    // Threads pointing to this leader that aren't freed yet, leader excluded
+    uint32_t thread_refs;
+    // Set while waiting on a futex, see `futex.c`
+    volatile bool blocked;
+    // User address cleared and woken up when the thread exits, see `proc_clone`
+    uintptr_t clear_tid;
+    // Whether `fpu_registers` holds a state to restore, see `fpu.c`
+    bool fpu_initialized;
+    // Set while the FPU state lives in its CPU's registers rather than in
+    // `fpu_registers`; the process can't move to another CPU then
+    volatile bool fpu_live;
+    // Demand-paged segments of the executable and its libraries, see
+    // `proc_handle_fault`
+    list_t regions;
+    // Guards the leader's page tables against its other threads
+    spinlock_t mem_lock;
+    // Open files indexed by descriptor, with a bitmap of the slots in use, so
+    // that the lowest free descriptor is quick to find; grown as needed up to
+    // `PROC_MAX_FD`, see `proc_alloc_fd`
+    ft_entry_t** fds;
+    uint32_t* used_fds;
+    uint32_t num_fds; // Size of `fds`, a multiple of 32
+    spinlock_t fd_lock; // Guards the above
+    uint32_t strace; // `PROC_STRACE` flags, on leaders
 } process_t;
 
 /* This structure defines the interface of schedulers in SnowflakeOS.
@@ -49,7 +118,8 @@ typedef struct _sched_t {
     void (*sched_add)(struct _sched_t*, process_t*);
     /* Returns the next process that should be run, depending to the specific
        scheduler implemented. Note that it can choose not to change process by
-       returning the currently executing process */
+       returning the currently executing process, and that it returns NULL if
+       no process can run. Blocked processes must be skipped */
     process_t* (*sched_next)(struct _sched_t*);
     /* Removes a process from the process pool. Basically the inverse of
      * `sched_add`. If the removed process was the one currently executing, the
@@ -57,28 +127,44 @@ typedef struct _sched_t {
      * right after.
      */
     void (*sched_exit)(struct _sched_t*, process_t*);
+    /* Removes and returns a process that is neither running, sleeping,
+     * blocked nor holding its CPU's FPU, for another CPU to run. Returns NULL
+     * if there is no such process. */
+    process_t* (*sched_steal)(struct _sched_t*);
 } sched_t;
 
 void init_proc();
-process_t* proc_run_code(uint8_t* code, uint32_t size, char** argv);
+process_t* proc_run_image(dl_image_t* image, char** argv);
+int32_t proc_clone(uintptr_t entry, uintptr_t stack, uintptr_t arg, uintptr_t tid_addr);
 void proc_print_processes();
 void proc_schedule();
 void proc_timer_callback();
 void proc_exit();
-void proc_enter_usermode();
+bool proc_handle_fault(uintptr_t addr);
+bool proc_set_strace(uint32_t pid, bool enabled);
+uint32_t proc_count_traced();
+void proc_populate(process_t* process, uintptr_t addr, uint32_t size);
+bool proc_fault_in(const void* addr, uint32_t size, bool write);
+void proc_enter_scheduler();
 void proc_switch_process(process_t* next);
 uint32_t proc_get_current_pid();
-char* proc_get_cwd();
-void proc_add_fd(ft_entry_t* entry);
+process_t* proc_get_current();
+uint32_t proc_get_info(sys_proc_info_t* buf, uint32_t count);
+const char* proc_get_cwd();
+void proc_add_fd(uint32_t fd, ft_entry_t* entry);
 
 void proc_sleep(uint32_t ms);
 void* proc_sbrk(intptr_t size);
 int32_t proc_exec(const char* path, char** argv);
 uint32_t proc_open(const char* path, uint32_t flags);
 void proc_close(uint32_t fd);
+int32_t proc_dup(uint32_t fd);
+int32_t proc_dup2(uint32_t fd, uint32_t new_fd);
 uint32_t proc_read(uint32_t fd, uint8_t* buf, uint32_t size);
 int32_t proc_readdir(uint32_t fd, sos_directory_entry_t* dent);
+int32_t proc_getdents(uint32_t fd, sos_dirent_t* buf, uint32_t size, uint32_t flags);
 uint32_t proc_write(uint32_t fd, uint8_t* buf, uint32_t size);
+uint32_t proc_pwrite(uint32_t fd, uint8_t* buf, uint32_t size, uint32_t offset);
 int32_t proc_fseek(uint32_t fd, int32_t offset, uint32_t whence);
 int32_t proc_ftell(uint32_t fd);
 int32_t proc_chdir(const char* path);
\ No newline at end of file
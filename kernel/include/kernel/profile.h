@@ -0,0 +1,21 @@
+#pragma once
+
+#include <kernel/isr.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Size of the sample buffer, filled at each CPU's scheduler tick
+#define PROFILE_NUM_SAMPLES 4096
+// Frames kept per sample, the interrupted one included
+#define PROFILE_MAX_DEPTH 16
+// Processes and objects that samples can name
+#define PROFILE_MAX_NAMES 64
+
+// Where user symbol maps are, as "<object name>.map"
+#define PROFILE_SYMBOLS_DIR "/symbols/"
+
+void profile_start(bool stacks);
+void profile_stop();
+void profile_sample(registers_t* regs);
+void profile_dump();
@@ -2,6 +2,8 @@
 
 #include <kernel/fs.h>
 
+#define RAMFS_BLOCK_SIZE 1024
+
 typedef struct ramfs_t {
     uint8_t* data;
     uint32_t size;
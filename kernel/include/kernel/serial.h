@@ -13,5 +13,7 @@
 
 void init_serial();
 char serial_read();
+void serial_send(char c);
+void serial_send_string(const char* str);
 void serial_write(char c);
 char* serial_get_log();
\ No newline at end of file
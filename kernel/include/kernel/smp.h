@@ -0,0 +1,49 @@
+#pragma once
+
+#include <kernel/multiboot2.h>
+#include <kernel/proc.h>
+#include <kernel/spinlock.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define SMP_MAX_CPUS 8
+
+// Physical address application processors start executing at, see `smp.S`
+#define SMP_TRAMPOLINE 0x8000
+
+/* What the firmware tells us about the processors of the machine.
+ */
+typedef struct {
+    uintptr_t lapic_address;
+    uint32_t num_cpus;
+    uint8_t apic_ids[SMP_MAX_CPUS];
+} smp_config_t;
+
+/* Per-CPU data. `cpus[0]` always describes the bootstrap processor.
+ */
+typedef struct {
+    uint32_t id; // Index in the CPU array, also used to find our TSS
+    uint32_t apic_id;
+    volatile bool started;
+    process_t* process; // Process currently running on this CPU
+    process_t* idle; // Runs when the scheduler has nothing to offer
+    sched_t* scheduler; // This CPU's run queue, guarded by `sched_lock`
+    spinlock_t sched_lock;
+    volatile uint32_t tlb_flush_pending;
+    // Process whose state is in the FPU registers, if any, see `fpu.c`
+    process_t* fpu_owner;
+    // Kernel page used to fill demand-paged frames, see `proc_handle_fault`
+    uintptr_t fault_window;
+    // Spinlocks held, a process mustn't be killed while there are any
+    uint32_t locks_held;
+} cpu_t;
+
+void init_smp(mb2_t* boot);
+void smp_start_aps();
+uint32_t smp_cpu_id();
+uint32_t smp_num_cpus();
+cpu_t* smp_get_cpu(uint32_t id);
+cpu_t* smp_current_cpu();
+void smp_tlb_shootdown(uintptr_t virt);
+void smp_handle_tlb_shootdown();
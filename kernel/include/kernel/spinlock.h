@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdint.h>
+
+/* A spinlock that can be taken again by the CPU already holding it, which
+ * keeps code paths that call each other, like the VFS, simple.
+ * Interrupts are disabled on the holding CPU for as long as the lock is held,
+ * so that an interrupt handler can't try to take a lock its CPU already holds.
+ */
+typedef struct {
+    volatile uint32_t locked;
+    uint32_t owner; // Index of the holding CPU
+    uint32_t depth;
+    uint32_t eflags; // Flags of the holding CPU before it took the lock
+} spinlock_t;
+
+#define SPINLOCK_NO_OWNER 0xFFFFFFFF
+#define SPINLOCK_INIT { 0, SPINLOCK_NO_OWNER, 0, 0 }
+
+void spinlock_acquire(spinlock_t* lock);
+void spinlock_release(spinlock_t* lock);
@@ -1,6 +1,20 @@
 #pragma once
 
+#include <stdbool.h>
 #include <stdint.h>
 
+/* Symbols of an object sorted by address, see `symbol_table_init`.
+ */
+typedef struct {
+    uintptr_t* addrs;
+    char** names; // Pointing into `strings`
+    char* strings;
+    uint32_t count;
+} symbol_table_t;
+
 void init_stacktrace(uint8_t* data, uint32_t size);
-void stacktrace_print();
\ No newline at end of file
+void stacktrace_print();
+bool symbol_table_init(symbol_table_t* table, char* data, uint32_t size);
+void symbol_table_free(symbol_table_t* table);
+const char* symbol_table_find(symbol_table_t* table, uintptr_t* addr);
+const char* symbol_for_addr(uintptr_t* addr);
\ No newline at end of file
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -41,6 +42,16 @@ static uint32_t divide_up(uint32_t n, uint32_t d) {
     return 1 + n / d;
 }
 
+/* Reads the time stamp counter, which must exist, see `timer.c`.
+ */
+static inline uint64_t rdtsc() {
+    uint32_t low, high;
+
+    asm volatile ("rdtsc" : "=a" (low), "=d" (high));
+
+    return ((uint64_t) high << 32) | low;
+}
+
 /* Dumps any contiguous memory structure's bytes as a string of hex octets with
  * position numbers to aid in debugging efforts.
  */
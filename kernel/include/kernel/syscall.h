@@ -7,4 +7,6 @@
 #define SYSCALL_NUM 64
 
 void init_syscall();
+void syscall_init_cpu();
+void syscall_handler(registers_t* regs);
 void syscall_register_handler(uint32_t num, handler_t handler);
\ No newline at end of file
@@ -2,10 +2,14 @@
 
 #include <kernel/irq.h>
 
+#include <kernel/uapi/uapi_time.h>
+
 void init_timer();
 void timer_callback();
 uint32_t timer_get_tick();
 float timer_get_time();
+uintptr_t timer_get_time_page();
+const sys_time_page_t* timer_get_time_info();
 void timer_register_callback(handler_t handler);
 void timer_remove_callback(handler_t handler);
 
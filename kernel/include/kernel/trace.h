@@ -0,0 +1,47 @@
+#pragma once
+
+#include <kernel/uapi/uapi_trace.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Tracepoints compile to nothing unless this is set, see `TRACING` in the
+ * top-level Makefile.
+ */
+#ifndef TRACE_ENABLED
+#define TRACE_ENABLED 1
+#endif
+
+// Size of the ring of events; older ones are overwritten
+#define TRACE_NUM_EVENTS 16384
+
+typedef struct {
+    uint64_t tsc;
+    uint8_t category;
+    uint8_t phase;
+    uint8_t cpu;
+    uint8_t unused;
+    uint32_t pid;
+    uint32_t args[2];
+} trace_event_t;
+
+extern volatile uint32_t trace_mask;
+
+void init_trace();
+void trace_record(uint32_t category, uint32_t phase, uint32_t arg0, uint32_t arg1);
+uint32_t trace_set_mask(uint32_t mask);
+void trace_dump();
+
+/* Records an event if its category is enabled. Costs a load and a branch when
+ * it isn't.
+ */
+#if TRACE_ENABLED
+#define TRACE(category, phase, arg0, arg1) \
+    do { \
+        if (__builtin_expect(trace_mask & (category), 0)) { \
+            trace_record((category), (phase), (arg0), (arg1)); \
+        } \
+    } while (0)
+#else
+#define TRACE(category, phase, arg0, arg1) do { } while (0)
+#endif
@@ -24,6 +24,8 @@
 
 #define FS_STDOUT_FILENO 1
 
+#define GETDENTS_STAT 1 // Also fill in sizes, modes and link counts
+
 typedef struct {
     uint32_t inode;
     uint16_t entry_size;
@@ -38,4 +40,20 @@ typedef struct stat_t {
     uint32_t st_mode;
     uint32_t st_nlink;
     uint32_t st_size;
-} stat_t;
\ No newline at end of file
+} stat_t;
+
+/* A directory entry as listed by `SYS_GETDENTS`. Entries are packed one after
+ * the other, `entry_size` bytes apart; `name` is null-terminated. `size`,
+ * `mode` and `nlink` are those `stat` would return with `GETDENTS_STAT`, zero
+ * otherwise.
+ */
+typedef struct {
+    uint32_t inode;
+    uint32_t size;
+    uint32_t mode;
+    uint32_t nlink;
+    uint16_t entry_size;
+    uint8_t type;
+    uint8_t name_len;
+    char name[];
+} sos_dirent_t;
\ No newline at end of file
@@ -26,12 +26,48 @@
 #define SYS_RENAME 20
 #define SYS_MAKETTY 21
 #define SYS_STAT 22
-#define SYS_MAX 23 // First invalid syscall number
+#define SYS_PROCINFO 23
+#define SYS_CLONE 24
+#define SYS_FUTEX 25
+#define SYS_GETPID 26
+#define SYS_DUP 27
+#define SYS_DUP2 28
+#define SYS_RING_ENTER 29
+#define SYS_TRACE 30
+#define SYS_PROFILE 31
+#define SYS_STRACE 32
+#define SYS_GETDENTS 33
+#define SYS_SYNC 34
+#define SYS_PWRITE 35
+#define SYS_MAX 36 // First invalid syscall number
 
 #define SYS_INFO_UPTIME 1
 #define SYS_INFO_MEMORY 2
 #define SYS_INFO_LOG    4
 
+#define SYS_FUTEX_WAIT 0
+#define SYS_FUTEX_WAKE 1
+
+#define SYS_RING_MAX_SIZE 4096
+
+#define SYS_TRACE_SET_MASK 0
+#define SYS_TRACE_DUMP 1
+
+#define SYS_PROFILE_START 0
+#define SYS_PROFILE_STOP 1
+#define SYS_PROFILE_DUMP 2
+#define SYS_PROFILE_STACKS 1 // Walk frame pointers, flag of `SYS_PROFILE_START`
+
+#define SYS_STRACE_STATS 0
+#define SYS_STRACE_RESET 1
+#define SYS_STRACE_ATTACH 2
+#define SYS_STRACE_DETACH 3
+#define SYS_STRACE_CHILDREN 4
+#define SYS_STRACE_READ 5
+#define SYS_STRACE_TRACED 6
+
+#define SYS_STRACE_BUCKETS 32
+
 typedef struct {
     uint32_t kernel_heap_usage;
     uint32_t kernel_heap_total;
@@ -41,7 +77,78 @@ typedef struct {
     char* kernel_log; // Must be at least 2048 bytes long
 } sys_info_t;
 
+#define SYS_PROC_NAME_LEN 32
+
+/* Per-process accounting, as reported by `SYS_PROCINFO`.
+ * `run_ticks` counts timer ticks during which the process was running.
+ */
+typedef struct {
+    uint32_t pid;
+    char name[SYS_PROC_NAME_LEN];
+    uint32_t run_ticks;
+    uint32_t voluntary_switches;
+    uint32_t involuntary_switches;
+    uint32_t syscalls;
+    uint32_t page_faults;
+    uint32_t resident_pages;
+} sys_proc_info_t;
+
 typedef struct {
     uint8_t* buf;
     uint32_t size;
-} sys_buf_t;
\ No newline at end of file
+} sys_buf_t;
+
+/* Latency of a system call since boot or the last `SYS_STRACE_RESET`, in time
+ * stamp counter cycles. Bucket `i` of the histogram counts calls that took
+ * from 2^i to 2^(i+1) - 1 cycles, the first one also those that took none.
+ */
+typedef struct {
+    uint32_t count;
+    uint64_t cycles;
+    uint64_t max_cycles;
+    uint32_t histogram[SYS_STRACE_BUCKETS];
+} sys_syscall_stats_t;
+
+/* A system call made by a traced process, as read with `SYS_STRACE_READ`.
+ * `cycles` saturates at 0xFFFFFFFF.
+ */
+typedef struct {
+    uint32_t pid;
+    uint32_t syscall;
+    uint32_t args[3];
+    int32_t result;
+    uint32_t cycles;
+} sys_strace_entry_t;
+
+/* A system call queued in a submission ring: `syscall` is one of `SYS_READ`,
+ * `SYS_WRITE`, `SYS_READDIR`, `SYS_STAT`, `SYS_OPEN`, `SYS_CLOSE`, or
+ * `SYS_WM` with `WM_CMD_RENDER` or `WM_CMD_EVENT`, and `args` are what it
+ * takes in ebx, ecx and edx.
+ */
+typedef struct {
+    uint32_t syscall;
+    uint32_t args[3];
+    uint32_t user_data; // Copied to the completion
+} sys_ring_sqe_t;
+
+/* The outcome of a submitted system call, what it returns in eax.
+ */
+typedef struct {
+    uint32_t user_data;
+    int32_t result;
+} sys_ring_cqe_t;
+
+/* A pair of rings in process memory, see `SYS_RING_ENTER`. The process queues
+ * submissions at `sq_tail` and reaps completions from `cq_head`, the kernel
+ * consumes the former and posts the latter. Indices are free-running, taken
+ * modulo `size`, which is a power of two.
+ */
+typedef struct {
+    uint32_t size;
+    volatile uint32_t sq_head;
+    volatile uint32_t sq_tail;
+    volatile uint32_t cq_head;
+    volatile uint32_t cq_tail;
+    sys_ring_sqe_t* sqes;
+    sys_ring_cqe_t* cqes;
+} sys_ring_t;
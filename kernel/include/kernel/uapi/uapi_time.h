@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdint.h>
+
+// Where the time page is mapped, read-only, in every process
+#define TIME_PAGE_ADDR 0xBFF00000
+
+/* Kept up to date by the kernel so that processes can tell the time without
+ * system calls. Nanoseconds since boot are:
+ *     ((rdtsc() - tsc_base) * tsc_mult) >> tsc_shift
+ * when `tsc_mult` isn't zero, and derived from `ticks` otherwise.
+ * Only `ticks` changes after boot, and it's written atomically.
+ */
+typedef struct {
+    volatile uint32_t ticks; // Timer ticks since boot
+    uint32_t tick_freq; // In Hz
+    uint64_t tsc_base; // Time stamp counter at boot
+    uint32_t tsc_mult; // Zero if the time stamp counter isn't usable
+    uint32_t tsc_shift;
+} sys_time_page_t;
@@ -0,0 +1,15 @@
+#pragma once
+
+// Categories of kernel trace events, see `SYS_TRACE`
+#define TRACE_IRQ     (1 << 0) // IRQ number
+#define TRACE_SYSCALL (1 << 1) // Syscall number, first argument then result
+#define TRACE_SWITCH  (1 << 2) // Previous pid, next pid
+#define TRACE_FAULT   (1 << 3) // Address, error code
+#define TRACE_RENDER  (1 << 4) // Window id
+#define TRACE_BLOCK   (1 << 5) // Block number, whether it's a write
+#define TRACE_ALL     0x3F
+
+// Whether an event starts or ends something, or stands alone
+#define TRACE_BEGIN 0
+#define TRACE_END 1
+#define TRACE_INSTANT 2
@@ -36,6 +36,7 @@ void wm_render_window(uint32_t win_id, rect_t* clip);
 void wm_get_event(uint32_t win_id, wm_event_t* event);
 
 bool wm_is_titlebar_being_hovered(wm_window_t* win);
+bool wm_is_window_titlebar_hovered(uint32_t win_id);
 list_t* wm_get_window(uint32_t id);
 
 // rect-handling functions
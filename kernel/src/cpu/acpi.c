@@ -0,0 +1,124 @@
+#include <kernel/acpi.h>
+#include <kernel/paging.h>
+#include <kernel/sys.h>
+
+#include <string.h>
+
+acpi_rsdp1_t* acpi_find_rsdp(mb2_t* boot);
+acpi_sdt_header_t* acpi_map_table(uintptr_t phys);
+bool acpi_checksum(void* table, uint32_t size);
+
+/* This file only cares about the little of ACPI needed to enumerate the
+ * processors of the machine: the MADT, found through the RSDT.
+ */
+
+/* Fills `config` with the local APICs listed in the MADT.
+ * Returns false if there is no usable MADT.
+ */
+bool acpi_find_cpus(mb2_t* boot, smp_config_t* config) {
+    acpi_rsdp1_t* rsdp = acpi_find_rsdp(boot);
+
+    if (!rsdp) {
+        return false;
+    }
+
+    acpi_sdt_header_t* rsdt = acpi_map_table(rsdp->rsdt_addr);
+
+    if (!rsdt || strncmp(rsdt->signature, "RSDT", 4)) {
+        printke("invalid RSDT");
+        return false;
+    }
+
+    uint32_t num_tables = (rsdt->length - sizeof(acpi_sdt_header_t)) / 4;
+    uint32_t* tables = (uint32_t*) (rsdt + 1);
+    acpi_madt_t* madt = NULL;
+
+    for (uint32_t i = 0; i < num_tables && !madt; i++) {
+        acpi_sdt_header_t* table = acpi_map_table(tables[i]);
+
+        if (table && !strncmp(table->signature, "APIC", 4)) {
+            madt = (acpi_madt_t*) table;
+        }
+    }
+
+    if (!madt) {
+        return false;
+    }
+
+    config->lapic_address = madt->lapic_address;
+    config->num_cpus = 0;
+
+    uintptr_t entry = (uintptr_t) madt->entries;
+    uintptr_t end = (uintptr_t) madt + madt->header.length;
+
+    while (entry < end) {
+        acpi_madt_entry_t* ent = (acpi_madt_entry_t*) entry;
+
+        if (!ent->length) {
+            break;
+        }
+
+        if (ent->type == ACPI_MADT_LAPIC) {
+            acpi_madt_lapic_t* lapic = (acpi_madt_lapic_t*) ent;
+
+            if (lapic->flags & ACPI_MADT_LAPIC_ENABLED && config->num_cpus < SMP_MAX_CPUS) {
+                config->apic_ids[config->num_cpus++] = lapic->apic_id;
+            }
+        }
+
+        entry += ent->length;
+    }
+
+    return config->num_cpus > 0;
+}
+
+/* Returns the RSDP given to us by GRUB, or the one found in the BIOS area if
+ * GRUB didn't give us any.
+ */
+acpi_rsdp1_t* acpi_find_rsdp(mb2_t* boot) {
+    mb2_tag_rsdp1_t* tag1 = (mb2_tag_rsdp1_t*) mb2_find_tag(boot, MB2_TAG_RSDP1);
+    mb2_tag_rsdp2_t* tag2 = (mb2_tag_rsdp2_t*) mb2_find_tag(boot, MB2_TAG_RSDP2);
+
+    if (tag2) {
+        return &tag2->rsdp.rsdp1;
+    } else if (tag1) {
+        return &tag1->rsdp;
+    }
+
+    // The RSDP lies on a 16 bytes boundary in the BIOS read-only area
+    for (uintptr_t addr = 0xE0000; addr < 0x100000; addr += 16) {
+        acpi_rsdp1_t* rsdp = (acpi_rsdp1_t*) PHYS_TO_VIRT(addr);
+
+        if (!strncmp(rsdp->signature, "RSD PTR ", 8) && acpi_checksum(rsdp, sizeof(acpi_rsdp1_t))) {
+            return rsdp;
+        }
+    }
+
+    return NULL;
+}
+
+/* Maps the whole table at physical address `phys`, which can be anywhere in
+ * memory, and checks its integrity.
+ */
+acpi_sdt_header_t* acpi_map_table(uintptr_t phys) {
+    acpi_sdt_header_t* header = paging_map_physical(phys, sizeof(acpi_sdt_header_t), 0);
+    acpi_sdt_header_t* table = paging_map_physical(phys, header->length, 0);
+
+    if (!acpi_checksum(table, table->length)) {
+        return NULL;
+    }
+
+    return table;
+}
+
+/* ACPI structures are valid if their bytes sum to zero.
+ */
+bool acpi_checksum(void* table, uint32_t size) {
+    uint8_t sum = 0;
+
+    for (uint32_t i = 0; i < size; i++) {
+        sum += ((uint8_t*) table)[i];
+    }
+
+    return sum == 0;
+}
@@ -1,13 +1,16 @@
+#include <stddef.h>
 #include <stdint.h>
 #include <string.h>
 
 #include <kernel/gdt.h>
 #include <kernel/idt.h>
+#include <kernel/smp.h>
 
-static gdt_entry_t gdt_entries[6];
+// Each CPU needs its own TSS, which come last in the GDT
+static gdt_entry_t gdt_entries[GDT_TSS_INDEX + SMP_MAX_CPUS];
 static gdt_pointer_t gdt_ptr;
 
-static tss_entry_t tss;
+static tss_entry_t tss[SMP_MAX_CPUS];
 
 /* Loads up and fills the GDT with all the entries we need.
  */
@@ -21,13 +24,22 @@ void init_gdt() {
     gdt_set_entry(3, 0, 0xFFFFFFFF, GDT_ACCESS_USER_CODE, GDT_FLAGS);
     gdt_set_entry(4, 0, 0xFFFFFFFF, GDT_ACCESS_USER_DATA, GDT_FLAGS);
 
-    gdt_write_tss(5, 0x10, 0x00);
+    for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        gdt_write_tss(cpu, 0x10, 0x00);
+    }
 
+    gdt_load_cpu(0);
+}
+
+/* Loads the GDT on the calling CPU, along with the TSS of CPU number `cpu`.
+ */
+void gdt_load_cpu(uint32_t cpu) {
     gdt_load(&gdt_ptr);
 
-    // 0x2B = 0+5*8bytes | 3 (bottom 2 bits control ring number)
-    asm("mov $0x2B, %ax\n" // Flush the TSS
-        "ltr %ax\n");
+    // e.g. 0x2B = 0+5*8bytes | 3 (bottom 2 bits control ring number)
+    uint16_t selector = ((GDT_TSS_INDEX + cpu) * 8) | 3;
+
+    asm volatile ("ltr %0\n" :: "r" (selector)); // Flush the TSS
 }
 
 /* See `gdt.h` for some "explanation" of the parameters here.
@@ -46,26 +58,34 @@ void gdt_set_entry(uint32_t num, uint32_t base, uint32_t limit, uint8_t access,
     gdt_entries[num].access = access;
 }
 
-/* Writes the GDT entry corresponding to a barebones TSS with a specific
- * data segment selector `ss0` and stack pointer `esp0`.
+/* Writes the GDT entry corresponding to CPU `cpu`'s barebones TSS with a
+ * specific data segment selector `ss0` and stack pointer `esp0`.
  * Shamelessly taken from ToaruOS :)
  */
-void gdt_write_tss(uint32_t num, uint32_t ss0, uint32_t esp0) {
-    uintptr_t base = (uintptr_t) &tss;
-    uintptr_t limit = base + sizeof(tss);
+void gdt_write_tss(uint32_t cpu, uint32_t ss0, uint32_t esp0) {
+    uintptr_t base = (uintptr_t) &tss[cpu];
+    uintptr_t limit = base + sizeof(tss_entry_t);
 
     /* Add the TSS descriptor to the GDT */
-    gdt_set_entry(num, base, limit, 0xE9, 0x00);
+    gdt_set_entry(GDT_TSS_INDEX + cpu, base, limit, 0xE9, 0x00);
 
-    memset(&tss, 0x00, sizeof(tss));
+    memset(&tss[cpu], 0x00, sizeof(tss_entry_t));
 
-    tss.ss0 = ss0;
-    tss.esp0 = esp0;
-    tss.iomap_base = sizeof(tss);
+    tss[cpu].ss0 = ss0;
+    tss[cpu].esp0 = esp0;
+    tss[cpu].iomap_base = sizeof(tss_entry_t);
+}
+
+/* Returns the address where CPU `cpu` finds its kernel stack pointer, for
+ * `sysenter`.
+ */
+uintptr_t gdt_get_kernel_stack_pointer(uint32_t cpu) {
+    return (uintptr_t) &tss[cpu] + offsetof(tss_entry_t, esp0);
 }
 
-/* Sets the stack pointer that will be used when the next interrupt happens.
+/* Sets the stack pointer that will be used when the next interrupt happens on
+ * the calling CPU.
  */
 void gdt_set_kernel_stack(uintptr_t stack) {
-    tss.esp0 = stack;
+    tss[smp_cpu_id()].esp0 = stack;
 }
@@ -3,6 +3,7 @@
 #include <kernel/idt.h>
 #include <kernel/irq.h>
 #include <kernel/sys.h>
+#include <kernel/trace.h>
 
 #include <string.h>
 
@@ -54,8 +55,6 @@ void init_irq() {
 void irq_handler(registers_t* regs) {
     uint32_t irq = regs->int_no;
 
-    fpu_kernel_enter();
-
     // Handle spurious interrupts
     if (irq == IRQ7 || irq == IRQ15) {
         uint16_t isr = irq_get_isr();
@@ -76,13 +75,15 @@ void irq_handler(registers_t* regs) {
 
     handler_t handler = irq_handlers[irq - IRQ0];
 
+    TRACE(TRACE_IRQ, TRACE_BEGIN, irq - IRQ0, 0);
+
     if (handler) {
         handler(regs);
     } else {
         printke("unhandled IRQ%d", irq - IRQ0);
     }
 
-    fpu_kernel_exit();
+    TRACE(TRACE_IRQ, TRACE_END, irq - IRQ0, 0);
 }
 
 void irq_send_eoi(uint8_t irq) {
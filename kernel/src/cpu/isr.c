@@ -96,8 +96,6 @@ void init_isr() {
 void isr_handler(registers_t* regs) {
     assert(regs->int_no < 256);
 
-    fpu_kernel_enter();
-
     if (isr_handlers[regs->int_no]) {
         handler_t handler = isr_handlers[regs->int_no];
         handler(regs);
@@ -110,8 +108,6 @@ void isr_handler(registers_t* regs) {
         // TODO: we're better than this
         abort();
     }
-
-    fpu_kernel_exit();
 }
 
 /* Registers a handler to be called when interrupt `num` fires.
@@ -0,0 +1,147 @@
+#include <kernel/lapic.h>
+#include <kernel/idt.h>
+#include <kernel/isr.h>
+#include <kernel/paging.h>
+#include <kernel/timer.h>
+#include <kernel/sys.h>
+
+#define CPUID_FEAT_EDX_APIC (1 << 9)
+
+// Scheduler ticks used to measure the local APIC timer's frequency
+#define CALIBRATION_TICKS 5
+
+void lapic_spurious_handler(registers_t* regs);
+void lapic_calibrate_timer();
+
+static volatile uint32_t* lapic;
+static uint32_t timer_count; // Timer decrements per scheduler tick
+
+static uint32_t lapic_read(uint32_t reg) {
+    return lapic[reg / 4];
+}
+
+static void lapic_write(uint32_t reg, uint32_t value) {
+    lapic[reg / 4] = value;
+}
+
+/* Returns whether the processor has a local APIC, through `cpuid`.
+ */
+bool lapic_available() {
+    uint32_t eax, ebx, ecx, edx;
+
+    asm volatile ("cpuid"
+        : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
+        : "a" (1));
+
+    return edx & CPUID_FEAT_EDX_APIC;
+}
+
+/* Maps the local APIC registers, shared by all processors at the same address,
+ * enables the bootstrap processor's local APIC and calibrates its timer
+ * against the PIT, which must already be ticking.
+ */
+void init_lapic(uintptr_t phys) {
+    lapic = paging_map_physical(phys, 0x1000, PAGE_CACHE_DISABLE);
+
+    idt_set_entry(LAPIC_VECTOR_TIMER, (uint32_t) isr240, 0x08, IDT_INT_KERNEL);
+    idt_set_entry(LAPIC_VECTOR_TLB, (uint32_t) isr241, 0x08, IDT_INT_KERNEL);
+    idt_set_entry(LAPIC_VECTOR_SPURIOUS, (uint32_t) isr255, 0x08, IDT_INT_KERNEL);
+    isr_register_handler(LAPIC_VECTOR_SPURIOUS, lapic_spurious_handler);
+
+    lapic_init_cpu(true);
+    lapic_calibrate_timer();
+}
+
+/* Enables the calling processor's local APIC.
+ * The bootstrap processor keeps receiving the PIC's interrupts through LINT0,
+ * in what Intel calls "virtual wire mode"; other processors only get IPIs and
+ * their own timer interrupts.
+ */
+void lapic_init_cpu(bool bsp) {
+    lapic_write(LAPIC_LVT_LINT0, bsp ? LAPIC_LVT_EXTINT : LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_LVT_LINT1, LAPIC_LVT_NMI);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_LVT_ERROR, LAPIC_LVT_MASKED);
+
+    lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | LAPIC_VECTOR_SPURIOUS);
+    lapic_write(LAPIC_TPR, 0); // Accept every interrupt
+
+    // Clear pending errors and interrupts
+    lapic_write(LAPIC_ESR, 0);
+    lapic_write(LAPIC_ESR, 0);
+    lapic_eoi();
+}
+
+/* Counts how much the timer decrements during a few PIT ticks.
+ */
+void lapic_calibrate_timer() {
+    lapic_write(LAPIC_TIMER_DIV, 0x3); // Divide the bus clock by 16
+
+    // Start on a tick boundary
+    uint32_t tick = timer_get_tick();
+
+    while (timer_get_tick() == tick) {
+        asm volatile ("pause");
+    }
+
+    lapic_write(LAPIC_TIMER_INIT, 0xFFFFFFFF);
+    tick = timer_get_tick();
+
+    while (timer_get_tick() < tick + CALIBRATION_TICKS) {
+        asm volatile ("pause");
+    }
+
+    uint32_t elapsed = 0xFFFFFFFF - lapic_read(LAPIC_TIMER_CURRENT);
+    lapic_write(LAPIC_TIMER_INIT, 0);
+
+    timer_count = elapsed / CALIBRATION_TICKS;
+    printk("local APIC timer: %d KHz", timer_count * TIMER_FREQ / 1000);
+}
+
+/* Makes the calling processor's timer fire at the scheduler's frequency.
+ */
+void lapic_timer_start() {
+    lapic_write(LAPIC_TIMER_DIV, 0x3);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_PERIODIC | LAPIC_VECTOR_TIMER);
+    lapic_write(LAPIC_TIMER_INIT, timer_count);
+}
+
+uint32_t lapic_id() {
+    return lapic_read(LAPIC_ID) >> 24;
+}
+
+void lapic_eoi() {
+    lapic_write(LAPIC_EOI, 0);
+}
+
+static void lapic_send(uint32_t apic_id, uint32_t command) {
+    lapic_write(LAPIC_ICR_HIGH, apic_id << 24);
+    lapic_write(LAPIC_ICR_LOW, command);
+
+    while (lapic_read(LAPIC_ICR_LOW) & LAPIC_ICR_PENDING) {
+        asm volatile ("pause");
+    }
+}
+
+/* Sends interrupt `vector` to the processor with local APIC `apic_id`.
+ */
+void lapic_send_ipi(uint32_t apic_id, uint32_t vector) {
+    lapic_send(apic_id, LAPIC_ICR_ASSERT | vector);
+}
+
+void lapic_send_init(uint32_t apic_id) {
+    lapic_send(apic_id, LAPIC_ICR_ASSERT | LAPIC_ICR_INIT);
+}
+
+/* Makes the processor with local APIC `apic_id` start executing real mode code
+ * at `trampoline`, which has to be a page-aligned address below 1 MiB.
+ */
+void lapic_send_startup(uint32_t apic_id, uintptr_t trampoline) {
+    lapic_send(apic_id, LAPIC_ICR_ASSERT | LAPIC_ICR_STARTUP | (trampoline >> 12));
+}
+
+/* Spurious interrupts must not be acknowledged.
+ */
+void lapic_spurious_handler(registers_t* regs) {
+    UNUSED(regs);
+}
@@ -0,0 +1,86 @@
+#include <kernel/mp.h>
+#include <kernel/paging.h>
+#include <kernel/sys.h>
+
+#include <string.h>
+
+mp_floating_pointer_t* mp_find_floating_pointer();
+mp_floating_pointer_t* mp_scan(uintptr_t base, uint32_t size);
+
+/* Fills `config` with the processors listed in the MP configuration table.
+ * Returns false if there is no such table.
+ */
+bool mp_find_cpus(smp_config_t* config) {
+    mp_floating_pointer_t* fp = mp_find_floating_pointer();
+
+    if (!fp || !fp->config) {
+        // No table means one of the default configurations, which we don't
+        // bother supporting
+        return false;
+    }
+
+    mp_config_t* header = paging_map_physical(fp->config, sizeof(mp_config_t), 0);
+    mp_config_t* table = paging_map_physical(fp->config, header->length, 0);
+
+    if (strncmp(table->signature, "PCMP", 4)) {
+        printke("invalid MP configuration table");
+        return false;
+    }
+
+    config->lapic_address = table->lapic_address;
+    config->num_cpus = 0;
+
+    uint8_t* entry = (uint8_t*) (table + 1);
+
+    for (uint32_t i = 0; i < table->entry_count; i++) {
+        if (*entry == MP_ENTRY_PROCESSOR) {
+            mp_processor_t* proc = (mp_processor_t*) entry;
+
+            if (proc->flags & MP_PROCESSOR_ENABLED && config->num_cpus < SMP_MAX_CPUS) {
+                config->apic_ids[config->num_cpus++] = proc->apic_id;
+            }
+
+            entry += sizeof(mp_processor_t);
+        } else {
+            // Every other entry type is 8 bytes long
+            entry += 8;
+        }
+    }
+
+    return config->num_cpus > 0;
+}
+
+/* Looks for the floating pointer structure where the specification says it may
+ * be: in the first KiB of the EBDA, in the last KiB of base memory, or in the
+ * BIOS read-only area.
+ */
+mp_floating_pointer_t* mp_find_floating_pointer() {
+    uintptr_t ebda = *((uint16_t*) PHYS_TO_VIRT(0x40E)) << 4;
+    mp_floating_pointer_t* fp = NULL;
+
+    if (ebda) {
+        fp = mp_scan(ebda, 0x400);
+    }
+
+    if (!fp) {
+        fp = mp_scan(0x9FC00, 0x400);
+    }
+
+    if (!fp) {
+        fp = mp_scan(0xF0000, 0x10000);
+    }
+
+    return fp;
+}
+
+mp_floating_pointer_t* mp_scan(uintptr_t base, uint32_t size) {
+    for (uintptr_t addr = base; addr < base + size; addr += 16) {
+        mp_floating_pointer_t* fp = (mp_floating_pointer_t*) PHYS_TO_VIRT(addr);
+
+        if (!strncmp(fp->signature, "_MP_", 4)) {
+            return fp;
+        }
+    }
+
+    return NULL;
+}
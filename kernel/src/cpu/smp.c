@@ -0,0 +1,238 @@
+#include <kernel/smp.h>
+#include <kernel/acpi.h>
+#include <kernel/fpu.h>
+#include <kernel/gdt.h>
+#include <kernel/idt.h>
+#include <kernel/isr.h>
+#include <kernel/lapic.h>
+#include <kernel/mp.h>
+#include <kernel/paging.h>
+#include <kernel/syscall.h>
+#include <kernel/timer.h>
+#include <kernel/sys.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+// Time allowed for an application processor to come up, in timer ticks
+#define STARTUP_TIMEOUT (TIMER_FREQ / 2)
+
+void smp_ap_main();
+void smp_timer_handler(registers_t* regs);
+void smp_tlb_handler(registers_t* regs);
+
+extern uint8_t smp_trampoline_start[];
+extern uint8_t smp_trampoline_end[];
+extern uint8_t smp_trampoline_cr3[];
+extern uint8_t smp_trampoline_stack[];
+
+static cpu_t cpus[SMP_MAX_CPUS];
+static uint32_t num_cpus = 1;
+static smp_config_t config;
+
+// Index of the processor being started, read by it in `smp_ap_main`
+static volatile uint32_t booting_cpu;
+
+/* Detects the processors of the machine, and sets up the bootstrap processor's
+ * local APIC. Other processors are only started by `smp_start_aps`.
+ * Needs a ticking timer, and interrupts enabled.
+ */
+void init_smp(mb2_t* boot) {
+    cpus[0].id = 0;
+    cpus[0].started = true;
+    cpus[0].sched_lock = (spinlock_t) SPINLOCK_INIT;
+
+    if (!lapic_available()) {
+        printk("no local APIC, running on a single CPU");
+        return;
+    }
+
+    if (!acpi_find_cpus(boot, &config) && !mp_find_cpus(&config)) {
+        printk("no processor tables found, running on a single CPU");
+        return;
+    }
+
+    init_lapic(config.lapic_address);
+    cpus[0].apic_id = lapic_id();
+
+    isr_register_handler(LAPIC_VECTOR_TIMER, smp_timer_handler);
+    isr_register_handler(LAPIC_VECTOR_TLB, smp_tlb_handler);
+
+    printk("found %d CPU%s", config.num_cpus, config.num_cpus > 1 ? "s" : "");
+}
+
+static void smp_wait_ticks(uint32_t ticks) {
+    uint32_t start = timer_get_tick();
+
+    while (timer_get_tick() < start + ticks) {
+        asm volatile ("pause");
+    }
+}
+
+/* Brings up the application processors found by `init_smp` one at a time,
+ * with the INIT-SIPI-SIPI sequence. They then idle until they have processes
+ * to run, or to steal.
+ */
+void smp_start_aps() {
+    if (config.num_cpus <= 1) {
+        return;
+    }
+
+    // The trampoline runs from low memory, which the higher half maps
+    uint8_t* trampoline = (uint8_t*) PHYS_TO_VIRT(SMP_TRAMPOLINE);
+    uint32_t* cr3 = (uint32_t*) (trampoline + (smp_trampoline_cr3 - smp_trampoline_start));
+    uint32_t* stack = (uint32_t*) (trampoline + (smp_trampoline_stack - smp_trampoline_start));
+
+    memcpy(trampoline, smp_trampoline_start, smp_trampoline_end - smp_trampoline_start);
+    *cr3 = paging_get_kernel_directory();
+
+    for (uint32_t i = 0; i < config.num_cpus; i++) {
+        uint32_t apic_id = config.apic_ids[i];
+
+        if (apic_id == cpus[0].apic_id) {
+            continue;
+        }
+
+        cpu_t* cpu = &cpus[num_cpus];
+        uintptr_t kernel_stack = (uintptr_t) kamalloc(0x1000 * PROC_KERNEL_STACK_PAGES, 16);
+
+        cpu->id = num_cpus;
+        cpu->apic_id = apic_id;
+        cpu->sched_lock = (spinlock_t) SPINLOCK_INIT;
+
+        *stack = kernel_stack + 0x1000 * PROC_KERNEL_STACK_PAGES;
+        booting_cpu = num_cpus;
+
+        // The second SIPI is only needed if the first one went unnoticed
+        lapic_send_init(apic_id);
+        smp_wait_ticks(1);
+        lapic_send_startup(apic_id, SMP_TRAMPOLINE);
+        smp_wait_ticks(1);
+
+        if (!cpu->started) {
+            lapic_send_startup(apic_id, SMP_TRAMPOLINE);
+        }
+
+        uint32_t start = timer_get_tick();
+
+        while (!cpu->started && timer_get_tick() < start + STARTUP_TIMEOUT) {
+            asm volatile ("pause");
+        }
+
+        if (!cpu->started) {
+            printke("CPU with APIC id %d didn't start", apic_id);
+            kfree((void*) kernel_stack);
+            continue;
+        }
+
+        num_cpus++;
+    }
+
+    printk("%d CPU%s running", num_cpus, num_cpus > 1 ? "s" : "");
+}
+
+/* Entry point of application processors, jumped to from the trampoline with
+ * paging enabled on the kernel's page directory.
+ */
+void smp_ap_main() {
+    cpu_t* cpu = &cpus[booting_cpu];
+
+    gdt_load_cpu(cpu->id);
+    init_idt();
+    fpu_init_cpu();
+    syscall_init_cpu();
+    lapic_init_cpu(false);
+    lapic_timer_start();
+
+    cpu->started = true;
+
+    proc_enter_scheduler();
+}
+
+/* Each CPU loads its own TSS, so the task register tells us who we are.
+ */
+uint32_t smp_cpu_id() {
+    uint16_t selector;
+    asm volatile ("str %0" : "=r" (selector));
+
+    uint32_t index = selector >> 3;
+
+    // Before the GDT is loaded, we're running on the bootstrap processor
+    return index >= GDT_TSS_INDEX ? index - GDT_TSS_INDEX : 0;
+}
+
+uint32_t smp_num_cpus() {
+    return num_cpus;
+}
+
+cpu_t* smp_get_cpu(uint32_t id) {
+    return &cpus[id];
+}
+
+cpu_t* smp_current_cpu() {
+    return &cpus[smp_cpu_id()];
+}
+
+/* Makes sure no other CPU keeps a stale translation of `virt` after its mapping
+ * changed. Kernel mappings are shared by everyone, user mappings only by the
+ * CPUs currently in the same address space.
+ * Returns once every concerned CPU has flushed its TLB.
+ */
+void smp_tlb_shootdown(uintptr_t virt) {
+    if (num_cpus == 1) {
+        return;
+    }
+
+    cpu_t* self = smp_current_cpu();
+    uintptr_t directory = self->process ? self->process->directory : 0;
+    bool targets[SMP_MAX_CPUS] = { false };
+
+    for (uint32_t i = 0; i < num_cpus; i++) {
+        cpu_t* cpu = &cpus[i];
+        process_t* proc = cpu->process;
+
+        if (cpu == self) {
+            continue;
+        }
+
+        if (virt >= KERNEL_BASE_VIRT || (proc && proc->directory == directory)) {
+            targets[i] = true;
+            cpu->tlb_flush_pending = 1;
+            lapic_send_ipi(cpu->apic_id, LAPIC_VECTOR_TLB);
+        }
+    }
+
+    for (uint32_t i = 0; i < num_cpus; i++) {
+        // A target may itself be waiting on us
+        while (targets[i] && cpus[i].tlb_flush_pending) {
+            smp_handle_tlb_shootdown();
+            asm volatile ("pause");
+        }
+    }
+}
+
+/* Flushes the calling CPU's TLB if another CPU asked for it.
+ */
+void smp_handle_tlb_shootdown() {
+    cpu_t* cpu = smp_current_cpu();
+
+    if (cpu->tlb_flush_pending) {
+        paging_invalidate_cache();
+        cpu->tlb_flush_pending = 0;
+    }
+}
+
+void smp_tlb_handler(registers_t* regs) {
+    UNUSED(regs);
+
+    smp_handle_tlb_shootdown();
+    lapic_eoi();
+}
+
+/* Application processors' scheduling ticks. The bootstrap processor's come from
+ * the PIT, see `timer.c`.
+ */
+void smp_timer_handler(registers_t* regs) {
+    lapic_eoi();
+    proc_timer_callback(regs);
+}
@@ -34,15 +34,7 @@ void init_fb(mb2_t* boot) {
     // Remap our framebuffer
     uintptr_t address = (uintptr_t) fb_info->addr;
     uint32_t size = fb.height*fb.pitch;
-    uintptr_t buff = (uintptr_t) kamalloc(size, 0x1000);
-    uint32_t num_pages = divide_up(size, 0x1000);
-
-    for (uint32_t i = 0; i < num_pages; i++) {
-        page_t* p = paging_get_page(buff + 0x1000*i, false, 0);
-        *p = (address + 0x1000*i) | PAGE_PRESENT | PAGE_RW;
-    }
-
-    fb.address = buff;
+    fb.address = (uintptr_t) paging_map_physical(address, size, 0);
 }
 
 fb_t fb_get_info() {
@@ -1,26 +1,44 @@
 #include <kernel/fpu.h>
 #include <kernel/isr.h>
+#include <kernel/smp.h>
 #include <kernel/sys.h>
 
-#include <string.h>
-
 #define CR0_MP (1 << 1)
 #define CR0_EM (1 << 2)
+#define CR0_TS (1 << 3)
 #define CR4_OSFXSR (1 << 9)
 #define CR4_OSXMMEXCPT (1 << 10)
 
 void fpu_exception_handler(registers_t* regs);
-
-/* Instructions to read and write FPU context require a 16-bytes aligned buffer */
-static uint8_t kernel_fpu[512] __attribute__((aligned(16)));
+static void fpu_unavailable_handler(registers_t* regs);
 
 void init_fpu() {
+    fpu_init_cpu();
+    isr_register_handler(7, fpu_unavailable_handler);
+    isr_register_handler(19, fpu_exception_handler);
+}
+
+/* Makes the next FPU instruction raise #NM.
+ */
+static void fpu_set_ts() {
+    uint32_t cr;
+
+    asm volatile ("mov %%cr0, %0" : "=r" (cr));
+
+    // Writing to CR0 is slow
+    if (!(cr & CR0_TS)) {
+        asm volatile ("mov %0, %%cr0" :: "r" (cr | CR0_TS));
+    }
+}
+
+/* Enables the FPU of the calling CPU.
+ */
+void fpu_init_cpu() {
     uint32_t cr;
 
     /* Configure CR0: disable emulation (EM), as we assume we have an FPU, and
-     * enable the EM bit: with the TS and EM bits disabled, `wait/fwait`
-     * instructions won't generate exceptions. This last part is desired
-     * because we save the FPU state on each task switch. */
+     * enable the MP bit: `wait/fwait` instructions then raise #NM too when TS
+     * is set, which lazy switching relies on. */
     asm volatile(
         "clts\n"
         "mov %%cr0, %0" : "=r"(cr));
@@ -40,33 +58,90 @@ void init_fpu() {
         "mov %0, %%cr4\n"
         "fninit" ::"r"(cr));
 
-    isr_register_handler(19, fpu_exception_handler);
+    // Nobody owns the FPU yet
+    fpu_set_ts();
 }
 
-/* Whatever process got interrupted last has its fpu state in kernel_fpu.
- * When this function is called, it is being switched away from, hence we save
- * kernel_fpu in that process's structure, and we load the next process's fpu
- * state into kernel_fpu, which will get picked up by fpu_kernel_exit soon
- * enough.
+/* FPU state is switched lazily: a process's state stays in the registers of
+ * its CPU until another process, or the kernel, needs the FPU. Switching to a
+ * process that doesn't own the FPU sets CR0.TS, so that its first FPU
+ * instruction raises #NM, whose handler does the actual switch.
+ * A process whose state is live on a CPU is never moved to another one, see
+ * `sched_steal`.
+ * Note: instructions to read and write FPU context require a 16-bytes aligned
+ * buffer.
  */
 void fpu_switch(process_t* prev, const process_t* next) {
-    memcpy(prev->fpu_registers, kernel_fpu, 512);
-    memcpy(kernel_fpu, next->fpu_registers, 512);
+    UNUSED(prev);
+
+    if (smp_current_cpu()->fpu_owner == next) {
+        asm volatile ("clts");
+    } else {
+        fpu_set_ts();
+    }
+}
+
+/* Saves the FPU state of the calling CPU's FPU owner to its structure, if
+ * there is one. The FPU must be enabled.
+ */
+static void fpu_save_owner(cpu_t* cpu) {
+    process_t* owner = cpu->fpu_owner;
+
+    if (owner) {
+        asm volatile ("fxsave (%0)" :: "r" (owner->fpu_registers) : "memory");
+        owner->fpu_live = false;
+        cpu->fpu_owner = NULL;
+    }
 }
 
-/* Called when execution enters the kernel: the fpu state is saved, then
- * cleared, so the kernel gets a fresh start.
+/* Forgets about the FPU state of an exiting process.
  */
-void fpu_kernel_enter() {
-    asm volatile (
-        "fxsave (%0)\n"
-        "fninit\n" :: "r" (kernel_fpu));
+void fpu_exit_process(process_t* proc) {
+    cpu_t* cpu = smp_current_cpu();
+
+    if (cpu->fpu_owner == proc) {
+        cpu->fpu_owner = NULL;
+        proc->fpu_live = false;
+    }
 }
 
-/* Restores the process's fpu state upon returning from the kernel.
+/* Called on the first FPU instruction of a process that doesn't own the FPU:
+ * saves the previous owner's state and loads the current process's.
  */
-void fpu_kernel_exit() {
-    asm volatile ("fxrstor (%0)" :: "r" (kernel_fpu));
+static void fpu_unavailable_handler(registers_t* regs) {
+    cpu_t* cpu = smp_current_cpu();
+    process_t* proc = cpu->process;
+
+    if (!(regs->cs & 0x3)) {
+        printke("FPU used by the kernel outside of `fpu_kernel_begin`, eip: %p",
+            regs->eip);
+    }
+
+    asm volatile ("clts");
+    fpu_save_owner(cpu);
+
+    if (proc->fpu_initialized) {
+        asm volatile ("fxrstor (%0)" :: "r" (proc->fpu_registers) : "memory");
+    } else {
+        asm volatile ("fninit");
+        proc->fpu_initialized = true;
+    }
+
+    cpu->fpu_owner = proc;
+    proc->fpu_live = true;
+}
+
+/* The kernel doesn't touch the FPU, except between calls to this function and
+ * `fpu_kernel_end`. Interrupts must be disabled in between.
+ */
+void fpu_kernel_begin() {
+    asm volatile ("clts");
+    fpu_save_owner(smp_current_cpu());
+    asm volatile ("fninit");
+}
+
+void fpu_kernel_end() {
+    fpu_set_ts();
 }
 
 void fpu_exception_handler(registers_t* regs) {
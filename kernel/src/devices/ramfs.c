@@ -5,20 +5,30 @@
 
 static void read_block(fs_t* fs, uint32_t block, uint8_t* buf) {
     ramfs_t* dev = fs->device.underlying_device;
-    memcpy(buf, dev->data + block*1024, 1024);
+    memcpy(buf, dev->data + block*RAMFS_BLOCK_SIZE, RAMFS_BLOCK_SIZE);
     // printk("_ramfs_read:");
     // dbg_buffer_dump(buf, 1024);
 }
 
+static void read_blocks(fs_t* fs, uint32_t block, uint32_t count, uint8_t* buf) {
+    ramfs_t* dev = fs->device.underlying_device;
+    memcpy(buf, dev->data + block*RAMFS_BLOCK_SIZE, count*RAMFS_BLOCK_SIZE);
+}
+
 static void write_block(fs_t* fs, uint32_t block, uint8_t* buf) {
     ramfs_t* dev = fs->device.underlying_device;
     printk("fswrite: block %d", block);
-    memcpy(dev->data + block*1024, buf, 1024);
+    memcpy(dev->data + block*RAMFS_BLOCK_SIZE, buf, RAMFS_BLOCK_SIZE);
+}
+
+static void write_blocks(fs_t* fs, uint32_t block, uint32_t count, uint8_t* buf) {
+    ramfs_t* dev = fs->device.underlying_device;
+    memcpy(dev->data + block*RAMFS_BLOCK_SIZE, buf, count*RAMFS_BLOCK_SIZE);
 }
 
 static void clear_block(fs_t* fs, uint32_t block) {
     ramfs_t* dev = fs->device.underlying_device;
-    memset(dev->data + block*1024, 0, 1024);
+    memset(dev->data + block*RAMFS_BLOCK_SIZE, 0, RAMFS_BLOCK_SIZE);
 }
 
 fs_device_t ramfs_new(uint8_t* data, uint32_t size) {
@@ -31,6 +41,8 @@ fs_device_t ramfs_new(uint8_t* data, uint32_t size) {
         .underlying_device = ramfs_dev,
         .read_block = read_block,
         .write_block = write_block,
-        .clear_block = clear_block
+        .clear_block = clear_block,
+        .read_blocks = read_blocks,
+        .write_blocks = write_blocks
     };
 }
\ No newline at end of file
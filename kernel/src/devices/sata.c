@@ -283,12 +283,34 @@ static void sata_read_block(fs_t* fs, uint32_t block, uint8_t* buf) {
     sata_read_device(dev, 2*block, 0, 1024, buf);
 }
 
+/* Reads consecutive blocks with as few commands as `sata_read_device` allows.
+ */
+static void sata_read_blocks(fs_t* fs, uint32_t block, uint32_t count, uint8_t* buf) {
+    sata_device_t* dev = fs->device.underlying_device;
+    uint32_t per_command = AHCI_PRDT_SIZE / 1024;
+
+    for (uint32_t i = 0; i < count; i += per_command) {
+        uint32_t n = min(count - i, per_command);
+        sata_read_device(dev, 2*(block + i), 0, n*1024, buf + i*1024);
+    }
+}
+
 static void sata_write_block(fs_t* fs, uint32_t block, uint8_t* buf) {
     sata_device_t* dev = fs->device.underlying_device;
     printk("writing to dev %s, block %d", dev->model_name, 2*block);
     sata_write_device(dev, 2*block, 0, 1024, buf);
 }
 
+static void sata_write_blocks(fs_t* fs, uint32_t block, uint32_t count, uint8_t* buf) {
+    sata_device_t* dev = fs->device.underlying_device;
+    uint32_t per_command = AHCI_PRDT_SIZE / 1024;
+
+    for (uint32_t i = 0; i < count; i += per_command) {
+        uint32_t n = min(count - i, per_command);
+        sata_write_device(dev, 2*(block + i), 0, n*1024, buf + i*1024);
+    }
+}
+
 static void sata_clear_block(fs_t* fs, uint32_t block) {
     uint8_t zeroes[SATA_BLOCK_SIZE] = {0};
     sata_device_t* dev = fs->device.underlying_device;
@@ -302,6 +324,9 @@ fs_device_t sata_to_fs_device(sata_device_t* dev) {
     fs_dev.read_block = sata_read_block;
     fs_dev.write_block = sata_write_block;
     fs_dev.clear_block = sata_clear_block;
+    fs_dev.read_blocks = sata_read_blocks;
+    fs_dev.write_blocks = sata_write_blocks;
+    fs_dev.prefetch = NULL;
 
     return fs_dev;
 }
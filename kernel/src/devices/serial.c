@@ -36,13 +36,28 @@ int serial_is_transmit_empty() {
     return inportb(SERIAL_PORT + SERIAL_THRE) & 0x20;
 }
 
-/* Writes a byte to the serial port, and to an internal buffer for debugging
- * purposes.
+/* Writes a byte to the serial port only, for bulk output that would drown the
+ * kernel log.
  */
-void serial_write(char c) {
+void serial_send(char c) {
     while (serial_is_transmit_empty() == 0);
 
     outportb(SERIAL_PORT, c);
+}
+
+/* Writes a string to the serial port only, see `serial_send`.
+ */
+void serial_send_string(const char* str) {
+    while (*str) {
+        serial_send(*str++);
+    }
+}
+
+/* Writes a byte to the serial port, and to an internal buffer for debugging
+ * purposes.
+ */
+void serial_write(char c) {
+    serial_send(c);
 
     // In-kernel logging, for dmesg-like support
     if (log_index == 0) {
@@ -1,16 +1,34 @@
 #include <kernel/timer.h>
 #include <kernel/com.h>
+#include <kernel/paging.h>
+#include <kernel/sys.h>
+
+#include <kernel/uapi/uapi_time.h>
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <list.h>
 
+#define CPUID_FEAT_EDX_TSC (1 << 4)
+#define CALIBRATION_TICKS 5
+
+static void timer_calibrate_tsc();
+
 static uint32_t current_tick;
 static list_t callbacks;
+static sys_time_page_t* time_page;
 
+/* Starts the PIT, and calibrates the time stamp counter against it for the
+ * time page. Interrupts must be enabled.
+ */
 void init_timer() {
     callbacks = LIST_HEAD_INIT(callbacks);
 
+    time_page = kamalloc(0x1000, 0x1000);
+    *time_page = (sys_time_page_t) {
+        .tick_freq = TIMER_FREQ
+    };
+
     irq_register_handler(IRQ0, &timer_callback);
 
     uint32_t divisor = TIMER_QUOTIENT / TIMER_FREQ;
@@ -18,10 +36,73 @@ void init_timer() {
     outportb(PIT_CMD, PIT_SET);
     outportb(PIT_0, divisor & 0xFF);
     outportb(PIT_0, (divisor >> 8) & 0xFF);
+
+    timer_calibrate_tsc();
+}
+
+/* Measures the frequency of the time stamp counter over a few timer ticks,
+ * and fills in the time page's conversion factors. They are chosen so that
+ * `tsc_mult` fits in 32 bits with as much precision as possible.
+ */
+static void timer_calibrate_tsc() {
+    uint32_t eax, ebx, ecx, edx;
+
+    asm volatile ("cpuid"
+        : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
+        : "a" (1));
+
+    if (!(edx & CPUID_FEAT_EDX_TSC)) {
+        printk("no time stamp counter, the clock has a %d ms resolution",
+            1000 / TIMER_FREQ);
+        return;
+    }
+
+    // Start on a tick boundary
+    uint32_t tick = current_tick;
+
+    while (current_tick == tick) {
+        asm volatile ("pause");
+    }
+
+    uint64_t start = rdtsc();
+    tick = current_tick;
+
+    while (current_tick < tick + CALIBRATION_TICKS) {
+        asm volatile ("pause");
+    }
+
+    uint64_t tsc_freq = (rdtsc() - start) * TIMER_FREQ / CALIBRATION_TICKS;
+    uint32_t shift = 32;
+    uint64_t mult = (1000000000ull << shift) / tsc_freq;
+
+    while (mult >> 32) {
+        shift--;
+        mult = (1000000000ull << shift) / tsc_freq;
+    }
+
+    // Count from boot, like ticks do
+    time_page->tsc_base = start - tsc_freq * tick / TIMER_FREQ;
+    time_page->tsc_shift = shift;
+    time_page->tsc_mult = mult;
+
+    printk("time stamp counter: %d MHz", (uint32_t) (tsc_freq / 1000000));
+}
+
+/* Returns the physical address of the time page, for mapping in processes.
+ */
+uintptr_t timer_get_time_page() {
+    return paging_virt_to_phys((uintptr_t) time_page);
+}
+
+/* Returns the kernel's view of the time page, to convert timestamps.
+ */
+const sys_time_page_t* timer_get_time_info() {
+    return time_page;
 }
 
 void timer_callback(registers_t* regs) {
     current_tick++;
+    time_page->ticks = current_tick;
 
     handler_t* callback;
     list_for_each_entry(callback, &callbacks) {
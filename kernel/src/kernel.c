@@ -1,7 +1,10 @@
+#include <kernel/bcache.h>
+#include <kernel/dl.h>
 #include <kernel/ext2.h>
 #include <kernel/fb.h>
 #include <kernel/fpu.h>
 #include <kernel/fs.h>
+#include <kernel/futex.h>
 #include <kernel/gdt.h>
 #include <kernel/idt.h>
 #include <kernel/irq.h>
@@ -15,11 +18,13 @@
 #include <kernel/ps2.h>
 #include <kernel/ramfs.h>
 #include <kernel/serial.h>
+#include <kernel/smp.h>
 #include <kernel/stacktrace.h>
 #include <kernel/sys.h>
 #include <kernel/syscall.h>
 #include <kernel/term.h>
 #include <kernel/timer.h>
+#include <kernel/trace.h>
 #include <kernel/wm.h>
 
 #include <assert.h>
@@ -68,6 +73,9 @@ void kernel_main(mb2_t* boot, uint32_t magic) {
 
     init_syscall();
     init_timer();
+    init_trace();
+    init_bcache();
+    init_smp(boot);
     init_ps2();
 
     /* Load GRUB modules: the disk image, and symbol file for stacktraces */
@@ -83,7 +91,7 @@ void kernel_main(mb2_t* boot, uint32_t magic) {
             memcpy(data, (void*) mod->mod_start, size);
 
             if (!strcmp(module_name, "disk")) {
-                init_fs(init_ext2(ramfs_new(data, size)));
+                init_fs(init_ext2(bcache_new(ramfs_new(data, size), RAMFS_BLOCK_SIZE)));
             } else if (!strcmp(module_name, "symbols")) {
                 init_stacktrace(data, size);
             }
@@ -97,13 +105,16 @@ void kernel_main(mb2_t* boot, uint32_t magic) {
     // sata_device_t* dev = sata_get_device_by_name("TESTDRIVE");
 
     // if (dev) {
-    //     init_fs(init_ext2(sata_to_fs_device(dev)));
+    //     init_fs(init_ext2(bcache_new(sata_to_fs_device(dev), 2*SATA_BLOCK_SIZE)));
     // }
 
     init_proc();
+    init_futex();
+    init_dl();
+    smp_start_aps();
 
     proc_exec("/background", NULL);
     proc_exec("/terminal", NULL);
 
-    proc_enter_usermode();
+    proc_enter_scheduler();
 }
@@ -1,9 +1,11 @@
 #include <kernel/paging.h>
 #include <kernel/pmm.h>
 #include <kernel/proc.h>
+#include <kernel/smp.h>
 #include <kernel/stacktrace.h>
 #include <kernel/sys.h>
 #include <kernel/term.h>
+#include <kernel/trace.h>
 
 #include <math.h>
 #include <stdio.h>
@@ -92,6 +94,8 @@ void paging_unmap_page(uintptr_t virt) {
     if (page) {
         pmm_free_page(*page & PAGE_FRAME);
         *page = 0;
+        paging_invalidate_page(virt);
+        smp_tlb_shootdown(virt);
     }
 }
 
@@ -136,6 +140,21 @@ void paging_fault_handler(registers_t* regs) {
     uintptr_t cr2 = 0;
     asm volatile("mov %%cr2, %0\n" : "=r"(cr2));
 
+    if (pid) {
+        proc_get_current()->page_faults++;
+
+        TRACE(TRACE_FAULT, TRACE_BEGIN, cr2, err);
+
+        // First access to a page of the executable
+        bool handled = !(err & 0x01) && proc_handle_fault(cr2);
+
+        TRACE(TRACE_FAULT, TRACE_END, cr2, handled);
+
+        if (handled) {
+            return;
+        }
+    }
+
     printke("page fault caused by instruction at %p from process %d:",
         regs->eip, pid);
     printke("the page at %p %s present ", cr2, err & 0x01 ? "was" : "wasn't");
@@ -162,6 +181,13 @@ void paging_fault_handler(registers_t* regs) {
         stacktrace_print();
     }
 
+    // Killing the process would leave its locks held forever, hanging
+    // whoever needs them next
+    if (smp_current_cpu()->locks_held) {
+        printke("the fault happened with spinlocks held");
+        abort();
+    }
+
     if (pid) {
         proc_exit();
     } else {
@@ -200,6 +226,25 @@ uintptr_t paging_virt_to_phys(uintptr_t virt) {
     return (((uintptr_t)*p) & PAGE_FRAME) + (virt & 0xFFF);
 }
 
+/* Maps `size` bytes of physical memory starting at `phys` in the kernel heap,
+ * for firmware tables or memory mapped registers. Returns the virtual address
+ * corresponding to `phys`.
+ * Note: the heap's own backing pages for that area are lost.
+ */
+void* paging_map_physical(uintptr_t phys, uint32_t size, uint32_t flags) {
+    uintptr_t offset = phys % 0x1000;
+    uint32_t num_pages = divide_up(size + offset, 0x1000);
+    uintptr_t virt = (uintptr_t) kamalloc(num_pages * 0x1000, 0x1000);
+
+    for (uint32_t i = 0; i < num_pages; i++) {
+        page_t* p = paging_get_page(virt + 0x1000*i, false, 0);
+        *p = (phys - offset + 0x1000*i) | PAGE_PRESENT | PAGE_RW | (flags & PAGE_FLAGS);
+        paging_invalidate_page(virt + 0x1000*i);
+    }
+
+    return (void*) (virt + offset);
+}
+
 bool paging_disable_page_cache(void* virt) {
     page_t* page = paging_get_page((uintptr_t) virt, false, 0);
     if (page)
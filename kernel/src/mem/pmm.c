@@ -1,6 +1,7 @@
 #include <kernel/multiboot2.h>
 #include <kernel/paging.h>
 #include <kernel/pmm.h>
+#include <kernel/spinlock.h>
 #include <kernel/sys.h>
 
 #include <math.h>
@@ -15,6 +16,7 @@ static uint32_t mem_size;
 static uint32_t used_blocks;
 static uint32_t max_blocks;
 static uintptr_t kernel_end;
+static spinlock_t pmm_lock = SPINLOCK_INIT; // Guards the bitmap and counters
 
 // Linker-provided symbols. Beware, those don't take into account GRUB's things
 extern uint32_t KERNEL_END;
@@ -104,12 +106,16 @@ void pmm_init_region(uintptr_t addr, uint32_t size) {
     /* A region might be smaller than a block, yet span two: boundaries */
     uint32_t num = divide_up(size + addr % PMM_BLOCK_SIZE, PMM_BLOCK_SIZE);
 
+    spinlock_acquire(&pmm_lock);
+
     while (num-- > 0) {
         mmap_unset(base_block++);
     }
 
     // Never map the nullptr
     mmap_set(0);
+
+    spinlock_release(&pmm_lock);
 }
 
 /* Mark an area of physical memory as used.
@@ -118,15 +124,21 @@ void pmm_deinit_region(uintptr_t addr, uint32_t size) {
     uint32_t base_block = addr/PMM_BLOCK_SIZE;
     uint32_t num = divide_up(size + addr % PMM_BLOCK_SIZE, PMM_BLOCK_SIZE);
 
+    spinlock_acquire(&pmm_lock);
+
     while (num-- > 0) {
         mmap_set(base_block++);
     }
+
+    spinlock_release(&pmm_lock);
 }
 
 /* Returns the address of a free page of physical memory.
  * Note: of course, this address is page-aligned.
  */
 uintptr_t pmm_alloc_page() {
+    spinlock_acquire(&pmm_lock);
+
     if (max_blocks <= used_blocks) {
         printke("kernel is out of physical memory!");
         abort();
@@ -134,11 +146,11 @@ uintptr_t pmm_alloc_page() {
 
     uint32_t block = mmap_find_free();
 
-    if (!block)  {
-        return 0;
+    if (block)  {
+        mmap_set(block);
     }
 
-    mmap_set(block);
+    spinlock_release(&pmm_lock);
 
     return (uintptr_t) (block*PMM_BLOCK_SIZE);
 }
@@ -150,13 +162,17 @@ uintptr_t pmm_alloc_page() {
  * address that is 4 MiB-aligned. Return that, mark 4 MiB as taken.
  */
 uintptr_t pmm_alloc_aligned_large_page() { // TODO: generalize
+    spinlock_acquire(&pmm_lock);
+
     if (max_blocks <= used_blocks || max_blocks - used_blocks < 2*1024) { // 4MiB
+        spinlock_release(&pmm_lock);
         return 0;
     }
 
     uint32_t free_block = mmap_find_free_frame(2*1024);
 
     if (!free_block) {
+        spinlock_release(&pmm_lock);
         return 0;
     }
 
@@ -166,17 +182,23 @@ uintptr_t pmm_alloc_aligned_large_page() { // TODO: generalize
         mmap_set(aligned_block + i);
     }
 
+    spinlock_release(&pmm_lock);
+
     return (uintptr_t)(aligned_block*PMM_BLOCK_SIZE);
 }
 
 uintptr_t pmm_alloc_pages(uint32_t num) {
+    spinlock_acquire(&pmm_lock);
+
     if (max_blocks <= used_blocks || max_blocks - used_blocks < num) {
+        spinlock_release(&pmm_lock);
         return 0;
     }
 
     uint32_t first_block = mmap_find_free_frame(num);
 
     if (!first_block) {
+        spinlock_release(&pmm_lock);
         return 0;
     }
 
@@ -184,20 +206,29 @@ uintptr_t pmm_alloc_pages(uint32_t num) {
         mmap_set(first_block+i);
     }
 
+    spinlock_release(&pmm_lock);
+
     return (uintptr_t) (first_block*PMM_BLOCK_SIZE);
 }
 
 void pmm_free_page(uintptr_t addr) {
     uint32_t block = addr/PMM_BLOCK_SIZE;
+
+    spinlock_acquire(&pmm_lock);
     mmap_unset(block);
+    spinlock_release(&pmm_lock);
 }
 
 void pmm_free_pages(uintptr_t addr, uint32_t num) {
     uint32_t first_block = addr/PMM_BLOCK_SIZE;
 
+    spinlock_acquire(&pmm_lock);
+
     for (uint32_t i = 0; i < num; i++) {
         mmap_unset(first_block+i);
     }
+
+    spinlock_release(&pmm_lock);
 }
 
 void mmap_set(uint32_t bit) {
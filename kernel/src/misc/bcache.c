@@ -0,0 +1,356 @@
+#include <kernel/bcache.h>
+#include <kernel/paging.h>
+#include <kernel/spinlock.h>
+#include <kernel/sys.h>
+#include <kernel/trace.h>
+
+#include <list.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* A block of a device as last read or written. Dirty blocks were written to
+ * since, and are written back to their device when evicted or synced.
+ */
+typedef struct bcache_block_t {
+    bcache_t* cache;
+    uint32_t block;
+    uint32_t last_use;
+    bool dirty;
+    uint8_t data[];
+} bcache_block_t;
+
+/* The buffer cache keeps recently used blocks of every device, hashed by
+ * device and block number. Writes only go to memory, so that repeated writes
+ * to a block, like those to allocation bitmaps, reach the device once.
+ */
+static list_t buckets[BCACHE_BUCKETS];
+static uint32_t num_blocks = 0;
+static uint32_t num_dirty = 0;
+static uint32_t cache_clock = 0; // Orders block uses
+static uint32_t dirty_since = 0; // Tick at which the oldest dirty block became dirty
+static spinlock_t bcache_lock = SPINLOCK_INIT; // Guards the above
+
+void init_bcache() {
+    for (uint32_t i = 0; i < BCACHE_BUCKETS; i++) {
+        buckets[i] = LIST_HEAD_INIT(buckets[i]);
+    }
+}
+
+static list_t* bcache_bucket(bcache_t* cache, uint32_t block) {
+    return &buckets[(block ^ ((uintptr_t) cache >> 4)) % BCACHE_BUCKETS];
+}
+
+/* Returns the cached block `block` of `cache`, or NULL if it isn't cached.
+ */
+static bcache_block_t* bcache_find(bcache_t* cache, uint32_t block) {
+    bcache_block_t* cached;
+
+    list_for_each_entry(cached, bcache_bucket(cache, block)) {
+        if (cached->cache == cache && cached->block == block) {
+            return cached;
+        }
+    }
+
+    return NULL;
+}
+
+/* Writes a dirty block back to its device, along with the dirty blocks it is
+ * in a run of, so that a file written block by block reaches the device in
+ * writes of up to `BCACHE_IO_BLOCKS` blocks.
+ */
+static void bcache_write_back(bcache_block_t* cached) {
+    bcache_t* cache = cached->cache;
+    uint32_t block = cached->block;
+    bcache_block_t* previous;
+
+    while (block && (previous = bcache_find(cache, block - 1)) && previous->dirty) {
+        block--;
+    }
+
+    while ((cached = bcache_find(cache, block)) && cached->dirty) {
+        uint32_t count = 0;
+
+        TRACE(TRACE_BLOCK, TRACE_BEGIN, block, 1);
+
+        do {
+            memcpy(cache->io_buffer + count*cache->block_size, cached->data, cache->block_size);
+            cached->dirty = false;
+            num_dirty--;
+            count++;
+        } while (count < BCACHE_IO_BLOCKS && (cached = bcache_find(cache, block + count)) &&
+                 cached->dirty);
+
+        cache->fs.device.write_blocks(&cache->fs, block, count, cache->io_buffer);
+        TRACE(TRACE_BLOCK, TRACE_END, block, 1);
+
+        block += count;
+    }
+}
+
+/* Writes every dirty block back to its device.
+ */
+static void bcache_flush() {
+    for (uint32_t i = 0; i < BCACHE_BUCKETS && num_dirty; i++) {
+        bcache_block_t* cached;
+
+        list_for_each_entry(cached, &buckets[i]) {
+            if (cached->dirty) {
+                bcache_write_back(cached);
+            }
+        }
+    }
+}
+
+/* Makes room for one more block. When the cache is full, the blocks unused
+ * for the last half of its worth of accesses are evicted all at once, which
+ * keeps eviction cheap on average.
+ */
+static void bcache_evict() {
+    if (num_blocks < BCACHE_MAX_BLOCKS) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < BCACHE_BUCKETS; i++) {
+        list_t* iter;
+        list_t* next;
+
+        list_for_each_safe(iter, next, &buckets[i]) {
+            bcache_block_t* cached = list_entry(iter, bcache_block_t);
+
+            if (cache_clock - cached->last_use < BCACHE_MAX_BLOCKS/2) {
+                continue;
+            }
+
+            if (cached->dirty) {
+                bcache_write_back(cached);
+            }
+
+            list_del(iter);
+            kfree(cached);
+            num_blocks--;
+        }
+    }
+}
+
+/* Adds block `block` of `cache` to the cache, its content left for the
+ * caller to fill.
+ */
+static bcache_block_t* bcache_insert(bcache_t* cache, uint32_t block) {
+    bcache_evict();
+
+    bcache_block_t* cached = kmalloc(sizeof(bcache_block_t) + cache->block_size);
+    cached->cache = cache;
+    cached->block = block;
+    cached->last_use = ++cache_clock;
+    cached->dirty = false;
+
+    list_add(bcache_bucket(cache, block), cached);
+    num_blocks++;
+
+    return cached;
+}
+
+/* Reads `count` consecutive blocks that aren't cached with a single device
+ * read, and caches them. `count` is at most `BCACHE_IO_BLOCKS`.
+ * The blocks are inserted before the read: evicting may write blocks back
+ * through `io_buffer`, which mustn't happen once it holds what was read.
+ */
+static void bcache_read_run(bcache_t* cache, uint32_t block, uint32_t count) {
+    bcache_block_t* run[BCACHE_IO_BLOCKS];
+
+    for (uint32_t i = 0; i < count; i++) {
+        run[i] = bcache_insert(cache, block + i);
+    }
+
+    TRACE(TRACE_BLOCK, TRACE_BEGIN, block, 0);
+    cache->fs.device.read_blocks(&cache->fs, block, count, cache->io_buffer);
+    TRACE(TRACE_BLOCK, TRACE_END, block, 0);
+
+    for (uint32_t i = 0; i < count; i++) {
+        memcpy(run[i]->data, cache->io_buffer + i*cache->block_size, cache->block_size);
+    }
+}
+
+/* Makes sure that blocks `block` to `block + count - 1` of `cache` are
+ * cached, reading each run of missing ones at once.
+ */
+static void bcache_fetch(bcache_t* cache, uint32_t block, uint32_t count) {
+    uint32_t i = 0;
+
+    while (i < count) {
+        if (bcache_find(cache, block + i)) {
+            i++;
+            continue;
+        }
+
+        uint32_t run = 1;
+
+        while (i + run < count && run < BCACHE_IO_BLOCKS && !bcache_find(cache, block + i + run)) {
+            run++;
+        }
+
+        bcache_read_run(cache, block + i, run);
+        i += run;
+    }
+}
+
+/* Returns block `block` of `cache`, read from the device if it isn't cached.
+ * With `overwrite`, a block that isn't cached isn't read either, as the
+ * caller is about to replace its content.
+ */
+static bcache_block_t* bcache_get(bcache_t* cache, uint32_t block, bool overwrite) {
+    bcache_block_t* cached = bcache_find(cache, block);
+
+    if (cached) {
+        cached->last_use = ++cache_clock;
+    } else if (overwrite) {
+        cached = bcache_insert(cache, block);
+    } else {
+        bcache_read_run(cache, block, 1);
+        cached = bcache_find(cache, block);
+    }
+
+    return cached;
+}
+
+/* Marks a block as changed. Blocks stay dirty for about `BCACHE_FLUSH_TICKS`
+ * at most, to bound what is lost if we never get to sync: their age is
+ * checked here and by idle CPUs, see `bcache_flush_old`.
+ */
+static void bcache_mark_dirty(bcache_block_t* cached) {
+    if (!cached->dirty) {
+        if (!num_dirty) {
+            dirty_since = timer_get_tick();
+        }
+
+        cached->dirty = true;
+        num_dirty++;
+    }
+
+    if (timer_get_tick() - dirty_since >= BCACHE_FLUSH_TICKS) {
+        bcache_flush();
+    }
+}
+
+static void bcache_read_block(fs_t* fs, uint32_t block, uint8_t* buf) {
+    bcache_t* cache = fs->device.underlying_device;
+
+    spinlock_acquire(&bcache_lock);
+
+    bcache_block_t* cached = bcache_get(cache, block, false);
+    memcpy(buf, cached->data, cache->block_size);
+
+    spinlock_release(&bcache_lock);
+}
+
+static void bcache_read_blocks(fs_t* fs, uint32_t block, uint32_t count, uint8_t* buf) {
+    bcache_t* cache = fs->device.underlying_device;
+
+    spinlock_acquire(&bcache_lock);
+
+    bcache_fetch(cache, block, count);
+
+    for (uint32_t i = 0; i < count; i++) {
+        bcache_block_t* cached = bcache_get(cache, block + i, false);
+        memcpy(buf + i*cache->block_size, cached->data, cache->block_size);
+    }
+
+    spinlock_release(&bcache_lock);
+}
+
+/* Reads blocks into the cache ahead of their use. Reads are synchronous, so
+ * what this saves is issuing them one block at a time later on.
+ */
+static void bcache_prefetch(fs_t* fs, uint32_t block, uint32_t count) {
+    bcache_t* cache = fs->device.underlying_device;
+
+    spinlock_acquire(&bcache_lock);
+    bcache_fetch(cache, block, count);
+    spinlock_release(&bcache_lock);
+}
+
+static void bcache_write_block(fs_t* fs, uint32_t block, uint8_t* buf) {
+    bcache_t* cache = fs->device.underlying_device;
+
+    spinlock_acquire(&bcache_lock);
+
+    bcache_block_t* cached = bcache_get(cache, block, true);
+    memcpy(cached->data, buf, cache->block_size);
+    bcache_mark_dirty(cached);
+
+    spinlock_release(&bcache_lock);
+}
+
+static void bcache_write_blocks(fs_t* fs, uint32_t block, uint32_t count, uint8_t* buf) {
+    bcache_t* cache = fs->device.underlying_device;
+
+    spinlock_acquire(&bcache_lock);
+
+    for (uint32_t i = 0; i < count; i++) {
+        bcache_block_t* cached = bcache_get(cache, block + i, true);
+        memcpy(cached->data, buf + i*cache->block_size, cache->block_size);
+        bcache_mark_dirty(cached);
+    }
+
+    spinlock_release(&bcache_lock);
+}
+
+static void bcache_clear_block(fs_t* fs, uint32_t block) {
+    bcache_t* cache = fs->device.underlying_device;
+
+    spinlock_acquire(&bcache_lock);
+
+    bcache_block_t* cached = bcache_get(cache, block, true);
+    memset(cached->data, 0, cache->block_size);
+    bcache_mark_dirty(cached);
+
+    spinlock_release(&bcache_lock);
+}
+
+/* Returns a device reading and writing the blocks of `device` through the
+ * buffer cache. `block_size` is the size of the blocks `device` transfers.
+ */
+fs_device_t bcache_new(fs_device_t device, uint32_t block_size) {
+    bcache_t* cache = kmalloc(sizeof(bcache_t));
+
+    memset(cache, 0, sizeof(bcache_t));
+    cache->fs.device = device;
+    cache->block_size = block_size;
+    cache->io_buffer = kamalloc(BCACHE_IO_BLOCKS*block_size, PAGE_SIZE);
+
+    for (uint32_t i = 0; i < BCACHE_IO_BLOCKS*block_size; i += PAGE_SIZE) {
+        paging_disable_page_cache(cache->io_buffer + i);
+    }
+
+    return (fs_device_t) {
+        .underlying_device = cache,
+        .read_block = bcache_read_block,
+        .write_block = bcache_write_block,
+        .clear_block = bcache_clear_block,
+        .read_blocks = bcache_read_blocks,
+        .write_blocks = bcache_write_blocks,
+        .prefetch = bcache_prefetch
+    };
+}
+
+/* Writes every dirty block of every device back.
+ */
+void bcache_sync() {
+    spinlock_acquire(&bcache_lock);
+    bcache_flush();
+    spinlock_release(&bcache_lock);
+}
+
+/* Writes every dirty block back if the oldest has been dirty for
+ * `BCACHE_FLUSH_TICKS`. Idle CPUs call this, so that blocks reach their
+ * device even when nothing writes to the cache anymore.
+ */
+void bcache_flush_old() {
+    spinlock_acquire(&bcache_lock);
+
+    if (num_dirty && timer_get_tick() - dirty_since >= BCACHE_FLUSH_TICKS) {
+        bcache_flush();
+    }
+
+    spinlock_release(&bcache_lock);
+}
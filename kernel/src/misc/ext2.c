@@ -17,6 +17,12 @@
 #define EXT2_PANIC 3
 
 #define BUFFER_SIZE PAGE_SIZE
+#define INODE_CACHE_BUCKETS 64
+#define INODE_CACHE_SIZE 256 // Number of inodes kept around unused
+#define READAHEAD_MIN 4 // In blocks, once reads look sequential
+#define READAHEAD_MAX 64
+#define EXTENT_CACHE_SIZE 8 // Runs of blocks whose location each cached inode remembers
+#define PREALLOC_BLOCKS 8 // Blocks reserved at once for a file being written
 
 enum {
     LINUX, HURD, MASIX, FREEBSD, GENERIC_BSD
@@ -79,6 +85,17 @@ typedef struct {
     uint32_t unused[3];
 } group_descriptor_t;
 
+/* What we keep in memory about a block group for allocations. Bitmaps are
+ * read on first use, and written back by `sync_allocations`.
+ */
+typedef struct {
+    uint8_t* block_bitmap;
+    uint8_t* inode_bitmap;
+    uint32_t next_block; // No block before this one is free
+    uint32_t next_inode; // Same for inodes, both relative to the group
+    bool dirty; // Bitmaps or descriptor changed since last written
+} ext2_group_t;
+
 typedef struct {
     uint16_t type_perms;
     uint16_t uid;
@@ -103,6 +120,34 @@ typedef struct {
     uint32_t os_specific2[3];
 } ext2_inode_t;
 
+/* A run of blocks of an inode that are also consecutive on disk, or a hole.
+ */
+typedef struct {
+    uint32_t first; // Number of the first block, within the inode
+    uint32_t count; // Zero if the slot is unused
+    uint32_t block; // Where the first block is on disk, zero for a hole
+} ext2_extent_t;
+
+/* An inode shared by the operations using it, see `get_inode`.
+ */
+typedef struct {
+    ext2_inode_t inode; // First, see `put_inode`
+    uint32_t ino;
+    uint32_t refs;
+    uint32_t last_use;
+    bool dirty; // Changed since it was read, see `update_inode`
+    /* Read-ahead state, see `read_ahead` */
+    uint32_t ra_next; // Block after the last one read
+    uint32_t ra_window; // Blocks to read ahead of the reader, zero if it isn't sequential
+    uint32_t ra_end; // First block not read ahead yet
+    /* Block map cache, see `map_inode_blocks` */
+    ext2_extent_t extents[EXTENT_CACHE_SIZE];
+    uint32_t next_extent; // Slot to replace next
+    /* Blocks allocated ahead of the file's next writes, see `reserve_inode_blocks` */
+    uint32_t prealloc_block;
+    uint32_t prealloc_count;
+} ext2_cached_inode_t;
+
 typedef struct dentry_t {
     char* name;
     uint32_t inode;
@@ -129,6 +174,12 @@ typedef struct ext2_fs_t {
        - To be used as uncached page with read/write_block,
          which interact with disk drivers. */
     uint8_t* buffer;
+    /* Inodes in use and recently used ones, hashed by number. */
+    list_t inodes[INODE_CACHE_BUCKETS];
+    uint32_t num_inodes;
+    uint32_t inode_clock; // Orders inode uses
+    ext2_group_t* groups; // `num_block_groups` of them
+    bool sb_dirty; // Free counts changed since the superblock was last written
 } ext2_fs_t;
 
 #define INODE_FIFO 0x1000
@@ -162,10 +213,12 @@ typedef struct ext2_fs_t {
 
 uint32_t ext2_create(ext2_fs_t* fs, const char* name, uint32_t type, uint32_t parent_inode);
 int32_t ext2_unlink(ext2_fs_t* fs, uint32_t d_ino, uint32_t ino);
-int32_t ext2_rename(ext2_fs_t* fs, uint32_t dir_ino, uint32_t ino, uint32_t destdir_ino);
+int32_t ext2_rename(ext2_fs_t* fs, uint32_t dir_ino, uint32_t ino, uint32_t destdir_ino,
+    const char* name);
 uint32_t ext2_mkdir(ext2_fs_t* fs, const char* name, uint32_t parent_inode);
 uint32_t ext2_read(ext2_fs_t* fs, uint32_t inode, uint32_t offset, uint8_t* buf, uint32_t size);
 uint32_t ext2_append(ext2_fs_t* fs, uint32_t inode, uint8_t* data, uint32_t size);
+uint32_t ext2_write(ext2_fs_t* fs, uint32_t inode, uint32_t offset, uint8_t* data, uint32_t size);
 sos_directory_entry_t* ext2_readdir(ext2_fs_t* fs, uint32_t inode, uint32_t offset);
 inode_t* ext2_get_fs_inode(ext2_fs_t* fs, uint32_t inode);
 int32_t ext2_close(ext2_fs_t* fs, uint32_t ino);
@@ -178,28 +231,46 @@ static void write_superblock(ext2_fs_t* fs);
 static void write_group_descriptor(ext2_fs_t* fs, uint32_t group);
 static superblock_t* parse_superblock(ext2_fs_t* fs);
 static group_descriptor_t* parse_group_descriptors(ext2_fs_t* fs);
-static void read_inode_block(ext2_fs_t* fs, ext2_inode_t* inode, uint32_t n, uint8_t* buf);
-static void write_inode_block(ext2_fs_t* fs, ext2_inode_t* inode, uint32_t n, uint8_t* buf);
+static uint32_t read_inode_blocks(ext2_fs_t* fs, ext2_inode_t* inode, uint32_t n, uint32_t count,
+    uint8_t* buf);
+static void read_ahead(ext2_fs_t* fs, ext2_inode_t* inode, uint32_t first, uint32_t last);
 static ext2_inode_t* get_inode(ext2_fs_t* fs, uint32_t inode);
-static uint32_t allocate_block(ext2_fs_t* fs);
+static void put_inode(ext2_fs_t* fs, ext2_inode_t* in);
+static ext2_cached_inode_t* find_cached_inode(ext2_fs_t* fs, uint32_t ino);
+static uint32_t allocate_blocks(ext2_fs_t* fs, uint32_t goal, uint32_t wanted, uint32_t* count);
+static uint32_t allocate_inode_block(ext2_fs_t* fs, ext2_inode_t* inode, uint32_t goal);
+static void reserve_inode_blocks(ext2_fs_t* fs, ext2_inode_t* inode, uint32_t goal, uint32_t wanted);
+static uint32_t allocate_inode_blocks(ext2_fs_t* fs, ext2_inode_t* inode, uint32_t first,
+    uint32_t last);
+static void discard_prealloc(ext2_fs_t* fs, ext2_inode_t* inode);
 static void free_block(ext2_fs_t* fs, uint32_t block);
-static uint32_t allocate_inode(ext2_fs_t* fs);
+static uint32_t allocate_inode(ext2_fs_t* fs, uint32_t d_ino);
 static void free_inode(ext2_fs_t* fs, uint32_t ino);
-static uint32_t min_dir_entry_size(const char* name);
+static void sync_allocations(ext2_fs_t* fs);
+static uint32_t min_dir_entry_size(uint32_t name_len);
 static void update_inode(ext2_fs_t* fs, uint32_t ino, ext2_inode_t* in);
 static uint32_t get_or_create_inode_block(ext2_fs_t* fs, ext2_inode_t* in, uint32_t n);
 static uint32_t get_inode_block(ext2_fs_t* fs, ext2_inode_t* inode, uint32_t n);
+static uint32_t map_inode_blocks(ext2_fs_t* fs, ext2_inode_t* inode, uint32_t n, uint32_t* count);
+static void forget_extents(ext2_inode_t* inode);
 static uint32_t add_directory_entry(ext2_fs_t* fs, const char* name, uint32_t d_ino, uint32_t type);
-static list_t* directory_to_entries(ext2_fs_t* fs, uint32_t ino);
-static void write_directory_entries(ext2_fs_t* fs, uint32_t ino, list_t* dir_entries);
-static dentry_t* make_directory_entry(const char* name, uint32_t ino, uint32_t type);
-static void free_directory_entries(list_t* entries);
+static bool insert_directory_entry(ext2_fs_t* fs, uint32_t d_ino, const char* name, uint32_t ino,
+    uint32_t type);
+static dentry_t* remove_directory_entry(ext2_fs_t* fs, uint32_t d_ino, uint32_t ino);
+static void set_directory_parent(ext2_fs_t* fs, uint32_t ino, uint32_t parent);
+static void free_directory_entry(dentry_t* entry);
 
 fs_t* init_ext2(fs_device_t dev) {
     ext2_fs_t* e2fs = kmalloc(sizeof(ext2_fs_t));
 
     e2fs->fs.device = dev;
     e2fs->buffer = kamalloc(BUFFER_SIZE, PAGE_SIZE);
+    e2fs->num_inodes = 0;
+    e2fs->inode_clock = 0;
+
+    for (uint32_t i = 0; i < INODE_CACHE_BUCKETS; i++) {
+        e2fs->inodes[i] = LIST_HEAD_INIT(e2fs->inodes[i]);
+    }
 
     paging_disable_page_cache(e2fs->buffer);
 
@@ -216,7 +287,11 @@ fs_t* init_ext2(fs_device_t dev) {
         return NULL;
     }
 
+    e2fs->groups = zalloc(e2fs->num_block_groups * sizeof(ext2_group_t));
+    e2fs->sb_dirty = false;
+
     e2fs->fs.append = (fs_append_t) ext2_append;
+    e2fs->fs.write = (fs_write_t) ext2_write;
     e2fs->fs.create = (fs_create_t) ext2_create;
     e2fs->fs.rename = (fs_rename_t) ext2_rename;
     e2fs->fs.get_fs_inode = (fs_get_fs_inode_t) ext2_get_fs_inode;
@@ -236,86 +311,65 @@ fs_t* init_ext2(fs_device_t dev) {
  * `type` is one of the `DENT_*` constants.
  */
 uint32_t ext2_create(ext2_fs_t* fs, const char* name, uint32_t type, uint32_t parent_inode) {
-    return add_directory_entry(fs, name, parent_inode, type);
+    uint32_t ino = add_directory_entry(fs, name, parent_inode, type);
+
+    sync_allocations(fs);
+
+    return ino;
 }
 
 /* Deletes the directory entry referencing `ino` in `d_ino`, deleting the inode
  * if it is no longer referenced anywhere.
  */
 int32_t ext2_unlink(ext2_fs_t* fs, uint32_t d_ino, uint32_t ino) {
-    ext2_inode_t* in = get_inode(fs, ino);
+    dentry_t* ent = remove_directory_entry(fs, d_ino, ino);
 
-    list_t* entries = directory_to_entries(fs, d_ino);
-    list_t* iter;
-    dentry_t* ent;
-
-    list_for_each(iter, ent, entries) {
-        if (ent->inode == ino) {
-            kfree(ent->name);
-            kfree(ent);
-            list_del(iter);
-            break;
-        }
+    if (!ent) {
+        return -1;
     }
 
-    write_directory_entries(fs, d_ino, entries);
+    free_directory_entry(ent);
+
+    ext2_inode_t* in = get_inode(fs, ino);
 
     if (--in->hardlinks_count == 0) {
         free_inode(fs, ino);
-    } else {
-        update_inode(fs, ino, in);
     }
 
+    update_inode(fs, ino, in);
+    put_inode(fs, in);
+    sync_allocations(fs);
+
     return 0;
 }
 
-/* Move `ino` whose parent directory is `dir_ino`, to the directory `destdir_ino`.
+/* Move `ino` whose parent directory is `dir_ino`, to the directory `destdir_ino`,
+ * under the name `name`.
  */
-int32_t ext2_rename(ext2_fs_t* fs, uint32_t dir_ino, uint32_t ino, uint32_t destdir_ino) {
-    list_t* entries = directory_to_entries(fs, dir_ino);
-    list_t* iter;
-    dentry_t* ent;
+int32_t ext2_rename(ext2_fs_t* fs, uint32_t dir_ino, uint32_t ino, uint32_t destdir_ino,
+    const char* name) {
+    dentry_t* ent = remove_directory_entry(fs, dir_ino, ino);
 
-    if (!entries) {
+    if (!ent) {
         return -1;
     }
 
-    /* Look for the file to move, remove it from the list */
-    list_for_each(iter, ent, entries) {
-        if (ent->inode == ino) {
-            list_del(iter);
-            break;
-        }
-    }
-
-    /* Not found */
-    if (iter == entries) {
-        free_directory_entries(entries);
-        kfree(entries);
+    // The destination may be full: then put the entry back, where it fits
+    // again since it was just removed
+    if (!insert_directory_entry(fs, destdir_ino, name, ino, ent->type)) {
+        insert_directory_entry(fs, dir_ino, ent->name, ino, ent->type);
+        free_directory_entry(ent);
+        sync_allocations(fs);
 
         return -1;
     }
 
-    /* Update the destination dir's list */
-    list_t* new_entries = directory_to_entries(fs, destdir_ino);
-
-    if (!new_entries) {
-        free_directory_entries(entries);
-        kfree(entries);
-
-        return -1;
+    if (ent->type == DTYPE_DIR && dir_ino != destdir_ino) {
+        set_directory_parent(fs, ino, destdir_ino);
     }
 
-    list_add(new_entries, make_directory_entry(ent->name, ent->inode, ent->type));
-
-    /* Write changes to disk */
-    write_directory_entries(fs, destdir_ino, new_entries);
-    write_directory_entries(fs, dir_ino, entries);
-
-    free_directory_entries(entries);
-    kfree(entries);
-    free_directory_entries(new_entries);
-    kfree(new_entries);
+    free_directory_entry(ent);
+    sync_allocations(fs);
 
     return 0;
 }
@@ -325,39 +379,96 @@ int32_t ext2_rename(ext2_fs_t* fs, uint32_t dir_ino, uint32_t ino, uint32_t dest
  */
 uint32_t ext2_append(ext2_fs_t* fs, uint32_t inode, uint8_t* data, uint32_t size) {
     ext2_inode_t* in = get_inode(fs, inode);
-    uint8_t* tmp = memset(fs->buffer, 0, fs->block_size);
 
-    uint32_t start_block = in->size_lower / fs->block_size;
-    uint32_t end_block = (in->size_lower + size) / fs->block_size;
-    uint32_t offset_start = in->size_lower % fs->block_size;
-    uint32_t offset_end = (in->size_lower + size) % fs->block_size;
+    if (!in) {
+        return 0;
+    }
+
+    uint32_t written = ext2_write(fs, inode, in->size_lower, data, size);
+    put_inode(fs, in);
 
-    if (start_block == end_block) {
-        read_inode_block(fs, in, start_block, tmp);
-        memcpy(tmp + offset_start, data, size);
-        write_inode_block(fs, in, start_block, tmp);
-    } else {
-        for (uint32_t block = start_block; block < end_block; block++) {
-            if (block == start_block) {
-                read_inode_block(fs, in, start_block, tmp);
-                memcpy(tmp + offset_start, data, fs->block_size - offset_start);
-                write_inode_block(fs, in, start_block, tmp);
+    return written;
+}
+
+/* Writes `size` bytes from `data` at `offset` in the file pointed to by
+ * `inode`, growing it if they go past its end. The blocks of the range are
+ * allocated first, then written by runs of contiguous ones, and the inode is
+ * updated once.
+ * Returns the number of bytes written, fewer than `size` if the disk is full.
+ */
+uint32_t ext2_write(ext2_fs_t* fs, uint32_t inode, uint32_t offset, uint8_t* data, uint32_t size) {
+    ext2_inode_t* in = get_inode(fs, inode);
+
+    if (!in) {
+        return 0;
+    }
+
+    // Files can't go past 4 GiB
+    if (!size || offset + size < offset) {
+        put_inode(fs, in);
+        return 0;
+    }
+
+    uint32_t end = offset + size;
+    uint32_t first = offset / fs->block_size;
+    uint32_t last = (end - 1) / fs->block_size;
+
+    // Blocks written in part keep the rest of their content, unless they're
+    // new: then it's zeros, not whatever their disk block held before
+    bool first_new = !get_inode_block(fs, in, first);
+    bool last_new = !get_inode_block(fs, in, last);
+
+    uint32_t allocated = allocate_inode_blocks(fs, in, first, last);
+
+    if (allocated < last - first + 1) {
+        last = first + allocated - 1;
+        end = min(end, (last + 1) * fs->block_size);
+    }
+
+    // Through `fs->buffer`, which is fit for device transfers
+    for (uint32_t n = first; n < first + allocated; ) {
+        uint32_t run;
+        uint32_t block = map_inode_blocks(fs, in, n, &run);
+        uint32_t run_start = n*fs->block_size;
+
+        run = min(run, min(last - n + 1, BUFFER_SIZE / fs->block_size));
+
+        uint32_t run_end = run_start + run*fs->block_size;
+        uint32_t from = max(offset, run_start);
+        uint32_t to = min(end, run_end);
+        uint8_t* tail = fs->buffer + (run - 1)*fs->block_size;
+
+        if (from > run_start) {
+            if (first_new) {
+                memset(fs->buffer, 0, fs->block_size);
             } else {
-                write_inode_block(fs, in, block, data + (block - start_block)*fs->block_size);
+                read_block(fs, block, fs->buffer);
             }
         }
 
-        if (offset_end) {
-            memcpy(tmp, data + (end_block - start_block)*fs->block_size - offset_start, offset_end);
-            write_inode_block(fs, in, end_block, tmp);
+        // Unless that block is the one just read
+        if (to < run_end && (run > 1 || from == run_start)) {
+            if (last_new) {
+                memset(tail, 0, fs->block_size);
+            } else {
+                read_block(fs, block + run - 1, tail);
+            }
         }
+
+        memcpy(fs->buffer + from - run_start, data + from - offset, to - from);
+        fs->fs.device.write_blocks((fs_t*) fs, block, run, fs->buffer);
+        n += run;
+    }
+
+    if (allocated) {
+        in->size_lower = max(in->size_lower, end);
+        update_inode(fs, inode, in);
     }
 
-    in->size_lower += size;
-    update_inode(fs, inode, in);
-    kfree(in);
+    put_inode(fs, in);
+    sync_allocations(fs);
 
-    return size;
+    return allocated ? end - offset : 0;
 }
 
 /* Reads at most `size` bytes from `inode`, and returns the number of bytes read.
@@ -375,7 +486,7 @@ uint32_t ext2_read(ext2_fs_t* fs, uint32_t inode, uint32_t offset, uint8_t* buf,
     uint32_t end;
 
     if (!size || !fsize || offset >= fsize) {
-        kfree(in);
+        put_inode(fs, in);
         return 0;
     }
 
@@ -385,39 +496,26 @@ uint32_t ext2_read(ext2_fs_t* fs, uint32_t inode, uint32_t offset, uint8_t* buf,
         end = offset + size;
     }
 
-    uint32_t start_block = offset / fs->block_size;
-    uint32_t end_block = end / fs->block_size;
-    uint32_t start_offset = offset % fs->block_size;
-    uint32_t end_offset = end % fs->block_size;
-    uint32_t bytes_read = end - offset;
+    uint32_t first = offset / fs->block_size;
+    uint32_t last = (end - 1) / fs->block_size;
 
-    uint8_t* tmp = fs->buffer;
+    read_ahead(fs, in, first, last);
 
-    if (start_block == end_block) {
-        read_inode_block(fs, in, start_block, tmp);
-        memcpy(buf, tmp + start_offset, bytes_read);
-    } else {
-        for (uint32_t block_no = start_block; block_no < end_block; block_no++) {
-            if (block_no == start_block) {
-                read_inode_block(fs, in, start_block, tmp);
-                memcpy(buf, tmp + start_offset, fs->block_size - start_offset);
-            } else {
-                // Don't merge these two lines: we need to read into fs->buffer, it's special
-                read_inode_block(fs, in, block_no, tmp);
-                memcpy(buf + (block_no - start_block)*fs->block_size - start_offset, tmp,
-                    fs->block_size);
-            }
-        }
+    // Read runs of contiguous blocks at once, through `fs->buffer` which is
+    // fit for device transfers
+    for (uint32_t n = first; n <= last; ) {
+        uint32_t count = read_inode_blocks(fs, in, n, last - n + 1, fs->buffer);
+        uint32_t run_start = n*fs->block_size;
+        uint32_t from = max(offset, run_start);
+        uint32_t to = min(end, run_start + count*fs->block_size);
 
-        if (end_offset) {
-            read_inode_block(fs, in, end_block, tmp);
-            memcpy(buf + (end_block - start_block)*fs->block_size - start_offset, tmp, end_offset);
-        }
+        memcpy(buf + from - offset, fs->buffer + from - run_start, to - from);
+        n += count;
     }
 
-    kfree(in);
+    put_inode(fs, in);
 
-    return bytes_read;
+    return end - offset;
 }
 
 /* Returns the directory entry at that offset, which must be freed later.
@@ -463,6 +561,7 @@ inode_t* ext2_get_fs_inode(ext2_fs_t* fs, uint32_t inode) {
         fs_in = (inode_t*) fi;
     } else {
         printke("unsupported inode type: %X", INODE_TYPE(in->type_perms));
+        put_inode(fs, in);
         return NULL;
     }
 
@@ -471,14 +570,20 @@ inode_t* ext2_get_fs_inode(ext2_fs_t* fs, uint32_t inode) {
     fs_in->hardlinks = in->hardlinks_count;
     fs_in->fs = (fs_t*) fs;
 
-    kfree(in);
+    put_inode(fs, in);
 
     return fs_in;
 }
 
+/* A file was closed: blocks preallocated for its writes are given back.
+ */
 int32_t ext2_close(ext2_fs_t* fs, uint32_t ino) {
-    UNUSED(fs);
-    UNUSED(ino);
+    ext2_cached_inode_t* cached = find_cached_inode(fs, ino);
+
+    if (cached && cached->prealloc_count) {
+        discard_prealloc(fs, &cached->inode);
+        sync_allocations(fs);
+    }
 
     return 0;
 }
@@ -496,6 +601,8 @@ int32_t ext2_stat(ext2_fs_t* fs, uint32_t ino, stat_t* stat) {
     stat->st_nlink = in->hardlinks_count;
     stat->st_size = in->size_lower;
 
+    put_inode(fs, in);
+
     return 0;
 }
 
@@ -519,8 +626,14 @@ static void write_superblock(ext2_fs_t* fs) {
     write_block(fs, 1, (uint8_t*) fs->sb);
 }
 
+/* Writes the block of the descriptor table that holds that of `group`.
+ */
 static void write_group_descriptor(ext2_fs_t* fs, uint32_t group) {
-    write_block(fs, 2, (uint8_t*) &fs->group_descriptors[group]);
+    uint32_t bgd_block = fs->block_size == 1024 ? 2 : 1;
+    uint32_t index = group * sizeof(group_descriptor_t) / fs->block_size;
+
+    write_block(fs, bgd_block + index,
+        (uint8_t*) fs->group_descriptors + index * fs->block_size);
 }
 
 /* Parses an ext2 superblock from the ext2 partition in the block device.
@@ -568,32 +681,153 @@ static group_descriptor_t* parse_group_descriptors(ext2_fs_t* fs) {
     return memcpy(bgd, fs->buffer, bgd_size);
 }
 
-/* Reads the content of the n-th block of the given inode.
- * Assumes that the requested block exists.
- * `n` is relative to the inode, i.e. it's not an absolute block number.
- * For convenience, reading a non-existent block reads zeros.
+/* Reads blocks of the given inode from the `n`-th one on, at most `count`, as
+ * long as they're contiguous on disk and fit in `BUFFER_SIZE`. A hole is
+ * read alone, as zeros.
+ * Returns the number of blocks read.
  */
-static void read_inode_block(ext2_fs_t* fs, ext2_inode_t* inode, uint32_t n, uint8_t* buf) {
-    uint32_t block = get_inode_block(fs, inode, n);
+static uint32_t read_inode_blocks(ext2_fs_t* fs, ext2_inode_t* inode, uint32_t n, uint32_t count,
+    uint8_t* buf) {
+    uint32_t run;
+    uint32_t block = map_inode_blocks(fs, inode, n, &run);
 
-    if (block) {
-        read_block(fs, block, buf);
-    } else {
+    if (!block) {
         memset(buf, 0, fs->block_size);
+        return 1;
     }
+
+    run = min(run, min(count, BUFFER_SIZE / fs->block_size));
+    fs->fs.device.read_blocks((fs_t*) fs, block, run, buf);
+
+    return run;
 }
 
-/* Writes to the `n`-th block of the given inode.
- * If the block didn't exist, it is created.
+/* Called as blocks `first` to `last` of `inode` are about to be read. Reads
+ * that start where the previous one ended look sequential, and make the
+ * device fetch the next blocks of the file as well, by runs of contiguous
+ * ones. The window doubles with each sequential read, up to
+ * `READAHEAD_MAX`, and is topped up once the reader is halfway through it;
+ * any other read closes it.
+ * The state is that of the inode, as filesystems don't see open files.
  */
-static void write_inode_block(ext2_fs_t* fs, ext2_inode_t* inode, uint32_t n, uint8_t* buf) {
-    uint32_t block = get_or_create_inode_block(fs, inode, n);
+static void read_ahead(ext2_fs_t* fs, ext2_inode_t* inode, uint32_t first, uint32_t last) {
+    ext2_cached_inode_t* cached = (ext2_cached_inode_t*) inode;
 
-    write_block(fs, block, buf);
+    if (!fs->fs.device.prefetch) {
+        return;
+    }
+
+    // A read may start in the block the previous one ended in
+    if (first == cached->ra_next || first + 1 == cached->ra_next) {
+        cached->ra_window = max(READAHEAD_MIN, min(2*cached->ra_window, READAHEAD_MAX));
+    } else {
+        cached->ra_window = 0;
+        cached->ra_end = 0;
+    }
+
+    cached->ra_next = last + 1;
+
+    if (!cached->ra_window || cached->ra_end > last + cached->ra_window/2) {
+        return;
+    }
+
+    uint32_t num_blocks = divide_up(inode->size_lower, fs->block_size);
+    uint32_t n = max(first, cached->ra_end);
+    uint32_t end = min(last + 1 + cached->ra_window, num_blocks);
+
+    cached->ra_end = end;
+
+    while (n < end) {
+        uint32_t run;
+        uint32_t block = map_inode_blocks(fs, inode, n, &run);
+
+        run = min(run, end - n);
+
+        if (block) {
+            fs->fs.device.prefetch((fs_t*) fs, block, run);
+        }
+
+        n += run;
+    }
 }
 
-/* Returns an inode struct from an inode number.
- * This inode can be freed using `kfree`.
+/* Returns the cached inode `ino`, or NULL if it isn't cached.
+ */
+static ext2_cached_inode_t* find_cached_inode(ext2_fs_t* fs, uint32_t ino) {
+    ext2_cached_inode_t* cached;
+
+    list_for_each_entry(cached, &fs->inodes[ino % INODE_CACHE_BUCKETS]) {
+        if (cached->ino == ino) {
+            return cached;
+        }
+    }
+
+    return NULL;
+}
+
+/* Writes a cached inode back to its inode table. Only the fields we know of
+ * are written, the rest of the on-disk inode is left as is.
+ */
+static void write_inode(ext2_fs_t* fs, ext2_cached_inode_t* cached) {
+    uint32_t ino = cached->ino;
+    uint32_t group = (ino - 1) / fs->sb->inodes_per_group;
+    uint32_t table_block = fs->group_descriptors[group].inode_table;
+    uint32_t index = (ino - 1) % fs->sb->inodes_per_group;
+    uint32_t block_offset = (index * fs->inode_size) / fs->block_size;
+    uint32_t offset_in_block = (index * fs->inode_size) % fs->block_size;
+
+    uint8_t* tmp = kmalloc(fs->block_size);
+    read_block(fs, table_block + block_offset, tmp);
+    memcpy(tmp + offset_in_block, &cached->inode, sizeof(ext2_inode_t));
+    write_block(fs, table_block + block_offset, tmp);
+    kfree(tmp);
+
+    cached->dirty = false;
+}
+
+/* Makes room for one more inode in the cache, dropping the least recently
+ * used inode nobody holds if it's full.
+ */
+static void evict_inode(ext2_fs_t* fs) {
+    ext2_cached_inode_t* oldest = NULL;
+    list_t* oldest_iter = NULL;
+
+    if (fs->num_inodes < INODE_CACHE_SIZE) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < INODE_CACHE_BUCKETS; i++) {
+        ext2_cached_inode_t* cached;
+        list_t* iter;
+
+        list_for_each(iter, cached, &fs->inodes[i]) {
+            if (!cached->refs && (!oldest || cached->last_use < oldest->last_use)) {
+                oldest = cached;
+                oldest_iter = iter;
+            }
+        }
+    }
+
+    if (!oldest) {
+        return;
+    }
+
+    if (oldest->prealloc_count) {
+        discard_prealloc(fs, &oldest->inode);
+    }
+
+    if (oldest->dirty) {
+        write_inode(fs, oldest);
+    }
+
+    list_del(oldest_iter);
+    kfree(oldest);
+    fs->num_inodes--;
+}
+
+/* Returns the inode `inode`, read from disk only if it isn't cached already.
+ * The inode is shared with the other operations using it, and must be
+ * released with `put_inode`; changes to it are saved with `update_inode`.
  * Note: doesn't check that the inode is valid.
  */
 static ext2_inode_t* get_inode(ext2_fs_t* fs, uint32_t inode) {
@@ -601,180 +835,426 @@ static ext2_inode_t* get_inode(ext2_fs_t* fs, uint32_t inode) {
         return NULL;
     }
 
+    ext2_cached_inode_t* cached = find_cached_inode(fs, inode);
+
+    if (cached) {
+        cached->refs++;
+        cached->last_use = ++fs->inode_clock;
+        return &cached->inode;
+    }
+
+    evict_inode(fs);
+
     // which block group is our inode in?
     uint32_t group = (inode - 1) / fs->sb->inodes_per_group;
 
     // get the location of the inode table from the group block's descriptor
     uint32_t table_block = fs->group_descriptors[group].inode_table;
-    uint32_t block_offset = ((inode - 1) * fs->inode_size) / fs->block_size;
-    uint32_t index_in_block = (inode - 1) - block_offset * (fs->block_size / fs->inode_size);
+    uint32_t index = (inode - 1) % fs->sb->inodes_per_group;
+    uint32_t block_offset = (index * fs->inode_size) / fs->block_size;
+    uint32_t offset_in_block = (index * fs->inode_size) % fs->block_size;
 
     read_block(fs, table_block + block_offset, fs->buffer);
-    ext2_inode_t* in = kmalloc(fs->inode_size);
-    memcpy(in, fs->buffer + index_in_block*fs->inode_size, fs->inode_size);
 
-    return in;
+    cached = kmalloc(sizeof(ext2_cached_inode_t));
+    memcpy(&cached->inode, fs->buffer + offset_in_block, sizeof(ext2_inode_t));
+    cached->ino = inode;
+    cached->refs = 1;
+    cached->last_use = ++fs->inode_clock;
+    cached->dirty = false;
+    cached->ra_next = 0;
+    cached->ra_window = 0;
+    cached->ra_end = 0;
+    cached->prealloc_block = 0;
+    cached->prealloc_count = 0;
+    forget_extents(&cached->inode);
+
+    list_add(&fs->inodes[inode % INODE_CACHE_BUCKETS], cached);
+    fs->num_inodes++;
+
+    return &cached->inode;
+}
+
+/* Releases an inode returned by `get_inode`. Once nobody holds it, changes
+ * made to it are written back.
+ */
+static void put_inode(ext2_fs_t* fs, ext2_inode_t* in) {
+    ext2_cached_inode_t* cached = (ext2_cached_inode_t*) in;
+
+    if (!in) {
+        return;
+    }
+
+    if (--cached->refs == 0 && cached->dirty) {
+        write_inode(fs, cached);
+    }
+}
+
+/* Returns the bitmap of `group`, of its blocks if `blocks` or else of its
+ * inodes, reading it from disk the first time.
+ */
+static uint8_t* get_bitmap(ext2_fs_t* fs, uint32_t group, bool blocks) {
+    ext2_group_t* g = &fs->groups[group];
+    uint8_t** bitmap = blocks ? &g->block_bitmap : &g->inode_bitmap;
+
+    if (!*bitmap) {
+        uint32_t bits = blocks ? fs->sb->blocks_per_group : fs->sb->inodes_per_group;
+        uint32_t first_block = blocks ? fs->group_descriptors[group].block_bitmap :
+            fs->group_descriptors[group].inode_bitmap;
+        uint32_t num_blocks = divide_up(bits, 8 * fs->block_size);
+
+        *bitmap = kmalloc(num_blocks * fs->block_size);
+
+        for (uint32_t i = 0; i < num_blocks; i++) {
+            read_block(fs, first_block + i, *bitmap + i * fs->block_size);
+        }
+    }
+
+    return *bitmap;
+}
+
+/* Returns the first clear bit of `bitmap` from `start` on, or `bits` if
+ * they're all set.
+ */
+static uint32_t find_clear_bit(uint8_t* bitmap, uint32_t start, uint32_t bits) {
+    uint32_t i = start;
+
+    while (i < bits) {
+        if (i % 8 == 0 && bitmap[i / 8] == 0xFF) {
+            i += 8;
+        } else if (bitmap[i / 8] & (1 << (i % 8))) {
+            i++;
+        } else {
+            return i;
+        }
+    }
+
+    return bits;
+}
+
+/* Writes the bitmaps and descriptors of the groups that allocations changed,
+ * and the superblock. Allocations only change memory, this is done once at
+ * the end of each operation rather than for every block.
+ */
+static void sync_allocations(ext2_fs_t* fs) {
+    for (uint32_t group = 0; group < fs->num_block_groups; group++) {
+        ext2_group_t* g = &fs->groups[group];
+        group_descriptor_t* gd = &fs->group_descriptors[group];
+
+        if (!g->dirty) {
+            continue;
+        }
+
+        if (g->block_bitmap) {
+            for (uint32_t i = 0; i < divide_up(fs->sb->blocks_per_group, 8 * fs->block_size); i++) {
+                write_block(fs, gd->block_bitmap + i, g->block_bitmap + i * fs->block_size);
+            }
+        }
+
+        if (g->inode_bitmap) {
+            for (uint32_t i = 0; i < divide_up(fs->sb->inodes_per_group, 8 * fs->block_size); i++) {
+                write_block(fs, gd->inode_bitmap + i, g->inode_bitmap + i * fs->block_size);
+            }
+        }
+
+        write_group_descriptor(fs, group);
+        g->dirty = false;
+    }
+
+    if (fs->sb_dirty) {
+        write_superblock(fs);
+        fs->sb_dirty = false;
+    }
 }
 
-/* Returns a free block number, marking it as used.
+/* Allocates up to `wanted` consecutive blocks, the first one as soon as possible
+ * after `goal`, so that files that grow stay contiguous. Groups are searched
+ * from that of `goal` on, wrapping around.
+ * Returns the first block allocated and sets `count`, or returns zero if the
+ * disk is full.
  */
-static uint32_t allocate_block(ext2_fs_t* fs) {
-    /* Exit early */
+static uint32_t allocate_blocks(ext2_fs_t* fs, uint32_t goal, uint32_t wanted, uint32_t* count) {
+    uint32_t first_data_block = fs->sb->superblock_block;
+    uint32_t per_group = fs->sb->blocks_per_group;
+
+    *count = 0;
+
     if (!fs->sb->free_blocks) {
         return 0;
     }
 
-    /* Find the first non-full block group */
-    uint32_t group;
-    for (group = 0; group < fs->num_block_groups; group++) {
-        if (fs->group_descriptors[group].free_blocks) {
-            break;
-        }
+    if (goal < first_data_block || goal >= fs->sb->blocks_count) {
+        goal = first_data_block;
     }
 
-    /* Go through the bitmap */
-    uint32_t bitmap_block = fs->group_descriptors[group].block_bitmap;
-    uint32_t block_offset = 0;
-    uint8_t* tmp = fs->buffer;
+    uint32_t goal_group = (goal - first_data_block) / per_group;
+
+    // The goal's group is searched again last, for blocks before the goal
+    for (uint32_t i = 0; i <= fs->num_block_groups; i++) {
+        uint32_t group = (goal_group + i) % fs->num_block_groups;
+        ext2_group_t* g = &fs->groups[group];
+        group_descriptor_t* gd = &fs->group_descriptors[group];
+        uint32_t group_start = first_data_block + group * per_group;
+        uint32_t bits = min(per_group, fs->sb->blocks_count - group_start);
+        uint32_t start = g->next_block;
 
-    for (uint32_t i = 0; i < fs->sb->blocks_per_group; i++) {
-        if (i % (8 * fs->block_size) == 0) {
-            read_block(fs, bitmap_block + block_offset++, tmp);
+        if (!gd->free_blocks) {
+            continue;
         }
 
-        uint32_t rel_i = i - (block_offset - 1) * 8 * fs->block_size;
-        uint8_t chunk = tmp[rel_i / 8];
+        if (i == 0) {
+            start = max(start, (goal - first_data_block) % per_group);
+        }
+
+        uint8_t* bitmap = get_bitmap(fs, group, true);
+        uint32_t bit = find_clear_bit(bitmap, start, bits);
 
-        /* Free block found: update disk structures */
-        if (!(chunk & (1 << (rel_i % 8)))) {
-            tmp[rel_i / 8] = chunk | 1 << (rel_i % 8);
-            write_block(fs, bitmap_block + block_offset - 1, tmp);
+        if (bit == bits) {
+            continue;
+        }
 
-            fs->sb->free_blocks--;
-            fs->group_descriptors[group].free_blocks--;
-            write_superblock(fs);
-            write_group_descriptor(fs, group);
+        while (*count < wanted && *count < gd->free_blocks && bit + *count < bits &&
+               !(bitmap[(bit + *count) / 8] & (1 << ((bit + *count) % 8)))) {
+            bitmap[(bit + *count) / 8] |= 1 << ((bit + *count) % 8);
+            (*count)++;
+        }
 
-            return group * fs->sb->blocks_per_group + i + 1;
+        if (bit == g->next_block) {
+            g->next_block = bit + *count;
         }
+
+        gd->free_blocks -= *count;
+        fs->sb->free_blocks -= *count;
+        g->dirty = true;
+        fs->sb_dirty = true;
+
+        return group_start + bit;
     }
 
     printke("block allocation failed when it shouldn't have");
-    abort();
 
     return 0;
 }
 
+/* Returns a new block for `inode`, as close after `goal` as possible.
+ * Regular files get `PREALLOC_BLOCKS` at once, see `reserve_inode_blocks`.
+ */
+static uint32_t allocate_inode_block(ext2_fs_t* fs, ext2_inode_t* inode, uint32_t goal) {
+    ext2_cached_inode_t* cached = (ext2_cached_inode_t*) inode;
+
+    if (!cached->prealloc_count) {
+        bool prealloc = INODE_TYPE(inode->type_perms) == INODE_FILE;
+        reserve_inode_blocks(fs, inode, goal, prealloc ? PREALLOC_BLOCKS : 1);
+    }
+
+    if (!cached->prealloc_count) {
+        return 0;
+    }
+
+    cached->prealloc_count--;
+
+    return cached->prealloc_block++;
+}
+
+/* Allocates `wanted` consecutive blocks for the next allocations of `inode`,
+ * as close after `goal` as possible, unless it has that many already. They
+ * are kept until the file is closed or leaves the inode cache. Fewer blocks
+ * are reserved when there aren't enough free ones in a row.
+ */
+static void reserve_inode_blocks(ext2_fs_t* fs, ext2_inode_t* inode, uint32_t goal, uint32_t wanted) {
+    ext2_cached_inode_t* cached = (ext2_cached_inode_t*) inode;
+    uint32_t count;
+
+    if (cached->prealloc_count >= wanted) {
+        return;
+    }
+
+    if (cached->prealloc_count) {
+        // Grow the reservation in place if the blocks after it are free
+        goal = cached->prealloc_block;
+        discard_prealloc(fs, inode);
+    } else if (!goal) {
+        // Start new files near their inode
+        uint32_t group = (cached->ino - 1) / fs->sb->inodes_per_group;
+        goal = fs->sb->superblock_block + group * fs->sb->blocks_per_group;
+    }
+
+    uint32_t block = allocate_blocks(fs, goal, wanted, &count);
+
+    if (block) {
+        cached->prealloc_block = block;
+        cached->prealloc_count = count;
+    }
+}
+
+/* Gives back the blocks preallocated for `inode`.
+ */
+static void discard_prealloc(ext2_fs_t* fs, ext2_inode_t* inode) {
+    ext2_cached_inode_t* cached = (ext2_cached_inode_t*) inode;
+
+    while (cached->prealloc_count) {
+        cached->prealloc_count--;
+        free_block(fs, cached->prealloc_block++);
+    }
+}
+
 static void free_block(ext2_fs_t* fs, uint32_t block) {
-    uint32_t group_no = block / fs->sb->blocks_per_group;
-    uint32_t bitmap_block = fs->group_descriptors[group_no].block_bitmap;
-    uint32_t rel_block = block % fs->sb->blocks_per_group;
-    uint32_t block_offset = rel_block / (8 * fs->block_size);
-    uint8_t* bitmap = kmalloc(fs->block_size);
+    uint32_t rel_block = block - fs->sb->superblock_block;
+    uint32_t group = rel_block / fs->sb->blocks_per_group;
+    uint32_t bit = rel_block % fs->sb->blocks_per_group;
+    uint8_t* bitmap = get_bitmap(fs, group, true);
+
+    bitmap[bit / 8] &= ~(1 << (bit % 8));
 
-    read_block(fs, bitmap_block + block_offset, bitmap);
-    bitmap[rel_block / 8] &= ~(1 << (rel_block % 8));
-    write_block(fs, bitmap_block + block_offset, bitmap);
-    kfree(bitmap);
+    if (bit < fs->groups[group].next_block) {
+        fs->groups[group].next_block = bit;
+    }
 
+    fs->group_descriptors[group].free_blocks++;
     fs->sb->free_blocks++;
-    fs->group_descriptors[group_no].free_blocks++;
-    write_superblock(fs);
-    write_group_descriptor(fs, group_no);
+    fs->groups[group].dirty = true;
+    fs->sb_dirty = true;
 }
 
-/* Returns the first free inode number available.
+/* Returns a free inode number, marking it as used, preferably in the group of
+ * the directory `d_ino` it'll be in. Returns zero if there's none left.
  */
-static uint32_t allocate_inode(ext2_fs_t* fs) {
+static uint32_t allocate_inode(ext2_fs_t* fs, uint32_t d_ino) {
+    uint32_t per_group = fs->sb->inodes_per_group;
+    uint32_t goal_group = (d_ino - 1) / per_group;
+
     if (!fs->sb->free_inodes) {
         printke("allocate_inode: no inodes left");
         return 0;
     }
 
-    /* Find a block group with a free inode */
-    uint32_t group;
-    for (group = 0; group < fs->num_block_groups; group++) {
-        if (fs->group_descriptors[group].free_inodes) {
-            break;
+    for (uint32_t i = 0; i < fs->num_block_groups; i++) {
+        uint32_t group = (goal_group + i) % fs->num_block_groups;
+        ext2_group_t* g = &fs->groups[group];
+
+        if (!fs->group_descriptors[group].free_inodes) {
+            continue;
         }
-    }
 
-    /* Go through the bitmap, knowing it's at most a block long */
-    uint8_t* tmp = kmalloc(fs->block_size);
-    uint32_t bitmap_block = fs->group_descriptors[group].inode_bitmap;
-    read_block(fs, bitmap_block, tmp);
-
-    for (uint32_t i = 0; i < fs->sb->inodes_per_group; i++) {
-        if (!(tmp[i / 8] & (1 << (i % 8)))) {
-            tmp[i / 8] |= 1 << (i % 8);
-            write_block(fs, bitmap_block, tmp);
-            kfree(tmp);
-
-            fs->group_descriptors[group].free_inodes--;
-            fs->sb->free_inodes--;
-            write_superblock(fs);
-            write_group_descriptor(fs, group);
-
-            // The first bit is inode no. 1
-            return i + 1;
+        uint8_t* bitmap = get_bitmap(fs, group, false);
+        uint32_t bit = find_clear_bit(bitmap, g->next_inode, per_group);
+
+        if (bit == per_group) {
+            continue;
         }
+
+        bitmap[bit / 8] |= 1 << (bit % 8);
+        g->next_inode = bit + 1;
+        g->dirty = true;
+
+        fs->group_descriptors[group].free_inodes--;
+        fs->sb->free_inodes--;
+        fs->sb_dirty = true;
+
+        // The first bit is inode no. 1
+        return group * per_group + bit + 1;
     }
 
     printke("inode allocation failed when it shouldn't have");
-    abort();
 
     return 0;
 }
 
+/* Frees the indirect block `block` and the blocks it points to, which are
+ * themselves indirect blocks if `depth` is above 1.
+ */
+static void free_indirect_block(ext2_fs_t* fs, uint32_t block, uint32_t depth) {
+    if (depth > 1) {
+        uint32_t* pointers = kmalloc(fs->block_size);
+
+        read_block(fs, block, (uint8_t*) pointers);
+
+        for (uint32_t i = 0; i < fs->block_size / sizeof(uint32_t); i++) {
+            if (pointers[i]) {
+                free_indirect_block(fs, pointers[i], depth - 1);
+            }
+        }
+
+        kfree(pointers);
+    }
+
+    free_block(fs, block);
+}
+
 /* Marks an inode as free, along with its allocated blocks.
  */
 static void free_inode(ext2_fs_t* fs, uint32_t ino) {
-    /* Free the blocks owned by the inode */
+    /* Free the blocks owned by the inode, run by run */
     ext2_inode_t* in = get_inode(fs, ino);
     uint32_t num_blocks = divide_up(in->size_lower, fs->block_size);
-    kfree(in);
 
-    for (uint32_t iblock = 0; iblock < num_blocks; iblock++) {
-        uint32_t rblock = get_inode_block(fs, in, iblock);
-        free_block(fs, rblock);
+    for (uint32_t n = 0; n < num_blocks; ) {
+        uint32_t run;
+        uint32_t block = map_inode_blocks(fs, in, n, &run);
+
+        run = min(run, num_blocks - n);
+
+        for (uint32_t i = 0; block && i < run; i++) {
+            free_block(fs, block + i);
+        }
+
+        n += run;
+    }
+
+    if (in->sibp) {
+        free_indirect_block(fs, in->sibp, 1);
+    }
+
+    if (in->dibp) {
+        free_indirect_block(fs, in->dibp, 2);
     }
 
+    if (in->tibp) {
+        free_indirect_block(fs, in->tibp, 3);
+    }
+
+    discard_prealloc(fs, in);
+    forget_extents(in);
+    put_inode(fs, in);
+
     /* Free the inode itself */
-    uint8_t* bitmap = kmalloc(fs->block_size);
-    uint32_t group_no = ino / fs->sb->inodes_per_group;
-    uint32_t bitmap_block = fs->group_descriptors[group_no].inode_bitmap;
-    uint32_t rel_ino = (ino - 1) % fs->sb->inodes_per_group;
+    uint32_t group = (ino - 1) / fs->sb->inodes_per_group;
+    uint32_t bit = (ino - 1) % fs->sb->inodes_per_group;
+    uint8_t* bitmap = get_bitmap(fs, group, false);
+
+    bitmap[bit / 8] &= ~(1 << (bit % 8));
 
-    read_block(fs, bitmap_block, bitmap);
-    bitmap[rel_ino / 8] &= ~(1 << (rel_ino % 8));
-    write_block(fs, bitmap_block, bitmap);
-    kfree(bitmap);
+    if (bit < fs->groups[group].next_inode) {
+        fs->groups[group].next_inode = bit;
+    }
 
-    fs->group_descriptors[group_no].free_inodes++;
+    fs->group_descriptors[group].free_inodes++;
     fs->sb->free_inodes++;
-    write_superblock(fs);
-    write_group_descriptor(fs, group_no);
+    fs->groups[group].dirty = true;
+    fs->sb_dirty = true;
 }
 
-/* Returns the minimum size of a directory entry with the given filename.
+/* Returns the room an entry with a name of `name_len` characters takes up in
+ * its record, at least.
  */
-static uint32_t min_dir_entry_size(const char* name) {
-    return align_to(sizeof(ext2_directory_entry_t) + strlen(name), 4);
+static uint32_t min_dir_entry_size(uint32_t name_len) {
+    return align_to(sizeof(ext2_directory_entry_t) + name_len, 4);
 }
 
-/* Update the inode no. `no` on disk with the content of `in`.
+/* Saves `in` as the content of the inode no. `ino`. `in` is either that inode
+ * as returned by `get_inode`, or a copy of its new content. Writing to disk is
+ * deferred until the inode is released by all operations using it.
  */
 static void update_inode(ext2_fs_t* fs, uint32_t ino, ext2_inode_t* in) {
-    uint32_t group = (ino - 1) / fs->sb->inodes_per_group;
-    uint32_t table_block = fs->group_descriptors[group].inode_table;
-    uint32_t block_offset = ((ino - 1) * fs->inode_size) / fs->block_size;
-    uint32_t offset_in_block = ((ino - 1) * fs->inode_size) % fs->block_size;
+    ext2_inode_t* cached = get_inode(fs, ino);
 
-    uint8_t* tmp = kmalloc(fs->block_size);
-    read_block(fs, table_block + block_offset, tmp);
-    memcpy(tmp + offset_in_block, in, fs->inode_size);
-    write_block(fs, table_block + block_offset, tmp);
-    kfree(tmp);
+    if (cached != in) {
+        memcpy(cached, in, sizeof(ext2_inode_t));
+        forget_extents(cached);
+    }
+
+    ((ext2_cached_inode_t*) cached)->dirty = true;
+    put_inode(fs, cached);
 }
 
 /* Returns the nth data block of an inode, creating it if it doesn't exist.
@@ -785,11 +1265,22 @@ static void update_inode(ext2_fs_t* fs, uint32_t ino, ext2_inode_t* in) {
 static uint32_t get_or_create_inode_block(ext2_fs_t* fs, ext2_inode_t* in, uint32_t n) {
     // Number of block pointers in an indirect block
     uint32_t p = fs->block_size / sizeof(uint32_t);
-    uint32_t ret = 0;
+    uint32_t ret = get_inode_block(fs, in, n);
+
+    if (ret) {
+        return ret;
+    }
+
+    // Holes the map remembers are about to be filled
+    forget_extents(in);
+
+    // Blocks go after the previous one, so that files stay contiguous
+    uint32_t previous = n ? get_inode_block(fs, in, n - 1) : 0;
+    uint32_t goal = previous ? previous + 1 : 0;
 
     if (n < 12) {
         if (!in->dbp[n]) {
-            in->dbp[n] = allocate_block(fs);
+            in->dbp[n] = allocate_inode_block(fs, in, goal);
         }
 
         ret = in->dbp[n];
@@ -798,14 +1289,14 @@ static uint32_t get_or_create_inode_block(ext2_fs_t* fs, ext2_inode_t* in, uint3
         uint32_t relblock = n - 12;
 
         if (!in->sibp) {
-            in->sibp = allocate_block(fs);
+            in->sibp = allocate_inode_block(fs, in, goal);
             write_block(fs, in->sibp, (uint8_t*) tmp);
         }
 
         read_block(fs, in->sibp, (uint8_t*) tmp);
 
         if (!tmp[relblock]) {
-            tmp[relblock] = allocate_block(fs);
+            tmp[relblock] = allocate_inode_block(fs, in, goal);
             write_block(fs, in->sibp, (uint8_t*) tmp);
         }
 
@@ -818,14 +1309,14 @@ static uint32_t get_or_create_inode_block(ext2_fs_t* fs, ext2_inode_t* in, uint3
         uint32_t offset_b = relblock % p;
 
         if (!in->dibp) {
-            in->dibp = allocate_block(fs);
+            in->dibp = allocate_inode_block(fs, in, goal);
             clear_block(fs, in->dibp);
         }
 
         read_block(fs, in->dibp, (uint8_t*) tmp);
 
         if (!tmp[offset_a]) {
-            tmp[offset_a] = allocate_block(fs);
+            tmp[offset_a] = allocate_inode_block(fs, in, goal);
             clear_block(fs, tmp[offset_a]);
             write_block(fs, in->dibp, (uint8_t*) tmp);
         }
@@ -834,7 +1325,7 @@ static uint32_t get_or_create_inode_block(ext2_fs_t* fs, ext2_inode_t* in, uint3
         read_block(fs, tmp[offset_a], (uint8_t*) tmp);
 
         if (!tmp[offset_b]) {
-            tmp[offset_b] = allocate_block(fs);
+            tmp[offset_b] = allocate_inode_block(fs, in, goal);
             write_block(fs, block_a, (uint8_t*) tmp);
         }
 
@@ -844,18 +1335,18 @@ static uint32_t get_or_create_inode_block(ext2_fs_t* fs, ext2_inode_t* in, uint3
         uint32_t* tmp = zalloc(fs->block_size);
         uint32_t relblock = n - 12 - p - p*p;
         uint32_t offset_a = relblock / (p*p);
-        uint32_t offset_b = relblock % (p*p);
+        uint32_t offset_b = (relblock / p) % p;
         uint32_t offset_c = relblock % p;
 
         if (!in->tibp) {
-            in->tibp = allocate_block(fs);
+            in->tibp = allocate_inode_block(fs, in, goal);
             clear_block(fs, in->tibp);
         }
 
         read_block(fs, in->tibp, (uint8_t*) tmp);
 
         if (!tmp[offset_a]) {
-            tmp[offset_a] = allocate_block(fs);
+            tmp[offset_a] = allocate_inode_block(fs, in, goal);
             clear_block(fs, tmp[offset_a]);
             write_block(fs, in->tibp, (uint8_t*) tmp);
         }
@@ -864,7 +1355,7 @@ static uint32_t get_or_create_inode_block(ext2_fs_t* fs, ext2_inode_t* in, uint3
         read_block(fs, tmp[offset_a], (uint8_t*) tmp);
 
         if (!tmp[offset_b]) {
-            tmp[offset_b] = allocate_block(fs);
+            tmp[offset_b] = allocate_inode_block(fs, in, goal);
             clear_block(fs, tmp[offset_b]);
             write_block(fs, block_a, (uint8_t*) tmp);
         }
@@ -873,7 +1364,7 @@ static uint32_t get_or_create_inode_block(ext2_fs_t* fs, ext2_inode_t* in, uint3
         read_block(fs, tmp[offset_b], (uint8_t*) tmp);
 
         if (!tmp[offset_c]) {
-            tmp[offset_c] = allocate_block(fs);
+            tmp[offset_c] = allocate_inode_block(fs, in, goal);
             write_block(fs, block_b, (uint8_t*) tmp);
         }
 
@@ -886,205 +1377,403 @@ static uint32_t get_or_create_inode_block(ext2_fs_t* fs, ext2_inode_t* in, uint3
     return ret;
 }
 
-/* Returns the nth data block of an inode, or zero if it does not exist.
+/* Makes sure that blocks `first` to `last` of `inode` exist. The missing ones
+ * are reserved all at once beforehand, so that they end up contiguous even
+ * if other files grow meanwhile.
+ * Returns the number of blocks from `first` on that exist, fewer than asked
+ * if the disk is full.
+ */
+static uint32_t allocate_inode_blocks(ext2_fs_t* fs, ext2_inode_t* inode, uint32_t first,
+    uint32_t last) {
+    ext2_cached_inode_t* cached = (ext2_cached_inode_t*) inode;
+    uint32_t missing = 0;
+    uint32_t goal = 0;
+
+    for (uint32_t n = first; n <= last; ) {
+        uint32_t run;
+        uint32_t block = map_inode_blocks(fs, inode, n, &run);
+
+        run = min(run, last - n + 1);
+
+        if (!block) {
+            // Blocks go after the one before the first hole
+            if (!missing && n) {
+                uint32_t previous = get_inode_block(fs, inode, n - 1);
+                goal = previous ? previous + 1 : 0;
+            }
+
+            missing += run;
+        }
+
+        n += run;
+    }
+
+    if (!missing) {
+        return last - first + 1;
+    }
+
+    if (INODE_TYPE(inode->type_perms) == INODE_FILE && cached->prealloc_count < missing) {
+        reserve_inode_blocks(fs, inode, goal, max(missing, PREALLOC_BLOCKS));
+    }
+
+    for (uint32_t n = first; n <= last; n++) {
+        if (!get_or_create_inode_block(fs, inode, n)) {
+            return n - first;
+        }
+    }
+
+    return last - first + 1;
+}
+
+/* Returns the `n`-th data block of an inode, or zero if it doesn't exist,
+ * and sets `count` to the number of blocks from the `n`-th on that follow it
+ * on disk, or that are holes as well, as far as the block of pointers to the
+ * `n`-th one tells.
  * Note: returning zero may simply mean that we're reading a sparse file;
  * such blocks are defined as containing only zeros.
  */
-static uint32_t get_inode_block(ext2_fs_t* fs, ext2_inode_t* inode, uint32_t n) {
+static uint32_t resolve_inode_blocks(ext2_fs_t* fs, ext2_inode_t* inode, uint32_t n,
+    uint32_t* count) {
     // Number of block pointers in an indirect block
     uint32_t p = fs->block_size / sizeof(uint32_t);
-    uint32_t ret = 0;
+    uint32_t* tmp = NULL;
+    uint32_t* pointers = NULL; // Those of the block that points to the `n`-th one
+    uint32_t num_pointers = p;
+    uint32_t index = 0;
+
+    *count = 1;
 
     if (n < 12) {
-        ret = inode->dbp[n];
+        pointers = inode->dbp;
+        num_pointers = 12;
+        index = n;
     } else if (n < 12 + p) {
-        uint32_t* tmp = kmalloc(fs->block_size);
         uint32_t relblock = n - 12;
 
-        read_block(fs, inode->sibp, (uint8_t*) tmp);
-        ret = tmp[relblock];
-        kfree(tmp);
+        if (inode->sibp) {
+            tmp = kmalloc(fs->block_size);
+            read_block(fs, inode->sibp, (uint8_t*) tmp);
+            pointers = tmp;
+            index = relblock;
+        }
     } else if (n < 12 + p + p*p) {
-        uint32_t* tmp = kmalloc(fs->block_size);
         uint32_t relblock = n - 12 - p;
         uint32_t offset_a = relblock / p;
         uint32_t offset_b = relblock % p;
 
-        read_block(fs, inode->dibp, (uint8_t*) tmp);
-        read_block(fs, tmp[offset_a], (uint8_t*) tmp);
-        ret = tmp[offset_b];
-        kfree(tmp);
+        if (inode->dibp) {
+            tmp = kmalloc(fs->block_size);
+            read_block(fs, inode->dibp, (uint8_t*) tmp);
+
+            if (tmp[offset_a]) {
+                read_block(fs, tmp[offset_a], (uint8_t*) tmp);
+                pointers = tmp;
+                index = offset_b;
+            }
+        }
     } else if (n < 12 + p + p*p + p*p*p) { // TODO: test this
-        uint32_t* tmp = kmalloc(fs->block_size);
         uint32_t relblock = n - 12 - p - p*p;
         uint32_t offset_a = relblock / (p*p);
-        uint32_t offset_b = relblock % (p*p);
+        uint32_t offset_b = (relblock / p) % p;
         uint32_t offset_c = relblock % p;
 
-        read_block(fs, inode->tibp, (uint8_t*) tmp);
-        read_block(fs, tmp[offset_a], (uint8_t*) tmp);
-        read_block(fs, tmp[offset_b], (uint8_t*) tmp);
-        ret = tmp[offset_c];
-        kfree(tmp);
+        if (inode->tibp) {
+            tmp = kmalloc(fs->block_size);
+            read_block(fs, inode->tibp, (uint8_t*) tmp);
+
+            if (tmp[offset_a]) {
+                read_block(fs, tmp[offset_a], (uint8_t*) tmp);
+
+                if (tmp[offset_b]) {
+                    read_block(fs, tmp[offset_b], (uint8_t*) tmp);
+                    pointers = tmp;
+                    index = offset_c;
+                }
+            }
+        }
     } else {
         printke("invalid inode block");
     }
 
-    return ret;
+    if (!pointers) {
+        kfree(tmp);
+        return 0;
+    }
+
+    uint32_t block = pointers[index];
+
+    while (index + *count < num_pointers &&
+           pointers[index + *count] == (block ? block + *count : 0)) {
+        (*count)++;
+    }
+
+    kfree(tmp);
+
+    return block;
+}
+
+/* Like `resolve_inode_blocks`, for an inode returned by `get_inode`, which
+ * remembers the runs of blocks it resolved. Sequential accesses thus read
+ * indirect blocks once per run rather than once per block.
+ */
+static uint32_t map_inode_blocks(ext2_fs_t* fs, ext2_inode_t* inode, uint32_t n, uint32_t* count) {
+    ext2_cached_inode_t* cached = (ext2_cached_inode_t*) inode;
+
+    for (uint32_t i = 0; i < EXTENT_CACHE_SIZE; i++) {
+        ext2_extent_t* extent = &cached->extents[i];
+
+        if (n >= extent->first && n - extent->first < extent->count) {
+            *count = extent->count - (n - extent->first);
+            return extent->block ? extent->block + (n - extent->first) : 0;
+        }
+    }
+
+    uint32_t block = resolve_inode_blocks(fs, inode, n, count);
+
+    cached->extents[cached->next_extent] = (ext2_extent_t) {
+        .first = n,
+        .count = *count,
+        .block = block
+    };
+    cached->next_extent = (cached->next_extent + 1) % EXTENT_CACHE_SIZE;
+
+    return block;
+}
+
+/* Empties the block map cache of an inode returned by `get_inode`, for when
+ * its blocks change.
+ */
+static void forget_extents(ext2_inode_t* inode) {
+    ext2_cached_inode_t* cached = (ext2_cached_inode_t*) inode;
+
+    memset(cached->extents, 0, sizeof(cached->extents));
+    cached->next_extent = 0;
+}
+
+/* Returns the nth data block of an inode, or zero if it does not exist.
+ */
+static uint32_t get_inode_block(ext2_fs_t* fs, ext2_inode_t* inode, uint32_t n) {
+    uint32_t count;
+
+    return map_inode_blocks(fs, inode, n, &count);
 }
 
 /* Creates a new entry with name `name` in the directory pointed to by
- * `parent_inode` with type `type`, one of the DTYPE_* constants.
+ * `parent_inode` with type `type`, one of the DENT_* constants.
  * Returns the inode of the created file.
  */
 static uint32_t add_directory_entry(ext2_fs_t* fs, const char* name, uint32_t d_ino, uint32_t type) {
     ext2_inode_t* d_in = get_inode(fs, d_ino);
 
     if (!d_in || INODE_TYPE(d_in->type_perms) != INODE_DIR) {
+        put_inode(fs, d_in);
         return 0;
     }
 
-    list_t* entries = directory_to_entries(fs, d_ino);
-    uint32_t ino = allocate_inode(fs);
-    ext2_inode_t in;
+    uint32_t ino = allocate_inode(fs, d_ino);
+
+    if (!ino) {
+        put_inode(fs, d_in);
+        return 0;
+    }
 
     // Create the new inode
+    ext2_inode_t in;
+    bool dir = type == DENT_DIRECTORY;
+
     memset(&in, 0, sizeof(ext2_inode_t));
     in.hardlinks_count = 1;
-    list_add(entries, make_directory_entry(name, ino, type));
+    in.type_perms = dir ? INODE_DIR : INODE_FILE;
+    update_inode(fs, ino, &in);
 
-    // Write the parent directory structure to disk
-    write_directory_entries(fs, d_ino, entries);
+    if (!insert_directory_entry(fs, d_ino, name, ino, dir ? DTYPE_DIR : DTYPE_FILE)) {
+        free_inode(fs, ino);
+        put_inode(fs, d_in);
+        return 0;
+    }
 
-    // If it's a directory, write its entries to disk
-    if (type == DENT_DIRECTORY) {
-        in.type_perms = INODE_DIR;
-        update_inode(fs, ino, &in);
+    // A directory starts with its own entries
+    if (dir) {
+        insert_directory_entry(fs, ino, ".", ino, DTYPE_DIR);
+        insert_directory_entry(fs, ino, "..", d_ino, DTYPE_DIR);
+    }
 
-        list_t dot_list = LIST_HEAD_INIT(dot_list);
+    put_inode(fs, d_in);
 
-        dentry_t* dot = make_directory_entry(".", ino, DENT_DIRECTORY);
-        dentry_t* dots = make_directory_entry("..", d_ino, DENT_DIRECTORY);
+    return ino;
+}
 
-        list_add(&dot_list, dot);
-        list_add(&dot_list, dots);
+/* Adds an entry named `name` for `ino` to the directory `d_ino`, with `type`
+ * one of the `DTYPE_*` constants. It goes in the first record with enough
+ * room left after its own entry, which is split in two, or in a new block if
+ * there's none. Only the block changed is written.
+ * Returns whether the entry could be added.
+ */
+static bool insert_directory_entry(ext2_fs_t* fs, uint32_t d_ino, const char* name, uint32_t ino,
+    uint32_t type) {
+    ext2_inode_t* d_in = get_inode(fs, d_ino);
+    uint32_t name_len = strlen(name);
+    uint32_t needed = min_dir_entry_size(name_len);
+    uint32_t num_blocks = d_in->size_lower / fs->block_size;
+    uint8_t* buf = fs->buffer;
+    ext2_directory_entry_t* ent = NULL;
+    uint32_t block = 0;
 
-        write_directory_entries(fs, ino, &dot_list);
-        free_directory_entries(&dot_list);
-    } else {
-        in.type_perms = INODE_FILE;
-        update_inode(fs, ino, &in);
+    if (name_len > 255) {
+        put_inode(fs, d_in);
+        return false;
     }
 
-    // Free the list of entries, and the rest
-    free_directory_entries(entries);
-    kfree(entries);
-    kfree(d_in);
+    for (uint32_t n = 0; n < num_blocks && !ent; n++) {
+        block = get_inode_block(fs, d_in, n);
 
-    return ino;
-}
+        if (!block) {
+            continue;
+        }
 
-/* Returns a list of `dentry_t` corresponding to the entries in the directory
- * whose inode was given.
- */
-static list_t* directory_to_entries(ext2_fs_t* fs, uint32_t ino) {
-    list_t* list = kmalloc(sizeof(list_t));
-    *list = LIST_HEAD_INIT(*list);
+        read_block(fs, block, buf);
 
-    sos_directory_entry_t* ent = NULL;
-    ext2_inode_t* in = get_inode(fs, ino);
-    uint32_t offset = 0;
+        for (uint32_t offset = 0; offset < fs->block_size; ) {
+            ext2_directory_entry_t* record = (ext2_directory_entry_t*) &buf[offset];
+            uint32_t used = record->inode ? min_dir_entry_size(record->name_len_low) : 0;
 
-    if (!in) {
-        kfree(list);
-        return NULL;
-    }
+            if (record->entry_size < max(used, sizeof(ext2_directory_entry_t)) ||
+                offset + record->entry_size > fs->block_size) {
+                printke("bad entry in directory %d", d_ino);
+                break;
+            }
+
+            if (record->entry_size - used >= needed) {
+                ent = (ext2_directory_entry_t*) &buf[offset + used];
 
-    while (offset < in->size_lower) {
-        ent = ext2_readdir(fs, ino, offset);
+                if (used) {
+                    ent->entry_size = record->entry_size - used;
+                    record->entry_size = used;
+                }
 
-        if (!ent) {
-            break;
+                break;
+            }
+
+            offset += record->entry_size;
         }
+    }
 
-        dentry_t* tn = kmalloc(sizeof(dentry_t));
-        tn->name = strndup(ent->name, ent->name_len_low);
-        tn->inode = ent->inode;
+    // No room left: grow the directory by a block, a single free record
+    if (!ent) {
+        block = get_or_create_inode_block(fs, d_in, num_blocks);
 
-        list_add(list, tn);
+        if (!block) {
+            put_inode(fs, d_in);
+            return false;
+        }
+
+        memset(buf, 0, fs->block_size);
+        ent = (ext2_directory_entry_t*) buf;
+        ent->entry_size = fs->block_size;
 
-        offset += ent->entry_size;
-        kfree(ent);
+        d_in->size_lower += fs->block_size;
+        update_inode(fs, d_ino, d_in);
     }
 
-    kfree(in);
+    ent->inode = ino;
+    ent->name_len_low = name_len;
+    ent->type = type;
+    memcpy(ent->name, name, name_len);
 
-    return list;
+    write_block(fs, block, buf);
+    put_inode(fs, d_in);
+
+    return true;
 }
 
-/* With `ino` that of a directory, write to it each dentry_t in `dir_entries`.
+/* Removes the entry for `ino` from the directory `d_ino`. Its record is
+ * merged into the previous one of its block, or marked unused if it's the
+ * first. Only the block changed is written.
+ * Returns the removed entry, to be freed with `free_directory_entry`, or NULL
+ * if there was none.
  */
-static void write_directory_entries(ext2_fs_t* fs, uint32_t ino, list_t* dir_entries) {
-    ext2_inode_t* in = get_inode(fs, ino);
+static dentry_t* remove_directory_entry(ext2_fs_t* fs, uint32_t d_ino, uint32_t ino) {
+    ext2_inode_t* d_in = get_inode(fs, d_ino);
 
-    if (INODE_TYPE(in->type_perms) != INODE_DIR) {
-        return;
+    if (!d_in || INODE_TYPE(d_in->type_perms) != INODE_DIR) {
+        put_inode(fs, d_in);
+        return NULL;
     }
 
-    uint8_t* tmp = fs->buffer;
-    ext2_directory_entry_t* ent = NULL;
-    uint32_t offset = 0;
-    uint32_t iblock_no = 0;
-    dentry_t* tn;
-    list_t* iter;
-
-    list_for_each(iter, tn, dir_entries) {
-        /* Switch to the next iblock, resize the previous entry to fill the block */
-        if (offset + min_dir_entry_size(tn->name) >= fs->block_size) {
-            printk("write_directory_entries: more than one block");
-            offset -= ent->entry_size;
-            ent->entry_size = fs->block_size - offset;
-            offset = 0;
-            write_inode_block(fs, in, iblock_no++, tmp);
+    uint32_t num_blocks = d_in->size_lower / fs->block_size;
+    uint8_t* buf = fs->buffer;
+    dentry_t* removed = NULL;
+
+    for (uint32_t n = 0; n < num_blocks && !removed; n++) {
+        uint32_t block = get_inode_block(fs, d_in, n);
+        ext2_directory_entry_t* previous = NULL;
+
+        if (!block) {
+            continue;
         }
 
-        ent = (ext2_directory_entry_t*) &tmp[offset];
-        bool last = list_last_entry(dir_entries, dentry_t) == tn;
+        read_block(fs, block, buf);
 
-        ent->inode = tn->inode;
-        ent->name_len_low = strlen(tn->name);
-        ent->type = tn->type;
-        ent->entry_size = last ? fs->block_size - offset : min_dir_entry_size(tn->name);
-        strncpy(ent->name, tn->name, strlen(tn->name));
+        for (uint32_t offset = 0; offset < fs->block_size; ) {
+            ext2_directory_entry_t* record = (ext2_directory_entry_t*) &buf[offset];
 
-        offset += ent->entry_size;
-    }
+            if (record->entry_size < sizeof(ext2_directory_entry_t) ||
+                offset + record->entry_size > fs->block_size) {
+                printke("bad entry in directory %d", d_ino);
+                break;
+            }
 
-    write_inode_block(fs, in, iblock_no, tmp);
+            if (record->inode == ino) {
+                removed = kmalloc(sizeof(dentry_t));
+                removed->name = strndup(record->name, record->name_len_low);
+                removed->inode = ino;
+                removed->type = record->type;
 
-    in->size_lower = fs->block_size * iblock_no + offset;
-    update_inode(fs, ino, in);
+                if (previous) {
+                    previous->entry_size += record->entry_size;
+                } else {
+                    record->inode = 0;
+                }
 
-    kfree(in);
-}
+                write_block(fs, block, buf);
+                break;
+            }
 
-static dentry_t* make_directory_entry(const char* name, uint32_t ino, uint32_t type) {
-    dentry_t* tn = kmalloc(sizeof(dentry_t));
+            previous = record;
+            offset += record->entry_size;
+        }
+    }
 
-    tn->inode = ino;
-    tn->name = strdup(name);
-    tn->type = type == DENT_DIRECTORY ? DTYPE_DIR : DTYPE_FILE;
+    put_inode(fs, d_in);
 
-    return tn;
+    return removed;
 }
 
-/* Does not free the list itself.
+/* Points the ".." entry of the directory `ino` to `parent`, which it was just
+ * moved to.
  */
-static void free_directory_entries(list_t* entries) {
-    while (!list_empty(entries)) {
-        dentry_t* tn = list_first_entry(entries, dentry_t);
-        kfree(tn->name);
-        kfree(tn);
-        list_del(list_first(entries));
+static void set_directory_parent(ext2_fs_t* fs, uint32_t ino, uint32_t parent) {
+    ext2_inode_t* in = get_inode(fs, ino);
+    uint32_t block = in ? get_inode_block(fs, in, 0) : 0;
+
+    if (block) {
+        read_block(fs, block, fs->buffer);
+
+        // ".." comes second, after "."
+        ext2_directory_entry_t* dot = (ext2_directory_entry_t*) fs->buffer;
+        ext2_directory_entry_t* dotdot = (ext2_directory_entry_t*) (fs->buffer + dot->entry_size);
+
+        if (dot->entry_size + sizeof(ext2_directory_entry_t) + 2 <= fs->block_size &&
+            dotdot->name_len_low == 2 && !strncmp(dotdot->name, "..", 2)) {
+            dotdot->inode = parent;
+            write_block(fs, block, fs->buffer);
+        }
     }
+
+    put_inode(fs, in);
+}
+
+static void free_directory_entry(dentry_t* entry) {
+    kfree(entry->name);
+    kfree(entry);
 }
@@ -1,7 +1,11 @@
+#include <kernel/bcache.h>
+#include <kernel/dl.h>
 #include <kernel/fs.h>
 #include <kernel/proc.h>
+#include <kernel/spinlock.h>
 #include <kernel/sys.h>
 
+#include <math.h>
 #include <stdlib.h>
 #include <string.h>
 #include <list.h>
@@ -10,22 +14,194 @@
 
 #define FS(inode) ((inode_t*) inode)->fs
 
+#define DCACHE_BUCKETS 256
+#define DCACHE_MAX_ENTRIES 1024
+
 typedef struct tnode_t {
     char* name;
     inode_t* inode;
 } tnode_t;
 
-char* dirname(const char* p);
-char* basename(const char* p);
+/* A dentry cache entry: what the name `name` is in `parent`, or that there's
+ * nothing by that name there when `tnode` is NULL.
+ */
+typedef struct {
+    folder_inode_t* parent;
+    tnode_t* tnode;
+    uint32_t hash;
+    uint32_t last_use;
+    uint32_t name_len;
+    char name[];
+} dcache_entry_t;
+
 uint32_t tnode_to_directory_entry(tnode_t* tn, sos_directory_entry_t* d_ent, uint32_t size);
 void fs_build_tree_level(folder_inode_t* dir_ino, inode_t* parent);
+static int32_t fs_rename_locked(const char* oldp, const char* newp);
 
 static tnode_t* root;
 
+/* Guards the whole VFS along with the filesystems below it. Public functions
+ * calling each other is fine, the lock is recursive.
+ */
+static spinlock_t fs_lock = SPINLOCK_INIT;
+
+/* The dentry cache spares path lookups from scanning directories entry by
+ * entry. It only caches what the tree of tnodes says about built directories,
+ * so entries are dropped whenever the tree changes, see `dcache_forget`.
+ * Guarded by `fs_lock`.
+ */
+static list_t dcache[DCACHE_BUCKETS];
+static uint32_t dcache_entries = 0;
+static uint32_t dcache_clock = 0; // Orders entry uses
+
+// Bumped whenever tnodes leave a directory, see `fs_dir_cursor_t`
+static uint32_t tree_generation = 0;
+
 void init_fs(fs_t* fs) {
+    for (uint32_t i = 0; i < DCACHE_BUCKETS; i++) {
+        dcache[i] = LIST_HEAD_INIT(dcache[i]);
+    }
+
     fs_mount("/", fs);
 }
 
+/* FNV-1a over the name, mixed with the directory it's looked up in.
+ */
+static uint32_t dcache_hash(folder_inode_t* parent, const char* name, uint32_t len) {
+    uint32_t hash = 2166136261u ^ ((uintptr_t) parent >> 4);
+
+    for (uint32_t i = 0; i < len; i++) {
+        hash = (hash ^ (uint8_t) name[i]) * 16777619u;
+    }
+
+    return hash;
+}
+
+/* Returns the list node of the entry for `name` in `parent`, or NULL.
+ */
+static list_t* dcache_find(folder_inode_t* parent, const char* name, uint32_t len, uint32_t hash) {
+    list_t* bucket = &dcache[hash % DCACHE_BUCKETS];
+    list_t* iter;
+    dcache_entry_t* dentry;
+
+    list_for_each(iter, dentry, bucket) {
+        if (dentry->hash == hash && dentry->parent == parent &&
+                dentry->name_len == len && !memcmp(dentry->name, name, len)) {
+            return iter;
+        }
+    }
+
+    return NULL;
+}
+
+/* Drops the entries that weren't used by the last half of the cache's worth
+ * of lookups, which is at least half of them.
+ */
+static void dcache_evict() {
+    for (uint32_t i = 0; i < DCACHE_BUCKETS; i++) {
+        list_t* iter;
+        list_t* next;
+
+        list_for_each_safe(iter, next, &dcache[i]) {
+            dcache_entry_t* dentry = list_entry(iter, dcache_entry_t);
+
+            if (dcache_clock - dentry->last_use > DCACHE_MAX_ENTRIES/2) {
+                kfree(dentry);
+                list_del(iter);
+                dcache_entries--;
+            }
+        }
+    }
+}
+
+static void dcache_add(folder_inode_t* parent, const char* name, uint32_t len, uint32_t hash,
+        tnode_t* tnode) {
+    if (dcache_entries >= DCACHE_MAX_ENTRIES) {
+        dcache_evict();
+    }
+
+    dcache_entry_t* dentry = kmalloc(sizeof(dcache_entry_t) + len);
+
+    dentry->parent = parent;
+    dentry->tnode = tnode;
+    dentry->hash = hash;
+    dentry->last_use = ++dcache_clock;
+    dentry->name_len = len;
+    memcpy(dentry->name, name, len);
+
+    list_add_front(&dcache[hash % DCACHE_BUCKETS], dentry);
+    dcache_entries++;
+}
+
+/* Drops what the cache knows about `name` in `parent`. To be called whenever
+ * that name appears, disappears or changes in the tree.
+ */
+static void dcache_forget(folder_inode_t* parent, const char* name, uint32_t len) {
+    list_t* iter = dcache_find(parent, name, len, dcache_hash(parent, name, len));
+
+    if (iter) {
+        kfree(list_entry(iter, dcache_entry_t));
+        list_del(iter);
+        dcache_entries--;
+    }
+}
+
+/* Drops every entry of the directory `parent`, for when its tnodes go away.
+ */
+static void dcache_forget_dir(folder_inode_t* parent) {
+    for (uint32_t i = 0; i < DCACHE_BUCKETS; i++) {
+        list_t* iter;
+        list_t* next;
+
+        list_for_each_safe(iter, next, &dcache[i]) {
+            dcache_entry_t* dentry = list_entry(iter, dcache_entry_t);
+
+            if (dentry->parent == parent) {
+                kfree(dentry);
+                list_del(iter);
+                dcache_entries--;
+            }
+        }
+    }
+}
+
+static tnode_t* fs_scan_dir(list_t* entries, const char* name, uint32_t len) {
+    tnode_t* ent;
+
+    list_for_each_entry(ent, entries) {
+        if (!strncmp(ent->name, name, len) && ent->name[len] == '\0') {
+            return ent;
+        }
+    }
+
+    return NULL;
+}
+
+/* Returns the tnode named by the `len` first characters of `name` in the built
+ * directory `dir`, or NULL, looking it up in the dentry cache first.
+ */
+static tnode_t* fs_lookup(folder_inode_t* dir, const char* name, uint32_t len) {
+    uint32_t hash = dcache_hash(dir, name, len);
+    list_t* iter = dcache_find(dir, name, len, hash);
+
+    if (iter) {
+        dcache_entry_t* dentry = list_entry(iter, dcache_entry_t);
+        dentry->last_use = ++dcache_clock;
+
+        return dentry->tnode;
+    }
+
+    tnode_t* tnode = fs_scan_dir(&dir->subfolders, name, len);
+
+    if (!tnode) {
+        tnode = fs_scan_dir(&dir->subfiles, name, len);
+    }
+
+    dcache_add(dir, name, len, hash, tnode);
+
+    return tnode;
+}
+
 void delete_tnode(tnode_t* tn) {
     inode_t* in = tn->inode;
 
@@ -70,10 +246,11 @@ void fs_build_tree_level(folder_inode_t* inode, inode_t* parent) {
     list_add(&inode->subfolders, tn);
 
     /* Add the rest of the entries */
-    while ((dent = FS(inode)->readdir(FS(inode), inode->ino.inode_no, offset)) != NULL && dent->type != DENT_INVALID) {
+    while ((dent = FS(inode)->readdir(FS(inode), inode->ino.inode_no, offset)) != NULL) {
         offset += dent->entry_size;
 
-        if (strncmp(dent->name, ".", dent->name_len_low) && strncmp(dent->name, "..", dent->name_len_low)) {
+        // Unused entries, like those of deleted files, have no inode
+        if (dent->inode && strncmp(dent->name, ".", dent->name_len_low) && strncmp(dent->name, "..", dent->name_len_low)) {
             tn = kmalloc(sizeof(tnode_t));
             tn->name = strndup(dent->name, dent->name_len_low);
             tn->inode = FS(inode)->get_fs_inode(FS(inode), dent->inode);
@@ -86,82 +263,169 @@ void fs_build_tree_level(folder_inode_t* inode, inode_t* parent) {
     inode->dirty = false;
 }
 
-/* Returns an inode_t* from a path.
- * `flags` can be one of:
- *  - O_CREAT: create the last component of `path`
- *  - O_CREATD: same, but as a directory
- * TODO: prevent creating duplicate entries.
+/* Follows the `len` first characters of `path` from `tnode`, component by
+ * component. Empty and "." components are skipped, ".." is looked up like any
+ * other name. Directories are built as they're reached. Returns NULL if some
+ * component doesn't exist.
  */
-inode_t* fs_open(const char* path, uint32_t flags) {
-    char* npath = fs_normalize_path(path);
-
-    if (!strcmp(npath, "/")) {
-        kfree(npath);
-        return root->inode;
-    }
-
-    tnode_t* tnode = root;
-    tnode_t* prev_tnode = NULL;
-    char* part = npath;
-    uint32_t part_len = 0;
-    bool last_part = false;
-
-    while (!last_part && tnode != prev_tnode) {
-        folder_inode_t* inode = (folder_inode_t*) tnode->inode;
-        prev_tnode = tnode;
-        part += part_len + 1; // Skip the separator
-        part_len = strchrnul(part, '/') - part;
-        last_part = part[part_len] == '\0';
-
-        // File creation requested: now's the time
-        if (last_part && (flags & O_CREAT || flags & O_CREATD)) {
-            uint32_t new_ino = FS(inode)->create(FS(inode), part,
-                flags & O_CREAT ? DENT_FILE : DENT_DIRECTORY,
-                inode->ino.inode_no);
-
-            tnode_t* new_tn = kmalloc(sizeof(tnode_t));
-            new_tn->inode = FS(inode)->get_fs_inode(FS(inode), new_ino);
-            new_tn->name = strdup(part);
-            list_add(flags & O_CREAT ? &inode->subfiles : &inode->subfolders, new_tn);
-        }
+static tnode_t* fs_walk(tnode_t* tnode, const char* path, uint32_t len) {
+    const char* end = path + len;
+
+    while (path < end) {
+        const char* part = path;
 
-        // Build the tree as needed
-        if (inode->dirty) {
-            fs_build_tree_level(inode, prev_tnode->inode);
+        while (path < end && *path != '/') {
+            path++;
         }
 
-        // Search the tree, starting with subfolders
-        tnode_t* ent;
-        list_for_each_entry(ent, &inode->subfolders) {
-            if (strlen(ent->name) == part_len &&
-                    !strncmp(ent->name, part, part_len)) {
-                tnode = ent;
+        uint32_t part_len = path - part;
+        path++; // Skip the separator
 
-                if (((folder_inode_t*) tnode->inode)->dirty) {
-                    fs_build_tree_level((folder_inode_t*) tnode->inode, prev_tnode->inode);
-                }
+        if (!part_len || (part_len == 1 && part[0] == '.')) {
+            continue;
+        }
 
-                break;
-            }
+        // Files have no children
+        folder_inode_t* dir = (folder_inode_t*) tnode->inode;
+
+        if (dir->ino.type != DENT_DIRECTORY) {
+            return NULL;
         }
 
-        if (tnode != prev_tnode) {
-            continue;
+        tnode = fs_lookup(dir, part, part_len);
+
+        if (!tnode) {
+            return NULL;
         }
 
-        // Not a subfolder: check the subfiles
-        list_for_each_entry(ent, &inode->subfiles) {
-            if (strlen(ent->name) == part_len &&
-                    !strncmp(ent->name, part, part_len)) {
-                tnode = ent;
-                break;
-            }
+        if (tnode->inode->type == DENT_DIRECTORY && ((folder_inode_t*) tnode->inode)->dirty) {
+            fs_build_tree_level((folder_inode_t*) tnode->inode, (inode_t*) dir);
         }
     }
 
-    kfree(npath);
+    return tnode;
+}
+
+/* Returns where resolving `path` starts: at the root if it's absolute, in the
+ * current directory otherwise.
+ */
+static tnode_t* fs_walk_start(const char* path) {
+    folder_inode_t* root_dir = (folder_inode_t*) root->inode;
+
+    if (root_dir->dirty) {
+        fs_build_tree_level(root_dir, root->inode);
+    }
+
+    if (path[0] == '/') {
+        return root;
+    }
+
+    const char* cwd = proc_get_cwd();
+
+    return fs_walk(root, cwd, strlen(cwd));
+}
+
+/* Returns the tnode `path` leads to, or NULL.
+ */
+static tnode_t* fs_resolve(const char* path) {
+    tnode_t* start = fs_walk_start(path);
+
+    return start ? fs_walk(start, path, strlen(path)) : NULL;
+}
+
+/* Returns the directory containing the last component of `path`, and points
+ * `name` to that component, `name_len` characters long. Returns NULL if that
+ * directory doesn't exist, or if the last component is "." or "..".
+ */
+static tnode_t* fs_resolve_parent(const char* path, const char** name, uint32_t* name_len) {
+    uint32_t end = strlen(path);
+
+    while (end && path[end - 1] == '/') {
+        end--;
+    }
+
+    uint32_t start = end;
+
+    while (start && path[start - 1] != '/') {
+        start--;
+    }
+
+    *name = path + start;
+    *name_len = end - start;
+
+    if (!*name_len || (*name[0] == '.' && (*name_len == 1 ||
+            (*name_len == 2 && (*name)[1] == '.')))) {
+        return NULL;
+    }
+
+    tnode_t* parent = fs_walk_start(path);
+
+    if (parent) {
+        parent = fs_walk(parent, path, start);
+    }
+
+    return parent && parent->inode->type == DENT_DIRECTORY ? parent : NULL;
+}
+
+/* Creates the entry `name`, `len` characters long, in the directory `parent`,
+ * as a directory if `flags` has `O_CREATD`. Returns the existing entry if there
+ * is one.
+ */
+static tnode_t* fs_create(tnode_t* parent, const char* name, uint32_t len, uint32_t flags) {
+    folder_inode_t* dir = (folder_inode_t*) parent->inode;
+    tnode_t* tnode = fs_lookup(dir, name, len);
+
+    if (tnode) {
+        return tnode;
+    }
+
+    char* new_name = strndup(name, len);
+    uint32_t new_ino = FS(dir)->create(FS(dir), new_name,
+        flags & O_CREAT ? DENT_FILE : DENT_DIRECTORY, dir->ino.inode_no);
+
+    if (!new_ino) {
+        kfree(new_name);
+        return NULL;
+    }
 
-    return tnode != prev_tnode ? tnode->inode : NULL;
+    tnode = kmalloc(sizeof(tnode_t));
+    tnode->inode = FS(dir)->get_fs_inode(FS(dir), new_ino);
+    tnode->name = new_name;
+    list_add(flags & O_CREAT ? &dir->subfiles : &dir->subfolders, tnode);
+    dcache_forget(dir, name, len);
+
+    if (tnode->inode->type == DENT_DIRECTORY) {
+        fs_build_tree_level((folder_inode_t*) tnode->inode, (inode_t*) dir);
+    }
+
+    return tnode;
+}
+
+/* Returns an inode_t* from a path, absolute or relative to the current
+ * directory. Resolution happens in place in the tree of tnodes: no copy of
+ * the path is made.
+ * `flags` can be one of:
+ *  - O_CREAT: create the last component of `path`, unless it exists
+ *  - O_CREATD: same, but as a directory
+ */
+inode_t* fs_open(const char* path, uint32_t flags) {
+    spinlock_acquire(&fs_lock);
+
+    tnode_t* tnode;
+
+    if (flags & O_CREAT || flags & O_CREATD) {
+        const char* name;
+        uint32_t len;
+        tnode_t* parent = fs_resolve_parent(path, &name, &len);
+
+        tnode = parent ? fs_create(parent, name, len, flags) : NULL;
+    } else {
+        tnode = fs_resolve(path);
+    }
+
+    spinlock_release(&fs_lock);
+
+    return tnode ? tnode->inode : NULL;
 }
 
 /* Mounts a filesystem at the given path in the existing VFS.
@@ -176,11 +440,14 @@ void fs_mount(const char* mount_point, fs_t* fs) {
         return;
     }
 
+    spinlock_acquire(&fs_lock);
+
     /* Check the mount point's validity */
     folder_inode_t* mnt_in = (folder_inode_t*) fs_open(mount_point, O_RDONLY);
 
     if (mnt_in->ino.type != DENT_DIRECTORY) {
         printke("mount: mountpoint not a directory");
+        spinlock_release(&fs_lock);
         return;
     }
 
@@ -192,10 +459,14 @@ void fs_mount(const char* mount_point, fs_t* fs) {
 
     if (num_children > 2 || !list_empty(&mnt_in->subfiles)) {
         printke("mount: mountpoint not empty");
+        spinlock_release(&fs_lock);
         return;
     }
 
     /* Empty its "." and ".." entries */
+    dcache_forget_dir(mnt_in);
+    tree_generation++;
+
     while (!list_empty(&mnt_in->subfolders)) {
         tnode_t* tn = list_first_entry(&mnt_in->subfolders, tnode_t);
         kfree(tn->name);
@@ -208,29 +479,37 @@ void fs_mount(const char* mount_point, fs_t* fs) {
     mnt_in->dirty = true;
     mnt_in->subfiles = LIST_HEAD_INIT(mnt_in->subfiles);
     mnt_in->subfolders = LIST_HEAD_INIT(mnt_in->subfolders);
+
+    spinlock_release(&fs_lock);
 }
 
 uint32_t fs_mkdir(const char* path, uint32_t mode) {
     UNUSED(mode);
 
+    spinlock_acquire(&fs_lock);
+
     // Fail if the path exists already
-    if (fs_open(path, O_RDONLY)) {
-        return FS_INVALID_INODE;
-    }
+    inode_t* in = fs_open(path, O_RDONLY) ? NULL : fs_open(path, O_CREATD);
+    uint32_t ino = in ? in->inode_no : FS_INVALID_INODE;
 
-    inode_t* in = fs_open(path, O_CREATD);
+    spinlock_release(&fs_lock);
 
-    return in ? in->inode_no : FS_INVALID_INODE;
+    return ino;
 }
 
 int32_t fs_unlink(const char* path) {
-    /* Check that we're unlinking a file */
-    char* npath = fs_normalize_path(path);
-    folder_inode_t* d_in = (folder_inode_t*) fs_open(dirname(npath), O_RDONLY);
-    inode_t* in = fs_open(npath, O_RDONLY);
-    kfree(npath);
+    spinlock_acquire(&fs_lock);
 
-    if (!d_in || !in || in->type != DENT_FILE) {
+    /* Check that we're unlinking a file */
+    const char* name;
+    uint32_t len;
+    tnode_t* parent = fs_resolve_parent(path, &name, &len);
+    folder_inode_t* d_in = parent ? (folder_inode_t*) parent->inode : NULL;
+    tnode_t* tn = d_in ? fs_lookup(d_in, name, len) : NULL;
+    inode_t* in = tn ? tn->inode : NULL;
+
+    if (!in || in->type != DENT_FILE) {
+        spinlock_release(&fs_lock);
         return -1;
     }
 
@@ -238,26 +517,35 @@ int32_t fs_unlink(const char* path) {
     int32_t ret = FS(d_in)->unlink(FS(d_in), d_in->ino.inode_no, in->inode_no);
 
     if (ret == -1) {
+        spinlock_release(&fs_lock);
         return -1;
     }
 
+    /* Forget its cached pages while the inode is still around */
+    dl_invalidate(in);
+
     /* Prune it from the tree */
     list_t* iter;
-    tnode_t* tn;
-    list_for_each(iter, tn, &d_in->subfiles) {
-        if (tn->inode->inode_no == in->inode_no) {
-            kfree(tn->name);
-            kfree(tn);
-
-            if (--in->hardlinks == 0) {
-                kfree(in);
-            }
-
+    tnode_t* ent;
+    list_for_each(iter, ent, &d_in->subfiles) {
+        if (ent == tn) {
             list_del(iter);
             break;
         }
     }
 
+    tree_generation++;
+
+    dcache_forget(d_in, name, len);
+    kfree(tn->name);
+    kfree(tn);
+
+    if (--in->hardlinks == 0) {
+        kfree(in);
+    }
+
+    spinlock_release(&fs_lock);
+
     return 0;
 }
 
@@ -266,8 +554,31 @@ int32_t fs_unlink(const char* path) {
  * Note: doesn't support renaming a directory to an existing empty directory.
  */
 int32_t fs_rename(const char* oldp, const char* newp) {
-    inode_t* old = fs_open(oldp, O_RDONLY);
-    inode_t* new  = fs_open(newp, O_RDONLY);
+    spinlock_acquire(&fs_lock);
+    int32_t ret = fs_rename_locked(oldp, newp);
+    spinlock_release(&fs_lock);
+
+    return ret;
+}
+
+static int32_t fs_rename_locked(const char* oldp, const char* newp) {
+    const char* old_name;
+    const char* new_name;
+    uint32_t old_len;
+    uint32_t new_len;
+    tnode_t* src_tn = fs_resolve_parent(oldp, &old_name, &old_len);
+    tnode_t* dst_tn = fs_resolve_parent(newp, &new_name, &new_len);
+
+    if (!src_tn || !dst_tn) {
+        return -1;
+    }
+
+    folder_inode_t* src = (folder_inode_t*) src_tn->inode;
+    folder_inode_t* dst = (folder_inode_t*) dst_tn->inode;
+    tnode_t* tn = fs_lookup(src, old_name, old_len);
+    tnode_t* new_tn = fs_lookup(dst, new_name, new_len);
+    inode_t* old = tn ? tn->inode : NULL;
+    inode_t* new = new_tn ? new_tn->inode : NULL;
 
     if (!old) {
         return -1;
@@ -283,7 +594,7 @@ int32_t fs_rename(const char* oldp, const char* newp) {
     }
 
     /* Moving across filesystems is unsupported right now */
-    if (new && new->fs != old->fs) {
+    if (FS(dst) != old->fs) {
         return -1;
     }
 
@@ -294,17 +605,16 @@ int32_t fs_rename(const char* oldp, const char* newp) {
         }
     }
 
-    /* Do the renaming on the fs */
-    char* noldp = fs_normalize_path(oldp);
-    char* nnewp = fs_normalize_path(newp);
-    folder_inode_t* src = (folder_inode_t*) fs_open(dirname(noldp), O_RDONLY);
-    folder_inode_t* dst = (folder_inode_t*) fs_open(dirname(nnewp), O_RDONLY);
+    /* Cached images found libraries by path */
+    dl_invalidate(old);
 
-    int32_t ret = FS(old)->rename(FS(old), src->ino.inode_no, old->inode_no, dst->ino.inode_no);
+    /* Do the renaming on the fs */
+    char* name = strndup(new_name, new_len);
+    int32_t ret = FS(old)->rename(FS(old), src->ino.inode_no, old->inode_no, dst->ino.inode_no,
+        name);
 
     if (ret == -1) {
-        kfree(noldp);
-        kfree(nnewp);
+        kfree(name);
         return -1;
     }
 
@@ -312,45 +622,73 @@ int32_t fs_rename(const char* oldp, const char* newp) {
     list_t* to_iterate = old->type == DENT_DIRECTORY ?
         &src->subfolders : &src->subfiles;
     list_t* iter;
-    tnode_t* tn;
-    list_for_each(iter, tn, to_iterate) {
-        if (tn->inode->inode_no == old->inode_no) {
+    tnode_t* ent;
+    list_for_each(iter, ent, to_iterate) {
+        if (ent == tn) {
             list_del(iter);
             break;
         }
     }
 
+    tree_generation++;
+
     /* Add to the destination parent directory */
+    dcache_forget(src, old_name, old_len);
+    dcache_forget(dst, new_name, new_len);
     kfree(tn->name);
-    tn->name = strdup(basename(nnewp));
+    tn->name = name;
     list_t* to_add_to = old->type == DENT_DIRECTORY ?
         &dst->subfolders : &dst->subfiles;
     list_add(to_add_to, tn);
 
-    kfree(noldp);
-    kfree(nnewp);
+    /* A moved directory has a new parent */
+    if (old->type == DENT_DIRECTORY && !((folder_inode_t*) old)->dirty) {
+        tnode_t* dotdot = fs_lookup((folder_inode_t*) old, "..", 2);
+
+        if (dotdot) {
+            dotdot->inode = (inode_t*) dst;
+        }
+    }
 
     return 0;
 }
 
 int32_t fs_stat(const char* path, stat_t* buf) {
+    spinlock_acquire(&fs_lock);
+
     inode_t* in = fs_open(path, O_RDONLY);
+    int32_t ret = in ? FS(in)->stat(FS(in), in->inode_no, buf) : -1;
 
-    if (!in) {
-        return -1;
-    }
+    spinlock_release(&fs_lock);
+
+    return ret;
+}
 
-    return FS(in)->stat(FS(in), in->inode_no, buf);
+/* Writes the blocks changed in the buffer cache back to their devices. Done
+ * under the fs lock so that no operation is halfway through its changes.
+ */
+void fs_sync() {
+    spinlock_acquire(&fs_lock);
+    bcache_sync();
+    spinlock_release(&fs_lock);
 }
 
 /* A process has released its grip on a file: notify the fs.
  */
 int32_t fs_close(inode_t* in) {
-    return FS(in)->close(FS(in), in->inode_no);
+    spinlock_acquire(&fs_lock);
+    int32_t ret = FS(in)->close(FS(in), in->inode_no);
+    spinlock_release(&fs_lock);
+
+    return ret;
 }
 
 uint32_t fs_read(inode_t* in, uint32_t offset, uint8_t* buf, uint32_t size) {
-    return FS(in)->read(FS(in), in->inode_no, offset, buf, size);
+    spinlock_acquire(&fs_lock);
+    uint32_t read = FS(in)->read(FS(in), in->inode_no, offset, buf, size);
+    spinlock_release(&fs_lock);
+
+    return read;
 }
 
 uint32_t fs_write(inode_t* in, uint8_t* buf, uint32_t size) {
@@ -358,129 +696,227 @@ uint32_t fs_write(inode_t* in, uint8_t* buf, uint32_t size) {
         return 0;
     }
 
+    spinlock_acquire(&fs_lock);
+
     uint32_t written = FS(in)->append(FS(in), in->inode_no, buf, size);
     in->size += written;
 
+    if (written) {
+        dl_invalidate(in);
+    }
+
+    spinlock_release(&fs_lock);
+
     return written;
 }
 
-uint32_t fs_readdir(inode_t* in, uint32_t index, sos_directory_entry_t* d_ent, uint32_t size) {
-    if (in->type != DENT_DIRECTORY) {
-        printke("not a directory");
+/* Writes `size` bytes from `buf` at `offset` in `in`, growing it if needed.
+ * Filesystems that can only append, like pipes, append instead.
+ */
+uint32_t fs_pwrite(inode_t* in, uint32_t offset, uint8_t* buf, uint32_t size) {
+    if (!in) {
         return 0;
     }
 
-    folder_inode_t* fin = (folder_inode_t*) in;
-
-    if (fin->dirty) {
-        printke("dirty inode being readdir'ed");
-        return 0;
+    if (!FS(in)->write) {
+        return fs_write(in, buf, size);
     }
 
-    uint32_t i = 0;
-    tnode_t* tn;
-    list_for_each_entry(tn, &fin->subfolders) {
-        if (i++ == index) {
-            return tnode_to_directory_entry(tn, d_ent, size);
-        }
-    }
+    spinlock_acquire(&fs_lock);
 
-    list_for_each_entry(tn, &fin->subfiles) {
-        if (i++ == index) {
-            return tnode_to_directory_entry(tn, d_ent, size);
-        }
+    uint32_t written = FS(in)->write(FS(in), in->inode_no, offset, buf, size);
+
+    if (written) {
+        in->size = max(in->size, offset + written);
+        dl_invalidate(in);
     }
 
-    return 0;
+    spinlock_release(&fs_lock);
+
+    return written;
 }
 
-/* Returns the absolute version of `p`, free of oddities,
- * dynamically allocated.
- * TODO: make it use static memory.
+/* Returns the node following `node` in the built directory `dir`, subfolders
+ * coming before subfiles, or NULL at the end. `&dir->subfolders` comes before
+ * the first entry.
  */
-char* fs_normalize_path(const char* p) {
-    char* np = kmalloc(MAX_PATH);
-    strcpy(np, p);
+static list_t* fs_dir_next(folder_inode_t* dir, list_t* node) {
+    node = node->next;
 
-    if (!strcmp(np, "/")) {
-        return np;
+    if (node == &dir->subfolders) {
+        node = dir->subfiles.next;
     }
 
-    if (!strcmp(np, ".")) {
-        return proc_get_cwd();
+    return node == &dir->subfiles ? NULL : node;
+}
+
+/* Returns the node of the entry following `cursor` in `dir`, without moving
+ * the cursor, or NULL at the end. The cursor's node may have left the tree
+ * since it last moved, in which case it's found again by walking `dir` from
+ * the start.
+ */
+static list_t* fs_cursor_peek(folder_inode_t* dir, fs_dir_cursor_t* cursor) {
+    if (!cursor->node || cursor->generation != tree_generation) {
+        list_t* node = &dir->subfolders;
+
+        for (uint32_t i = 0; i < cursor->index && node; i++) {
+            node = fs_dir_next(dir, node);
+        }
+
+        if (!node) {
+            return NULL;
+        }
+
+        cursor->node = node;
+        cursor->generation = tree_generation;
     }
 
-    // Make the path absolute
-    if (p[0] != '/') {
-        char* cwd = proc_get_cwd();
-        strcpy(np, cwd);
-        strcat(np, "/");
-        strcat(np, p);
-        kfree(cwd);
+    return fs_dir_next(dir, cursor->node);
+}
+
+static void fs_cursor_advance(fs_dir_cursor_t* cursor, list_t* node) {
+    cursor->node = node;
+    cursor->index++;
+}
+
+/* Returns the directory `in` if it can be listed, NULL otherwise.
+ */
+static folder_inode_t* fs_listable(inode_t* in) {
+    if (in->type != DENT_DIRECTORY) {
+        printke("not a directory");
+        return NULL;
     }
 
-    // Trim trailing slashes
-    while (np[strlen(np) - 1] == '/') {
-        np[strlen(np) - 1] = '\0';
+    if (((folder_inode_t*) in)->dirty) {
+        printke("dirty inode being readdir'ed");
+        return NULL;
     }
 
-    // Trim '//' sequences
-    char* s = NULL;
-    while ((s = strstr(np, "//"))) {
-        uint32_t n = 0;
+    return (folder_inode_t*) in;
+}
 
-        // Make sure to keep exaclty one /
-        if (strstr(np, "///") != s) {
-            n = 1;
-        } else {
-            n = 2;
-        }
+/* Writes the entry of `in` at `cursor` to `d_ent` and moves the cursor past it.
+ * Returns the size of the entry, or 0 at the end or if `size` is too small.
+ */
+uint32_t fs_readdir(inode_t* in, fs_dir_cursor_t* cursor, sos_directory_entry_t* d_ent, uint32_t size) {
+    spinlock_acquire(&fs_lock);
+
+    folder_inode_t* fin = fs_listable(in);
+    list_t* node = fin ? fs_cursor_peek(fin, cursor) : NULL;
+    uint32_t ret = node ? tnode_to_directory_entry(list_entry(node, tnode_t), d_ent, size) : 0;
 
-        char* npp = kmalloc(MAX_PATH);
-        strncpy(npp, np, s - np);
-        npp[s - np] = '\0';
-        strcat(npp, s + n);
-        kfree(np);
-        np = npp;
+    if (ret) {
+        fs_cursor_advance(cursor, node);
     }
 
-    return np;
+    spinlock_release(&fs_lock);
+
+    return ret;
 }
 
-/* Returns the path to the parent directory of the thing pointed to by `p`,
- * statically allocated.
- * Expects `p` to be a normalized path.
- * TODO: repurpose those functions in libc.
+/* Fills `buf`, `size` bytes long, with as many entries of the directory `in`
+ * as fit, starting at `cursor` and moving it past them. Entries include their
+ * size, mode and link count with `GETDENTS_STAT`, sparing a `stat` of each.
+ * Returns the number of bytes written, 0 at the end of the directory.
  */
-char* dirname(const char* p) {
-    static char dp[MAX_PATH] = "";
-    char* last_sep = strrchr(p, '/');
+uint32_t fs_getdents(inode_t* in, fs_dir_cursor_t* cursor, sos_dirent_t* buf, uint32_t size,
+        uint32_t flags) {
+    spinlock_acquire(&fs_lock);
 
-    strcpy(dp, p);
+    folder_inode_t* fin = fs_listable(in);
+    uint32_t written = 0;
+    list_t* node;
 
-    if (!strcmp(dp, "/")) {
-        return dp;
-    }
+    while (fin && (node = fs_cursor_peek(fin, cursor))) {
+        tnode_t* tn = list_entry(node, tnode_t);
+        uint32_t len = strlen(tn->name);
+        uint32_t esize = align_to(sizeof(sos_dirent_t) + len + 1, 4);
 
-    if (last_sep == p) {
-        dp[1] = '\0';
-    } else {
-        dp[last_sep - p] = '\0';
+        if (written + esize > size) {
+            break;
+        }
+
+        sos_dirent_t* ent = (sos_dirent_t*) ((uintptr_t) buf + written);
+        stat_t st = { 0 };
+
+        if (flags & GETDENTS_STAT) {
+            FS(tn->inode)->stat(FS(tn->inode), tn->inode->inode_no, &st);
+        }
+
+        ent->inode = tn->inode->inode_no;
+        ent->size = st.st_size;
+        ent->mode = st.st_mode;
+        ent->nlink = st.st_nlink;
+        ent->entry_size = esize;
+        ent->type = tn->inode->type;
+        ent->name_len = len;
+        memcpy(ent->name, tn->name, len + 1);
+
+        written += esize;
+        fs_cursor_advance(cursor, node);
     }
 
-    return dp;
+    spinlock_release(&fs_lock);
+
+    return written;
 }
 
-/* Returns the name of the file pointed to by `p`.
+/* Writes the absolute version of `p` to `np`, a buffer of `MAX_PATH` bytes,
+ * without ".", ".." or repeated and trailing slashes, in a single pass.
+ * Relative paths start from the current directory. Returns false if the result
+ * doesn't fit.
  */
-char* basename(const char* p) {
-    char* last_sep = strrchr(p, '/');
+bool fs_normalize_path(const char* p, char* np) {
+    uint32_t len = 0;
+
+    // The current directory is normalized already, "/" aside
+    if (p[0] != '/') {
+        const char* cwd = proc_get_cwd();
+        len = strlen(cwd);
 
-    if (!strcmp(p, "/")) {
-        return (char*) p;
+        if (len >= MAX_PATH) {
+            return false;
+        }
+
+        memcpy(np, cwd, len);
+        len = len == 1 ? 0 : len;
     }
 
-    return last_sep + 1;
+    while (*p) {
+        const char* part = p;
+        p = strchrnul(p, '/');
+        uint32_t part_len = p - part;
+
+        if (*p) {
+            p++;
+        }
+
+        if (!part_len || (part_len == 1 && part[0] == '.')) {
+            continue;
+        }
+
+        // Go back to the previous separator
+        if (part_len == 2 && part[0] == '.' && part[1] == '.') {
+            while (len && np[--len] != '/');
+            continue;
+        }
+
+        if (len + 1 + part_len >= MAX_PATH) {
+            return false;
+        }
+
+        np[len++] = '/';
+        memcpy(np + len, part, part_len);
+        len += part_len;
+    }
+
+    if (!len) {
+        np[len++] = '/';
+    }
+
+    np[len] = '\0';
+
+    return true;
 }
 
 /* Writes the given `tnode_t` to `d_ent` with proper form, returns the entry size.
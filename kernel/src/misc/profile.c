@@ -0,0 +1,266 @@
+#include <kernel/profile.h>
+#include <kernel/fs.h>
+#include <kernel/paging.h>
+#include <kernel/proc.h>
+#include <kernel/serial.h>
+#include <kernel/spinlock.h>
+#include <kernel/stacktrace.h>
+#include <kernel/sys.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define KERNEL 0 // Index of the kernel in `names`
+#define UNKNOWN 1 // Frames outside of the kernel and of any object
+#define PROFILE_LINE_SIZE 1024
+
+/* Where a CPU was at a scheduler tick. Frames are listed from the interrupted
+ * one outwards; user ones are relative to the base of their object.
+ */
+typedef struct {
+    uint8_t process; // Index of the process's name in `names`
+    uint8_t depth;
+    uint8_t objects[PROFILE_MAX_DEPTH]; // Index of each frame's object in `names`
+    uintptr_t pcs[PROFILE_MAX_DEPTH];
+} profile_sample_t;
+
+static profile_sample_t* samples;
+static volatile uint32_t num_samples; // Keeps counting once the buffer is full
+static volatile bool sampling;
+static bool walk_stacks;
+
+// Names are copied, processes and objects may be gone by the time we dump
+static char names[PROFILE_MAX_NAMES][SYS_PROC_NAME_LEN];
+static uint32_t num_names;
+static spinlock_t names_lock = SPINLOCK_INIT;
+
+/* Clears the sample buffer and starts sampling on every scheduler tick. With
+ * `stacks`, samples also walk the frame pointers of the interrupted code.
+ */
+void profile_start(bool stacks) {
+    sampling = false;
+
+    if (!samples) {
+        samples = kmalloc(PROFILE_NUM_SAMPLES*sizeof(profile_sample_t));
+    }
+
+    spinlock_acquire(&names_lock);
+    strcpy(names[KERNEL], "kernel");
+    strcpy(names[UNKNOWN], "unknown");
+    num_names = 2;
+    spinlock_release(&names_lock);
+
+    num_samples = 0;
+    walk_stacks = stacks;
+    sampling = true;
+}
+
+void profile_stop() {
+    sampling = false;
+}
+
+/* Returns the index of `name` in `names`, adding it if needed.
+ */
+static uint8_t profile_name(const char* name) {
+    uint8_t index = UNKNOWN;
+
+    spinlock_acquire(&names_lock);
+
+    for (uint32_t i = 0; i < num_names; i++) {
+        if (!strncmp(names[i], name, SYS_PROC_NAME_LEN - 1)) {
+            spinlock_release(&names_lock);
+            return i;
+        }
+    }
+
+    if (num_names < PROFILE_MAX_NAMES) {
+        index = num_names++;
+        strncpy(names[index], name, SYS_PROC_NAME_LEN - 1);
+        names[index][SYS_PROC_NAME_LEN - 1] = '\0';
+    }
+
+    spinlock_release(&names_lock);
+
+    return index;
+}
+
+/* Returns whether the word at `addr` can be read without faulting. User
+ * addresses are those of `process`, which we're running in.
+ */
+static bool profile_readable(process_t* process, uintptr_t addr) {
+    if (!addr || addr % 4 || (addr < KERNEL_BASE_VIRT && !process->pid)) {
+        return false;
+    }
+
+    page_t* page = paging_get_page(addr & PAGE_FRAME, false, 0);
+
+    return page && (*page & PAGE_PRESENT) &&
+        (addr >= KERNEL_BASE_VIRT || (*page & PAGE_USER));
+}
+
+/* Adds `pc` to the frames of `sample`, finding the object it's in.
+ */
+static void profile_add_frame(profile_sample_t* sample, process_t* process, uintptr_t pc) {
+    uint32_t i = sample->depth++;
+    proc_region_t* region;
+
+    sample->objects[i] = pc >= KERNEL_BASE_VIRT ? KERNEL : UNKNOWN;
+    sample->pcs[i] = pc;
+
+    if (pc >= KERNEL_BASE_VIRT || !process->pid) {
+        return;
+    }
+
+    list_for_each_entry(region, &process->leader->regions) {
+        if (pc >= region->start && pc < region->end) {
+            sample->objects[i] = profile_name(region->name);
+            sample->pcs[i] = pc - region->base;
+            return;
+        }
+    }
+}
+
+/* Records where the code interrupted by a scheduler tick was, `regs` being
+ * its state. Runs with interrupts disabled, possibly on several CPUs at once.
+ */
+void profile_sample(registers_t* regs) {
+    if (!sampling) {
+        return;
+    }
+
+    uint32_t index = __atomic_fetch_add(&num_samples, 1, __ATOMIC_RELAXED);
+
+    if (index >= PROFILE_NUM_SAMPLES) {
+        return;
+    }
+
+    process_t* process = proc_get_current();
+    profile_sample_t* sample = &samples[index];
+    uintptr_t ebp = regs->ebp;
+
+    sample->process = profile_name(process->name);
+    sample->depth = 0;
+    profile_add_frame(sample, process, regs->eip);
+
+    // Frames of the kernel stack lead to the user stack after system calls
+    // and interrupts, so the walk goes on there
+    while (walk_stacks && sample->depth < PROFILE_MAX_DEPTH &&
+            profile_readable(process, ebp) && profile_readable(process, ebp + 4)) {
+        uintptr_t* frame = (uintptr_t*) ebp;
+        uintptr_t next = frame[0];
+
+        // Return addresses may be past the end of the calling function
+        profile_add_frame(sample, process, frame[1] - 1);
+
+        // Callers' frames are higher up, except across the kernel boundary
+        if (next <= ebp && !(ebp >= KERNEL_BASE_VIRT && next < KERNEL_BASE_VIRT)) {
+            break;
+        }
+
+        ebp = next;
+    }
+}
+
+/* Reads the symbol map of the object `name` into `table`. Returns false if
+ * there is none.
+ */
+static bool profile_load_map(const char* name, symbol_table_t* table) {
+    char path[MAX_PATH];
+
+    snprintf(path, MAX_PATH, "%s%s.map", PROFILE_SYMBOLS_DIR, name);
+
+    inode_t* in = fs_open(path, O_RDONLY);
+
+    if (!in) {
+        return false;
+    }
+
+    char* map = kmalloc(in->size + 1);
+    uint32_t size = fs_read(in, 0, (uint8_t*) map, in->size);
+
+    fs_close(in);
+
+    if (!symbol_table_init(table, map, size)) {
+        symbol_table_free(table);
+        return false;
+    }
+
+    return true;
+}
+
+/* Appends `;` and the function at `pc` in `object` to `line`. `map` is the
+ * object's symbol table, or NULL. Unknown functions are named by address.
+ */
+static void profile_append_frame(char* line, uint32_t object, uintptr_t pc, symbol_table_t* map) {
+    uint32_t len = strlen(line);
+    const char* sym = NULL;
+
+    if (object == KERNEL) {
+        sym = symbol_for_addr(&pc);
+    } else if (map) {
+        sym = symbol_table_find(map, &pc);
+    }
+
+    if (sym) {
+        snprintf(line + len, PROFILE_LINE_SIZE - len, ";%s", sym);
+    } else {
+        snprintf(line + len, PROFILE_LINE_SIZE - len, ";%s+%x", names[object], pc);
+    }
+}
+
+/* Writes the samples to the serial port as folded stacks, one per line and
+ * outermost frame first, ready for flame graph tools:
+ *     profile: begin
+ *     <process>;<function>;<function> 1
+ *     profile: end <samples lost to a full buffer>
+ * Kernel functions are resolved with the kernel's symbols, user ones with the
+ * maps in `PROFILE_SYMBOLS_DIR`. Sampling is paused meanwhile.
+ */
+void profile_dump() {
+    static char line[PROFILE_LINE_SIZE];
+    static symbol_table_t maps[PROFILE_MAX_NAMES];
+    uint8_t loaded[PROFILE_MAX_NAMES] = { 0 }; // 1 if tried, 2 if found
+
+    if (!samples) {
+        return;
+    }
+
+    bool was_sampling = sampling;
+    sampling = false;
+
+    uint32_t count = num_samples < PROFILE_NUM_SAMPLES ? num_samples : PROFILE_NUM_SAMPLES;
+
+    serial_send_string("profile: begin\n");
+
+    for (uint32_t i = 0; i < count; i++) {
+        profile_sample_t* sample = &samples[i];
+
+        strcpy(line, names[sample->process]);
+
+        for (int32_t j = sample->depth - 1; j >= 0; j--) {
+            uint32_t object = sample->objects[j];
+
+            if (object > UNKNOWN && !loaded[object]) {
+                loaded[object] = profile_load_map(names[object], &maps[object]) ? 2 : 1;
+            }
+
+            profile_append_frame(line, object, sample->pcs[j],
+                loaded[object] == 2 ? &maps[object] : NULL);
+        }
+
+        serial_send_string(line);
+        serial_send_string(" 1\n");
+    }
+
+    snprintf(line, PROFILE_LINE_SIZE, "profile: end %d\n", num_samples - count);
+    serial_send_string(line);
+
+    for (uint32_t i = 0; i < PROFILE_MAX_NAMES; i++) {
+        if (loaded[i] == 2) {
+            symbol_table_free(&maps[i]);
+        }
+    }
+
+    sampling = was_sampling;
+}
@@ -11,50 +11,142 @@ typedef struct _stackframe_t {
     uintptr_t eip;
 } stackframe_t;
 
-static uint8_t* symbols;
-static uint32_t len;
+static symbol_table_t kernel_symbols;
 
 void init_stacktrace(uint8_t* data, uint32_t size) {
-    symbols = realloc(data, size + 1); // NULL-terminate the symbol list
-    symbols[size] = 0;
-    len = size;
+    data = realloc(data, size + 1); // Room to terminate the last name
+
+    if (!symbol_table_init(&kernel_symbols, (char*) data, size)) {
+        printke("invalid kernel symbol table");
+    }
+}
+
+/* Returns the value of the hexadecimal digit `c`, or -1.
+ */
+static int32_t hex_value(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+
+    return -1;
 }
 
-/* Returns a pointer to the start of the symbol corresponding to `*addr`.
- * Returns the symbol's address in `*addr`.
+/* Parses `size` bytes of "address name" lines, as generated by
+ * `misc/gen-symbol-map.sh`, into `table`, so that lookups are binary searches
+ * instead of scans of the text. `data` must have room for a byte after its
+ * end; it's kept as the table's string table, and freed with it.
+ * Returns false if no symbol could be read.
  */
-char* symbol_for_addr(uintptr_t* addr) {
-    uintptr_t last = 0, current = 0;
-    char* last_sym = 0, * current_sym = 0;
-    char* curr = (char*) symbols;
-
-    while (curr && curr < (char*) symbols + len) {
-        current = strtol(curr, &current_sym, 16);
-        current_sym = current_sym + 1;
-
-        if (!last) {
-            last = current;
-            last_sym = current_sym;
+bool symbol_table_init(symbol_table_t* table, char* data, uint32_t size) {
+    uint32_t max_count = 1;
+
+    for (uint32_t i = 0; i < size; i++) {
+        max_count += data[i] == '\n';
+    }
+
+    data[size] = '\0';
+
+    *table = (symbol_table_t) {
+        .addrs = kmalloc(max_count*sizeof(uintptr_t)),
+        .names = kmalloc(max_count*sizeof(char*)),
+        .strings = data,
+        .count = 0
+    };
+
+    char* line = data;
+    bool sorted = true;
+
+    while (line < data + size) {
+        char* end = strchrnul(line, '\n');
+        uintptr_t addr = 0;
+        int32_t digit;
+
+        *end = '\0';
+
+        while ((digit = hex_value(*line)) >= 0) {
+            addr = (addr << 4) | digit;
+            line++;
         }
 
-        if (current > *addr) {
-            *addr = last;
-            return last_sym;
+        if (*line == ' ' && line[1]) {
+            uint32_t i = table->count++;
+
+            table->addrs[i] = addr;
+            table->names[i] = line + 1;
+            sorted = sorted && (!i || table->addrs[i - 1] <= addr);
         }
 
-        last = current;
-        last_sym = current_sym;
-        curr = strchr(curr, '\n') + 1;
+        line = end + 1;
     }
 
-    return NULL;
+    // Maps come sorted from the build, this is only a fallback
+    for (uint32_t i = 1; !sorted && i < table->count; i++) {
+        uintptr_t addr = table->addrs[i];
+        char* name = table->names[i];
+        uint32_t j = i;
+
+        for (; j > 0 && table->addrs[j - 1] > addr; j--) {
+            table->addrs[j] = table->addrs[j - 1];
+            table->names[j] = table->names[j - 1];
+        }
+
+        table->addrs[j] = addr;
+        table->names[j] = name;
+    }
+
+    return table->count > 0;
+}
+
+void symbol_table_free(symbol_table_t* table) {
+    kfree(table->addrs);
+    kfree(table->names);
+    kfree(table->strings);
+    table->count = 0;
+}
+
+/* Returns the name of the symbol `*addr` belongs to, the last one starting at
+ * or before it, and sets `*addr` to the symbol's address. Returns NULL if the
+ * address is outside of the table.
+ */
+const char* symbol_table_find(symbol_table_t* table, uintptr_t* addr) {
+    if (!table->count || *addr < table->addrs[0] || *addr > table->addrs[table->count - 1]) {
+        return NULL;
+    }
+
+    uint32_t low = 0;
+    uint32_t high = table->count - 1;
+
+    // Invariant: addrs[low] <= *addr, and the answer is at most `high`
+    while (low < high) {
+        uint32_t mid = low + (high - low + 1)/2;
+
+        if (table->addrs[mid] <= *addr) {
+            low = mid;
+        } else {
+            high = mid - 1;
+        }
+    }
+
+    *addr = table->addrs[low];
+
+    return table->names[low];
+}
+
+/* Looks `*addr` up in the kernel's symbols, see `symbol_table_find`.
+ */
+const char* symbol_for_addr(uintptr_t* addr) {
+    return symbol_table_find(&kernel_symbols, addr);
 }
 
 void stacktrace_print() {
     stackframe_t* stackframe = NULL;
     uintptr_t addr = 0;
 
-    if (!symbols) {
+    if (!kernel_symbols.count) {
         printke("symbols were not loaded, aborting stack trace output");
         return;
     }
@@ -65,13 +157,9 @@ void stacktrace_print() {
 
     while (stackframe) {
         addr = stackframe->eip;
-        char* sym = symbol_for_addr(&addr);
-        sym = sym ? sym : "<not found>";
-        char* end = strchrnul(sym, '\n');
+        const char* sym = symbol_for_addr(&addr);
 
-        *end = '\0';
-        printk(" %p: %s", addr, sym);
-        *end = '\n';
+        printk(" %p: %s", addr, sym ? sym : "<not found>");
 
         stackframe = stackframe->ebp;
     }
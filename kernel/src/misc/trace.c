@@ -0,0 +1,91 @@
+#include <kernel/trace.h>
+#include <kernel/proc.h>
+#include <kernel/serial.h>
+#include <kernel/smp.h>
+#include <kernel/sys.h>
+#include <kernel/timer.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+volatile uint32_t trace_mask;
+
+static trace_event_t* events;
+static volatile uint32_t next_event; // Free-running, wraps around the ring
+
+void init_trace() {
+    events = kmalloc(TRACE_NUM_EVENTS*sizeof(trace_event_t));
+    memset(events, 0, TRACE_NUM_EVENTS*sizeof(trace_event_t));
+}
+
+/* Appends an event to the ring, overwriting the oldest one when it's full.
+ * Takes no lock: each event claims its slot with an atomic increment, so
+ * interrupt handlers and other CPUs can record concurrently.
+ */
+void trace_record(uint32_t category, uint32_t phase, uint32_t arg0, uint32_t arg1) {
+    uint32_t index = __atomic_fetch_add(&next_event, 1, __ATOMIC_RELAXED);
+
+    events[index % TRACE_NUM_EVENTS] = (trace_event_t) {
+        .tsc = rdtsc(),
+        .category = category,
+        .phase = phase,
+        .cpu = smp_current_cpu()->id,
+        .pid = proc_get_current_pid(),
+        .args = { arg0, arg1 }
+    };
+}
+
+/* Enables the categories of events in `mask`, disabling the others, and
+ * returns the previous mask.
+ */
+uint32_t trace_set_mask(uint32_t mask) {
+    if (!events) {
+        return 0;
+    }
+
+    return __atomic_exchange_n(&trace_mask, mask & TRACE_ALL, __ATOMIC_SEQ_CST);
+}
+
+static void trace_print(const char* format, ...) {
+    char line[96];
+    va_list args;
+
+    va_start(args, format);
+    vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+
+    serial_send_string(line);
+}
+
+/* Writes the recorded events to the serial port, oldest first, and empties
+ * the ring. Tracing is stopped first so that the dump doesn't trace itself.
+ * The format is line-based, for `misc/trace2json.py`:
+ *     trace: begin <tsc_base> <tsc_mult> <tsc_shift>
+ *     <tsc> <cpu> <pid> <category> <phase> <arg0> <arg1>
+ *     trace: end <lost events>
+ * with numbers in hexadecimal.
+ */
+void trace_dump() {
+    if (!events) {
+        return;
+    }
+
+    const sys_time_page_t* time = timer_get_time_info();
+    uint32_t mask = trace_set_mask(0);
+    uint32_t end = next_event;
+    uint32_t start = end > TRACE_NUM_EVENTS ? end - TRACE_NUM_EVENTS : 0;
+
+    trace_print("trace: begin %llx %x %x\n", time->tsc_base, time->tsc_mult, time->tsc_shift);
+
+    for (uint32_t i = start; i != end; i++) {
+        trace_event_t* event = &events[i % TRACE_NUM_EVENTS];
+
+        trace_print("%llx %x %x %x %x %x %x\n", event->tsc, event->cpu, event->pid,
+            event->category, event->phase, event->args[0], event->args[1]);
+    }
+
+    trace_print("trace: end %x\n", start);
+
+    next_event = 0;
+    trace_set_mask(mask);
+}
@@ -1,7 +1,9 @@
 #include <kernel/wm.h>
 #include <kernel/mouse.h>
 #include <kernel/kbd.h>
+#include <kernel/spinlock.h>
 #include <kernel/sys.h>
+#include <kernel/trace.h>
 
 #include <kernel/fs.h>
 
@@ -37,13 +39,18 @@ static fb_t fb;
 static mouse_t mouse;
 static rect_t screen_rect;
 
+// Taken by entry points: system calls and input callbacks
+static spinlock_t wm_lock = SPINLOCK_INIT;
+
 static struct {
     mouse_t raw_prev;
     wm_window_t* previously_hovered_win;
     wm_window_t* clicked_win;
     bool win_dragged;
     point_t initial_position;
-    float cumulative_dx, cumulative_dy;
+    int32_t cumulative_dx, cumulative_dy;
+    // Sub-pixel motion left over by the sensitivity scaling, in tenths
+    int32_t remainder_dx, remainder_dy;
 } cursor;
 
 void init_wm() {
@@ -69,22 +76,28 @@ uint32_t wm_open_window(fb_t* buff, uint32_t flags) {
     *win = (wm_window_t) {
         .ufb = *buff,
         .kfb = *buff,
-        .id = ++id_count,
         .flags = flags | WM_NOT_DRAWN,
         .events = ringbuffer_new(WM_EVENT_QUEUE_SIZE * sizeof(wm_event_t))
     };
 
     win->kfb.address = (uintptr_t) kmalloc(buff->height*buff->pitch);
 
+    spinlock_acquire(&wm_lock);
+
+    win->id = ++id_count;
     list_add_front(&windows, win);
     wm_assign_position(win);
     wm_assign_z_orders();
     wm_raise_window(win);
 
+    spinlock_release(&wm_lock);
+
     return win->id;
 }
 
 void wm_close_window(uint32_t win_id) {
+    spinlock_acquire(&wm_lock);
+
     list_t* item = wm_get_window(win_id);
 
     if (item) {
@@ -119,17 +132,24 @@ void wm_close_window(uint32_t win_id) {
     } else {
         printke("close: failed to find window of id %d", win_id);
     }
+
+    spinlock_release(&wm_lock);
 }
 
 /* System call interface to draw a window. `clip` specifies which part to copy
  * from userspace and redraw. If `clip` is NULL, the whole window is redrawn.
  */
 void wm_render_window(uint32_t win_id, rect_t* clip) {
+    TRACE(TRACE_RENDER, TRACE_BEGIN, win_id, 0);
+    spinlock_acquire(&wm_lock);
+
     list_t* item = wm_get_window(win_id);
     rect_t rect;
 
     if (!item) {
         printke("render called by invalid window, id %d", win_id);
+        spinlock_release(&wm_lock);
+        TRACE(TRACE_RENDER, TRACE_END, win_id, 0);
         return;
     }
 
@@ -160,13 +180,19 @@ void wm_render_window(uint32_t win_id, rect_t* clip) {
     if (win->flags & WM_NOT_DRAWN) {
         win->flags &= ~WM_NOT_DRAWN;
     }
+
+    spinlock_release(&wm_lock);
+    TRACE(TRACE_RENDER, TRACE_END, win_id, 0);
 }
 
 void wm_get_event(uint32_t win_id, wm_event_t* event) {
+    spinlock_acquire(&wm_lock);
+
     list_t* item = wm_get_window(win_id);
 
     if (!item) {
         printke("Get_event: invalid window %d", win_id);
+        spinlock_release(&wm_lock);
         return;
     }
 
@@ -177,6 +203,8 @@ void wm_get_event(uint32_t win_id, wm_event_t* event) {
     } else {
         memset(event, 0, sizeof(wm_event_t));
     }
+
+    spinlock_release(&wm_lock);
 }
 
 /* Window management stuff */
@@ -501,6 +529,26 @@ bool wm_is_titlebar_being_hovered(wm_window_t* win) {
     }
 }
 
+/* Same as above, for the window of id `win_id`. Fails if there is no such
+ * window.
+ */
+bool wm_is_window_titlebar_hovered(uint32_t win_id) {
+    spinlock_acquire(&wm_lock);
+
+    list_t* item = wm_get_window(win_id);
+    bool hovered = false;
+
+    if (item) {
+        hovered = wm_is_titlebar_being_hovered(list_entry(item, wm_window_t));
+    } else {
+        printke("the given window id (%d) is unknown", win_id);
+    }
+
+    spinlock_release(&wm_lock);
+
+    return hovered;
+}
+
 /* TODO: update to allow drawing cut-off cursors e.g. to the right
  *       or bottom of the screen.
  */
@@ -526,13 +574,20 @@ void wm_draw_mouse(rect_t new) {
  */
 void wm_mouse_callback(mouse_t raw_curr) {
     const mouse_t prev = mouse;
-    const float sens = 0.7f;
+    const int32_t sens = 7; // In tenths; the kernel doesn't use the FPU
     const int32_t max_x = fb.width - MOUSE_SIZE - 1;
     const int32_t max_y = fb.height - MOUSE_SIZE - 1;
 
+    spinlock_acquire(&wm_lock);
+
     // Move the cursor
-    float dx = (raw_curr.x - cursor.raw_prev.x)*sens;
-    float dy = (raw_curr.y - cursor.raw_prev.y)*sens;
+    int32_t dx = (raw_curr.x - cursor.raw_prev.x)*sens + cursor.remainder_dx;
+    int32_t dy = (raw_curr.y - cursor.raw_prev.y)*sens + cursor.remainder_dy;
+
+    cursor.remainder_dx = dx % 10;
+    cursor.remainder_dy = dy % 10;
+    dx /= 10;
+    dy /= 10;
 
     mouse.x += dx;
     mouse.y += dy;
@@ -648,11 +703,15 @@ void wm_mouse_callback(mouse_t raw_curr) {
 
     // Update the saved cursor state
     cursor.raw_prev = raw_curr;
+
+    spinlock_release(&wm_lock);
 }
 
 void wm_kbd_callback(kbd_event_t event) {
     wm_event_t kbd_event;
 
+    spinlock_acquire(&wm_lock);
+
     if (!list_empty(&windows)) {
         list_t* iter;
         wm_window_t* win;
@@ -665,8 +724,10 @@ void wm_kbd_callback(kbd_event_t event) {
             ringbuffer_write(win->events, sizeof(wm_event_t), (uint8_t*) &kbd_event);
 
             if (!(win->flags & WM_SKIP_INPUT)) {
-                return;
+                break;
             }
         }
     }
+
+    spinlock_release(&wm_lock);
 }
@@ -0,0 +1,902 @@
+#include <kernel/dl.h>
+#include <kernel/paging.h>
+#include <kernel/proc.h>
+#include <kernel/spinlock.h>
+#include <kernel/sys.h>
+
+#include <list.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Where a library is loaded. A library always gets the same address, so that
+ * its read-only pages are the same in, and shared by, every process using it,
+ * see `proc_populate_page`.
+ */
+typedef struct {
+    char* path;
+    uintptr_t base;
+    uint32_t size;
+} dl_library_t;
+
+static list_t libraries;
+static uintptr_t next_base = DL_BASE;
+static spinlock_t dl_lock = SPINLOCK_INIT; // Guards the above
+
+/* A page of an executable or a library as it is loaded, before relocations:
+ * what the segments overlapping it store, zero-filled past the end of the
+ * file. Read-only pages are mapped as is in processes, others are copied, see
+ * `proc_populate_page`.
+ */
+typedef struct {
+    uintptr_t vaddr;
+    uint8_t* data; // Page-aligned kernel memory
+    uintptr_t frame; // Where `data` lives
+    uint32_t refs; // Address spaces mapping `frame`
+    uint32_t last_use;
+} dl_page_t;
+
+/* The cached pages of a file.
+ */
+typedef struct {
+    inode_t* inode;
+    list_t pages;
+} dl_file_t;
+
+/* The exec cache keeps images and the pages of their files around once
+ * processes are done with them, so that running a program again needs no
+ * disk access. Entries are dropped when their file changes, see
+ * `dl_invalidate`, pages that are still mapped being kept aside until they
+ * aren't.
+ */
+static list_t images; // Most recently used first
+static uint32_t num_images = 0;
+static list_t files;
+static list_t stale_pages;
+static uint32_t num_pages = 0; // Not counting stale ones
+static uint32_t cache_clock = 0; // Orders page uses
+static uint32_t cache_generation = 0; // Bumped by every invalidation
+static spinlock_t cache_lock = SPINLOCK_INIT; // Guards the above
+
+static void dl_free(dl_image_t* image);
+
+void init_dl() {
+    libraries = LIST_HEAD_INIT(libraries);
+    images = LIST_HEAD_INIT(images);
+    files = LIST_HEAD_INIT(files);
+    stale_pages = LIST_HEAD_INIT(stale_pages);
+}
+
+/* Returns the address of the library at `path`, which spans `size` bytes, or
+ * zero if we ran out of room for libraries.
+ */
+static uintptr_t dl_library_base(const char* path, uint32_t size) {
+    dl_library_t* library;
+    uintptr_t base = 0;
+
+    spinlock_acquire(&dl_lock);
+
+    list_for_each_entry(library, &libraries) {
+        // A library that grew doesn't fit at its old address anymore
+        if (!strcmp(library->path, path) && size <= library->size) {
+            base = library->base;
+            break;
+        }
+    }
+
+    if (!base && next_base + size > next_base && next_base + size <= DL_END) {
+        library = kmalloc(sizeof(dl_library_t));
+        *library = (dl_library_t) {
+            .path = strdup(path),
+            .base = next_base,
+            .size = size
+        };
+
+        list_add(&libraries, library);
+        base = next_base;
+        next_base += size;
+    }
+
+    spinlock_release(&dl_lock);
+
+    return base;
+}
+
+/* Reads the `size` bytes at `vaddr` in `object`, relative to its base, into
+ * `buf`. Returns false unless all of them are stored in the file.
+ */
+static bool dl_read(dl_object_t* object, uintptr_t vaddr, void* buf, uint32_t size) {
+    if (!size) {
+        return true;
+    }
+
+    for (uint32_t i = 0; i < object->header.phnum; i++) {
+        elf_program_header_t* segment = &object->segments[i];
+
+        if (segment->type == ELF_PT_LOAD && vaddr >= segment->vaddr &&
+                vaddr + size >= vaddr &&
+                vaddr + size <= segment->vaddr + segment->filesz) {
+            uint32_t offset = segment->offset + (vaddr - segment->vaddr);
+            return fs_read(object->inode, offset, buf, size) == size;
+        }
+    }
+
+    return false;
+}
+
+/* Returns whether the `size` bytes at `vaddr` in `object` are in a segment,
+ * a writable one if `writable` is set. Relocations may only touch those,
+ * read-only pages being shared.
+ */
+static bool dl_contains(dl_object_t* object, uintptr_t vaddr, uint32_t size, bool writable) {
+    for (uint32_t i = 0; i < object->header.phnum; i++) {
+        elf_program_header_t* segment = &object->segments[i];
+
+        if (segment->type == ELF_PT_LOAD && (!writable || (segment->flags & ELF_PF_W)) &&
+                vaddr >= segment->vaddr && vaddr + size >= vaddr &&
+                vaddr + size <= segment->vaddr + segment->memsz) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* Reads the dynamic section of `object` and the tables it points to: symbols,
+ * their hash table and names, and relocations. Returns false if the object is
+ * malformed, or needs relocations in its text.
+ */
+static bool dl_read_dynamic(dl_object_t* object) {
+    elf_program_header_t* dynamic = NULL;
+
+    for (uint32_t i = 0; i < object->header.phnum; i++) {
+        if (object->segments[i].type == ELF_PT_DYNAMIC) {
+            dynamic = &object->segments[i];
+        }
+    }
+
+    // Statically linked
+    if (!dynamic || dynamic->filesz < sizeof(elf_dynamic_t)) {
+        return true;
+    }
+
+    uint32_t file_size = object->inode->size;
+
+    if (dynamic->filesz > file_size) {
+        return false;
+    }
+
+    object->num_dynamic = dynamic->filesz / sizeof(elf_dynamic_t);
+    object->dynamic = kmalloc(object->num_dynamic * sizeof(elf_dynamic_t));
+
+    if (!dl_read(object, dynamic->vaddr, object->dynamic,
+            object->num_dynamic * sizeof(elf_dynamic_t))) {
+        return false;
+    }
+
+    uintptr_t hash = 0;
+    uintptr_t symbols = 0;
+    uintptr_t strings = 0;
+    uintptr_t rel = 0;
+    uintptr_t jmprel = 0;
+    uint32_t rel_size = 0;
+    uint32_t jmprel_size = 0;
+
+    for (uint32_t i = 0; i < object->num_dynamic; i++) {
+        uint32_t value = object->dynamic[i].value;
+
+        switch (object->dynamic[i].tag) {
+        case ELF_DT_HASH:
+            hash = value;
+            break;
+        case ELF_DT_SYMTAB:
+            symbols = value;
+            break;
+        case ELF_DT_STRTAB:
+            strings = value;
+            break;
+        case ELF_DT_STRSZ:
+            object->strings_size = value;
+            break;
+        case ELF_DT_REL:
+            rel = value;
+            break;
+        case ELF_DT_RELSZ:
+            rel_size = value;
+            break;
+        case ELF_DT_JMPREL:
+            jmprel = value;
+            break;
+        case ELF_DT_PLTRELSZ:
+            jmprel_size = value;
+            break;
+        case ELF_DT_TEXTREL:
+            return false;
+        }
+    }
+
+    // The hash table tells the number of symbols
+    uint32_t counts[2]; // Buckets, chains
+
+    if (!hash || !symbols || !strings || !object->strings_size ||
+            object->strings_size > file_size ||
+            rel_size > file_size || rel_size % sizeof(elf_rel_t) ||
+            jmprel_size > file_size || jmprel_size % sizeof(elf_rel_t) ||
+            !dl_read(object, hash, counts, sizeof(counts)) ||
+            !counts[0] || counts[0] > file_size / 4 || counts[1] > file_size / 4) {
+        return false;
+    }
+
+    uint32_t hash_size = (2 + counts[0] + counts[1]) * sizeof(uint32_t);
+
+    object->hash = kmalloc(hash_size);
+    object->num_symbols = counts[1];
+    object->symbols = kmalloc(object->num_symbols * sizeof(elf_symbol_t) + 1);
+    object->strings = kmalloc(object->strings_size);
+    object->num_rels = (rel_size + jmprel_size) / sizeof(elf_rel_t);
+    object->rels = kmalloc(rel_size + jmprel_size + 1);
+
+    if (!dl_read(object, hash, object->hash, hash_size) ||
+            !dl_read(object, symbols, object->symbols,
+                object->num_symbols * sizeof(elf_symbol_t)) ||
+            !dl_read(object, strings, object->strings, object->strings_size) ||
+            !dl_read(object, rel, object->rels, rel_size) ||
+            !dl_read(object, jmprel, (uint8_t*) object->rels + rel_size, jmprel_size)) {
+        return false;
+    }
+
+    object->strings[object->strings_size - 1] = '\0';
+
+    return true;
+}
+
+static void dl_free_object(dl_object_t* object) {
+    if (object->inode) {
+        fs_close(object->inode);
+    }
+
+    kfree(object->name);
+    kfree(object->segments);
+    kfree(object->dynamic);
+    kfree(object->hash);
+    kfree(object->symbols);
+    kfree(object->strings);
+    kfree(object->rels);
+    kfree(object->values);
+    kfree(object);
+}
+
+/* Opens the executable or library at `path`, depending on `type`, and reads
+ * what's needed to link it. Libraries are given their address.
+ */
+static dl_object_t* dl_open(const char* path, const char* name, uint16_t type) {
+    inode_t* in = fs_open(path, O_RDONLY);
+
+    if (!in || in->type != DENT_FILE) {
+        if (type == ELF_TYPE_DYN) {
+            printke("dl: can't find %s", path);
+        }
+
+        return NULL;
+    }
+
+    dl_object_t* object = kmalloc(sizeof(dl_object_t));
+    memset(object, 0, sizeof(dl_object_t));
+    object->name = strdup(name);
+    object->inode = in;
+    object->segments = elf_read_headers(in, &object->header, type);
+
+    if (!object->segments || !dl_read_dynamic(object)) {
+        printke("dl: %s isn't a valid %s", path,
+            type == ELF_TYPE_EXEC ? "executable" : "library");
+        dl_free_object(object);
+        return NULL;
+    }
+
+    if (type == ELF_TYPE_DYN) {
+        uint32_t size = 0;
+
+        for (uint32_t i = 0; i < object->header.phnum; i++) {
+            elf_program_header_t* segment = &object->segments[i];
+            uint32_t end = align_to(segment->vaddr + segment->memsz, 0x1000);
+
+            if (segment->type == ELF_PT_LOAD && end > size) {
+                size = end;
+            }
+        }
+
+        object->base = dl_library_base(path, size);
+
+        if (!object->base) {
+            printke("dl: no room left to load %s", path);
+            dl_free_object(object);
+            return NULL;
+        }
+    }
+
+    return object;
+}
+
+/* The hash function of the ELF specification.
+ */
+static uint32_t dl_hash(const char* name) {
+    uint32_t h = 0;
+
+    while (*name) {
+        h = (h << 4) + (uint8_t) *name++;
+        uint32_t g = h & 0xF0000000;
+
+        if (g) {
+            h ^= g >> 24;
+        }
+
+        h &= ~g;
+    }
+
+    return h;
+}
+
+/* Returns the global symbol `name` if `object` defines it, NULL otherwise.
+ */
+static elf_symbol_t* dl_find_symbol(dl_object_t* object, const char* name) {
+    if (!object->hash) {
+        return NULL;
+    }
+
+    uint32_t num_buckets = object->hash[0];
+    uint32_t* buckets = &object->hash[2];
+    uint32_t* chains = &object->hash[2 + num_buckets];
+    uint32_t i = buckets[dl_hash(name) % num_buckets];
+
+    // Bound the walk in case the chains loop
+    for (uint32_t n = 0; i && i < object->num_symbols && n < object->num_symbols; n++) {
+        elf_symbol_t* symbol = &object->symbols[i];
+
+        if (symbol->shndx != ELF_SHN_UNDEF && ELF_ST_BIND(symbol->info) != ELF_STB_LOCAL &&
+                symbol->name < object->strings_size &&
+                !strcmp(object->strings + symbol->name, name)) {
+            return symbol;
+        }
+
+        i = chains[i];
+    }
+
+    return NULL;
+}
+
+/* Looks `name` up in the executable, then in libraries in load order, except
+ * in `skip`. Sets `owner` to the object defining the symbol.
+ */
+static elf_symbol_t* dl_lookup(dl_image_t* image, const char* name,
+        dl_object_t* skip, dl_object_t** owner) {
+    dl_object_t* object;
+
+    list_for_each_entry(object, &image->objects) {
+        elf_symbol_t* symbol = object != skip ? dl_find_symbol(object, name) : NULL;
+
+        if (symbol) {
+            *owner = object;
+            return symbol;
+        }
+    }
+
+    return NULL;
+}
+
+/* Finds the address each relocation of `object` refers to, so that applying
+ * them later can't fail. Returns false on undefined symbols or relocations we
+ * don't handle.
+ */
+static bool dl_resolve(dl_image_t* image, dl_object_t* object) {
+    if (!object->num_rels) {
+        return true;
+    }
+
+    object->values = kmalloc(object->num_rels * sizeof(uintptr_t));
+
+    for (uint32_t i = 0; i < object->num_rels; i++) {
+        elf_rel_t* rel = &object->rels[i];
+        uint32_t type = ELF_R_TYPE(rel->info);
+        uint32_t index = ELF_R_SYM(rel->info);
+        uint32_t size = sizeof(uint32_t);
+
+        if (index >= object->num_symbols || object->symbols[index].name >= object->strings_size) {
+            printke("dl: invalid relocation in %s", object->name);
+            return false;
+        }
+
+        elf_symbol_t* symbol = &object->symbols[index];
+        const char* name = object->strings + symbol->name;
+
+        if (type == ELF_R_386_RELATIVE) {
+            object->values[i] = object->base;
+        } else if (type == ELF_R_386_32 || type == ELF_R_386_PC32 ||
+                type == ELF_R_386_GLOB_DAT || type == ELF_R_386_JMP_SLOT ||
+                type == ELF_R_386_COPY) {
+            dl_object_t* owner = object;
+            elf_symbol_t* definition = symbol;
+
+            if (index && (symbol->shndx == ELF_SHN_UNDEF ||
+                    ELF_ST_BIND(symbol->info) != ELF_STB_LOCAL)) {
+                // Copy relocations initialize our copy from the library's
+                definition = dl_lookup(image, name,
+                    type == ELF_R_386_COPY ? object : NULL, &owner);
+            }
+
+            if (type == ELF_R_386_COPY) {
+                size = symbol->size;
+
+                if (!definition || definition->size < size ||
+                        !dl_contains(owner, definition->value, size, false)) {
+                    printke("dl: can't copy %s in %s", name, object->name);
+                    return false;
+                }
+            }
+
+            if (definition) {
+                object->values[i] = index ? owner->base + definition->value : 0;
+            } else if (ELF_ST_BIND(symbol->info) == ELF_STB_WEAK) {
+                object->values[i] = 0;
+            } else {
+                printke("dl: undefined symbol %s in %s", name, object->name);
+                return false;
+            }
+        } else {
+            printke("dl: unsupported relocation type %d in %s", type, object->name);
+            return false;
+        }
+
+        if (!dl_contains(object, rel->offset, size, true)) {
+            printke("dl: relocation to read-only memory in %s", object->name);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* Adds the library `name` to `image` if it isn't there already.
+ */
+static bool dl_need(dl_image_t* image, const char* name) {
+    dl_object_t* object;
+
+    list_for_each_entry(object, &image->objects) {
+        if (!strcmp(object->name, name)) {
+            return true;
+        }
+    }
+
+    if (strchr(name, '/') || strlen(name) > 255) {
+        printke("dl: invalid library name %s", name);
+        return false;
+    }
+
+    char path[sizeof(DL_LIBRARY_DIR) + 256];
+    strcpy(path, DL_LIBRARY_DIR);
+    strcat(path, name);
+
+    object = dl_open(path, name, ELF_TYPE_DYN);
+
+    if (!object) {
+        return false;
+    }
+
+    list_add(&image->objects, object);
+
+    return true;
+}
+
+/* Keeps `image` for later loads of its executable, unless the files it was
+ * read from changed since `generation`. Evicts the least recently used image
+ * nobody is using if there are too many.
+ */
+static void dl_cache_image(dl_image_t* image, uint32_t generation) {
+    inode_t* inode = list_first_entry(&image->objects, dl_object_t)->inode;
+    dl_image_t* evicted = NULL;
+    dl_image_t* other;
+    list_t* iter;
+
+    spinlock_acquire(&cache_lock);
+
+    bool keep = generation == cache_generation;
+
+    list_for_each_entry(other, &images) {
+        if (list_first_entry(&other->objects, dl_object_t)->inode == inode) {
+            keep = false; // Loaded concurrently, keep the other one
+            break;
+        }
+    }
+
+    if (keep) {
+        image->cached = true;
+        list_add_front(&images, image);
+        num_images++;
+    }
+
+    if (num_images > DL_CACHE_IMAGES) {
+        list_for_each_entry_rev(iter, other, &images) {
+            if (!other->refs) {
+                other->cached = false;
+                evicted = other;
+                list_del(iter);
+                num_images--;
+                break;
+            }
+        }
+    }
+
+    spinlock_release(&cache_lock);
+
+    // Closing files takes the fs lock, which may be held around `cache_lock`
+    if (evicted) {
+        dl_free(evicted);
+    }
+}
+
+/* Opens the executable at `path` and the libraries it needs, and resolves all
+ * of its symbols, so that it can be relocated once loaded in a process with
+ * `dl_relocate`. Returns NULL if anything is missing.
+ * Images are cached: running the same program again reuses its image without
+ * reading anything. Release it with `dl_release`.
+ */
+dl_image_t* dl_load(const char* path) {
+    inode_t* in = fs_open(path, O_RDONLY);
+    dl_image_t* image;
+    list_t* iter;
+
+    spinlock_acquire(&cache_lock);
+
+    uint32_t generation = cache_generation;
+
+    list_for_each(iter, image, &images) {
+        if (in && list_first_entry(&image->objects, dl_object_t)->inode == in) {
+            image->refs++;
+            list_move(iter, &images);
+            spinlock_release(&cache_lock);
+
+            return image;
+        }
+    }
+
+    spinlock_release(&cache_lock);
+
+    dl_object_t* executable = dl_open(path, path, ELF_TYPE_EXEC);
+
+    if (!executable) {
+        return NULL;
+    }
+
+    image = kmalloc(sizeof(dl_image_t));
+    *image = (dl_image_t) {
+        .objects = LIST_HEAD_INIT(image->objects),
+        .refs = 1,
+        .cached = false
+    };
+    list_add(&image->objects, executable);
+
+    // Libraries are appended while we walk the list, so their own
+    // dependencies are loaded too
+    dl_object_t* object;
+
+    list_for_each_entry(object, &image->objects) {
+        for (uint32_t i = 0; i < object->num_dynamic; i++) {
+            elf_dynamic_t* entry = &object->dynamic[i];
+
+            if (entry->tag != ELF_DT_NEEDED) {
+                continue;
+            }
+
+            if (entry->value >= object->strings_size ||
+                    !dl_need(image, object->strings + entry->value)) {
+                dl_free(image);
+                return NULL;
+            }
+        }
+    }
+
+    list_for_each_entry(object, &image->objects) {
+        if (!dl_resolve(image, object)) {
+            dl_free(image);
+            return NULL;
+        }
+    }
+
+    dl_cache_image(image, generation);
+
+    return image;
+}
+
+/* Applies the relocations of `image`, once loaded in `process`. The process's
+ * page directory must be the current one.
+ */
+void dl_relocate(dl_image_t* image, process_t* process) {
+    list_t* iter;
+    dl_object_t* object;
+
+    // Libraries first, so that copy relocations see their relocated data
+    list_for_each_entry_rev(iter, object, &image->objects) {
+        for (uint32_t i = 0; i < object->num_rels; i++) {
+            elf_rel_t* rel = &object->rels[i];
+            uintptr_t value = object->values[i];
+            uint32_t* target = (uint32_t*) (object->base + rel->offset);
+
+            if (ELF_R_TYPE(rel->info) == ELF_R_386_COPY) {
+                uint32_t size = object->symbols[ELF_R_SYM(rel->info)].size;
+
+                proc_populate(process, value, size);
+                proc_populate(process, (uintptr_t) target, size);
+                memcpy(target, (void*) value, size);
+                continue;
+            }
+
+            proc_populate(process, (uintptr_t) target, sizeof(uint32_t));
+
+            switch (ELF_R_TYPE(rel->info)) {
+            case ELF_R_386_RELATIVE:
+            case ELF_R_386_32:
+                *target += value;
+                break;
+            case ELF_R_386_PC32:
+                *target += value - (uintptr_t) target;
+                break;
+            default: // The GOT and PLT slots are bound right away
+                *target = value;
+                break;
+            }
+        }
+    }
+}
+
+static void dl_free(dl_image_t* image) {
+    while (!list_empty(&image->objects)) {
+        dl_free_object(list_first_entry(&image->objects, dl_object_t));
+        list_del(image->objects.next);
+    }
+
+    kfree(image);
+}
+
+/* Done with an image returned by `dl_load`.
+ */
+void dl_release(dl_image_t* image) {
+    spinlock_acquire(&cache_lock);
+    bool unused = !--image->refs && !image->cached;
+    spinlock_release(&cache_lock);
+
+    if (unused) {
+        dl_free(image);
+    }
+}
+
+static dl_file_t* dl_cache_find_file(inode_t* inode) {
+    dl_file_t* file;
+
+    list_for_each_entry(file, &files) {
+        if (file->inode == inode) {
+            return file;
+        }
+    }
+
+    return NULL;
+}
+
+static dl_page_t* dl_cache_find_page(inode_t* inode, uintptr_t vaddr) {
+    dl_file_t* file = dl_cache_find_file(inode);
+    dl_page_t* page;
+
+    if (!file) {
+        return NULL;
+    }
+
+    list_for_each_entry(page, &file->pages) {
+        if (page->vaddr == vaddr) {
+            return page;
+        }
+    }
+
+    return NULL;
+}
+
+/* Returns the cached contents of the page at `vaddr` of the executable or
+ * library `inode`, or NULL. If `map` is set, the caller maps the page in an
+ * address space, until `dl_cache_unmap_page`. On a miss, `generation` is to
+ * be passed to `dl_cache_add_page` once the page has been read.
+ */
+uint8_t* dl_cache_get_page(inode_t* inode, uintptr_t vaddr, bool map, uint32_t* generation) {
+    spinlock_acquire(&cache_lock);
+
+    dl_page_t* page = dl_cache_find_page(inode, vaddr);
+    uint8_t* data = NULL;
+
+    if (page) {
+        page->last_use = ++cache_clock;
+        page->refs += map ? 1 : 0;
+        data = page->data;
+    }
+
+    *generation = cache_generation;
+    spinlock_release(&cache_lock);
+
+    return data;
+}
+
+/* Frees the least recently used page that isn't mapped anywhere. Returns
+ * false if there is none.
+ */
+static bool dl_cache_evict_page() {
+    dl_file_t* file;
+    dl_page_t* page;
+    dl_page_t* oldest = NULL;
+    list_t* oldest_iter = NULL;
+    list_t* iter;
+
+    list_for_each_entry(file, &files) {
+        list_for_each(iter, page, &file->pages) {
+            if (!page->refs && (!oldest || page->last_use < oldest->last_use)) {
+                oldest = page;
+                oldest_iter = iter;
+            }
+        }
+    }
+
+    if (!oldest) {
+        return false;
+    }
+
+    list_del(oldest_iter);
+    kfree(oldest->data);
+    kfree(oldest);
+    num_pages--;
+
+    return true;
+}
+
+/* Caches `data`, a page-aligned page read from `inode` for `vaddr` after a
+ * miss at `generation`, see `dl_cache_get_page`. Returns the cached contents,
+ * ours or those another CPU added first, in which case `data` is freed.
+ * Returns NULL if the page can't be cached, the file having changed since we
+ * read it or the cache being full; `data` is then left to the caller.
+ */
+uint8_t* dl_cache_add_page(inode_t* inode, uintptr_t vaddr, uint8_t* data, bool map,
+        uint32_t generation) {
+    spinlock_acquire(&cache_lock);
+
+    dl_page_t* page = dl_cache_find_page(inode, vaddr);
+
+    if (page) {
+        kfree(data);
+    } else if (generation == cache_generation &&
+            (num_pages < DL_CACHE_PAGES || dl_cache_evict_page())) {
+        dl_file_t* file = dl_cache_find_file(inode);
+
+        if (!file) {
+            file = kmalloc(sizeof(dl_file_t));
+            file->inode = inode;
+            file->pages = LIST_HEAD_INIT(file->pages);
+            list_add(&files, file);
+        }
+
+        page = kmalloc(sizeof(dl_page_t));
+        *page = (dl_page_t) {
+            .vaddr = vaddr,
+            .data = data,
+            .frame = paging_virt_to_phys((uintptr_t) data),
+            .refs = 0
+        };
+
+        list_add(&file->pages, page);
+        num_pages++;
+    }
+
+    if (page) {
+        page->last_use = ++cache_clock;
+        page->refs += map ? 1 : 0;
+        data = page->data;
+    } else {
+        data = NULL;
+    }
+
+    spinlock_release(&cache_lock);
+
+    return data;
+}
+
+/* `frame`, the cached page at `vaddr` of `inode`, was unmapped from an address
+ * space.
+ */
+void dl_cache_unmap_page(inode_t* inode, uintptr_t vaddr, uintptr_t frame) {
+    spinlock_acquire(&cache_lock);
+
+    dl_page_t* page = dl_cache_find_page(inode, vaddr);
+    list_t* iter;
+
+    if (page && page->frame == frame) {
+        page->refs--;
+        spinlock_release(&cache_lock);
+        return;
+    }
+
+    // The file changed since the page was mapped
+    list_for_each(iter, page, &stale_pages) {
+        if (page->frame == frame) {
+            if (!--page->refs) {
+                list_del(iter);
+                kfree(page->data);
+                kfree(page);
+            }
+
+            break;
+        }
+    }
+
+    spinlock_release(&cache_lock);
+}
+
+/* Drops what the exec cache knows of `inode`, which is being written to,
+ * renamed or deleted. Called with the fs lock held.
+ */
+void dl_invalidate(inode_t* inode) {
+    list_t doomed = LIST_HEAD_INIT(doomed);
+    dl_image_t* image;
+    dl_object_t* object;
+    dl_page_t* page;
+    list_t* iter;
+    list_t* next;
+
+    spinlock_acquire(&cache_lock);
+
+    // Reads in progress mustn't cache what they got either
+    cache_generation++;
+
+    list_for_each_safe(iter, next, &images) {
+        image = list_entry(iter, dl_image_t);
+
+        list_for_each_entry(object, &image->objects) {
+            if (object->inode == inode) {
+                image->cached = false;
+                break;
+            }
+        }
+
+        if (!image->cached) {
+            if (!image->refs) {
+                list_add(&doomed, image);
+            }
+
+            list_del(iter);
+            num_images--;
+        }
+    }
+
+    dl_file_t* file = dl_cache_find_file(inode);
+
+    if (file) {
+        while (!list_empty(&file->pages)) {
+            page = list_first_entry(&file->pages, dl_page_t);
+
+            if (page->refs) {
+                list_add(&stale_pages, page);
+            } else {
+                kfree(page->data);
+                kfree(page);
+            }
+
+            list_del(file->pages.next);
+            num_pages--;
+        }
+
+        list_for_each(iter, file, &files) {
+            if (file->inode == inode) {
+                list_del(iter);
+                kfree(file);
+                break;
+            }
+        }
+    }
+
+    spinlock_release(&cache_lock);
+
+    while (!list_empty(&doomed)) {
+        dl_free(list_first_entry(&doomed, dl_image_t));
+        list_del(doomed.next);
+    }
+}
@@ -0,0 +1,62 @@
+#include <kernel/elf.h>
+#include <kernel/sys.h>
+
+#include <kernel/uapi/uapi_time.h>
+
+#include <stdlib.h>
+
+/* Checks that `segment` can be loaded from a file of `size` bytes. Segments of
+ * executables must also live between the first page and the time page, those
+ * of shared objects are checked once they're given an address, see `dl.c`.
+ */
+static bool elf_check_segment(elf_program_header_t* segment, uint32_t size, uint16_t type) {
+    uint32_t end = segment->vaddr + segment->memsz;
+
+    if (segment->filesz > segment->memsz || end < segment->vaddr ||
+            segment->offset + segment->filesz < segment->offset ||
+            segment->offset + segment->filesz > size) {
+        return false;
+    }
+
+    return type != ELF_TYPE_EXEC || (segment->vaddr >= 0x1000 && end <= TIME_PAGE_ADDR);
+}
+
+/* Reads and validates the headers of the 32-bit x86 ELF file `in`, filling
+ * `header`. `type` is the kind of file expected, an executable or a shared
+ * object. Returns the program headers, to be freed by the caller, or NULL if
+ * the file isn't one we can load.
+ */
+elf_program_header_t* elf_read_headers(inode_t* in, elf_header_t* header, uint16_t type) {
+    if (fs_read(in, 0, (uint8_t*) header, sizeof(elf_header_t)) != sizeof(elf_header_t)) {
+        return NULL;
+    }
+
+    if (header->magic != ELF_MAGIC || header->class != ELF_CLASS_32 ||
+            header->data != ELF_DATA_LSB || header->type != type ||
+            header->machine != ELF_MACHINE_386 || !header->phnum ||
+            header->phentsize != sizeof(elf_program_header_t)) {
+        return NULL;
+    }
+
+    if (type == ELF_TYPE_EXEC && (header->entry < 0x1000 || header->entry >= TIME_PAGE_ADDR)) {
+        return NULL;
+    }
+
+    uint32_t size = header->phnum * sizeof(elf_program_header_t);
+    elf_program_header_t* segments = kmalloc(size);
+
+    if (fs_read(in, header->phoff, (uint8_t*) segments, size) != size) {
+        kfree(segments);
+        return NULL;
+    }
+
+    for (uint32_t i = 0; i < header->phnum; i++) {
+        if (segments[i].type == ELF_PT_LOAD && !elf_check_segment(&segments[i], in->size, type)) {
+            printke("elf: invalid segment at %p", segments[i].vaddr);
+            kfree(segments);
+            return NULL;
+        }
+    }
+
+    return segments;
+}
@@ -0,0 +1,88 @@
+#include <kernel/futex.h>
+#include <kernel/proc.h>
+#include <kernel/spinlock.h>
+
+#include <list.h>
+#include <stdlib.h>
+
+/* A thread blocked on a futex. Futexes are keyed by user address, and only
+ * threads sharing an address space share futexes.
+ */
+typedef struct {
+    uintptr_t directory;
+    uint32_t* uaddr;
+    process_t* process;
+} futex_waiter_t;
+
+static list_t waiters;
+static spinlock_t futex_lock = SPINLOCK_INIT; // Guards the above
+
+void init_futex() {
+    waiters = LIST_HEAD_INIT(waiters);
+}
+
+/* Blocks the current thread until `futex_wake` is called on `uaddr`, unless
+ * `*uaddr` isn't `val` anymore, in which case -1 is returned right away.
+ * Wakeups can be spurious: callers must check their condition again.
+ */
+int32_t futex_wait(uint32_t* uaddr, uint32_t val) {
+    process_t* proc = proc_get_current();
+    futex_waiter_t waiter = {
+        .directory = proc->directory,
+        .uaddr = uaddr,
+        .process = proc
+    };
+
+    // Reading the word mustn't fault under the lock
+    if (!proc_fault_in(uaddr, sizeof(uint32_t), false)) {
+        return -1;
+    }
+
+    // Checking the value under the lock means we can't miss a wakeup
+    spinlock_acquire(&futex_lock);
+
+    if (*(volatile uint32_t*) uaddr != val) {
+        spinlock_release(&futex_lock);
+        return -1;
+    }
+
+    list_add(&waiters, &waiter);
+    proc->blocked = true;
+
+    spinlock_release(&futex_lock);
+
+    // The scheduler skips us until we're woken up, possibly already
+    proc_schedule();
+
+    return 0;
+}
+
+/* Wakes up at most `count` threads waiting on `uaddr` in the current address
+ * space. Returns the number of threads woken up.
+ */
+uint32_t futex_wake(uint32_t* uaddr, uint32_t count) {
+    uintptr_t directory = proc_get_current()->directory;
+    uint32_t woken = 0;
+    list_t* iter;
+    list_t* next;
+
+    spinlock_acquire(&futex_lock);
+
+    list_for_each_safe(iter, next, &waiters) {
+        futex_waiter_t* waiter = list_entry(iter, futex_waiter_t);
+
+        if (woken == count) {
+            break;
+        }
+
+        if (waiter->uaddr == uaddr && waiter->directory == directory) {
+            list_del(iter);
+            waiter->process->blocked = false;
+            woken++;
+        }
+    }
+
+    spinlock_release(&futex_lock);
+
+    return woken;
+}
@@ -1,37 +1,132 @@
 #include <kernel/proc.h>
+#include <kernel/bcache.h>
 #include <kernel/timer.h>
 #include <kernel/paging.h>
 #include <kernel/pmm.h>
+#include <kernel/profile.h>
 #include <kernel/gdt.h>
 #include <kernel/fpu.h>
 #include <kernel/fs.h>
+#include <kernel/futex.h>
 #include <kernel/pipe.h>
+#include <kernel/smp.h>
+#include <kernel/spinlock.h>
+#include <kernel/trace.h>
 #include <kernel/sys.h>
 
 #include <kernel/sched_robin.h>
 
+#include <kernel/uapi/uapi_time.h>
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+// Each CPU runs its own process
+#define current_process (smp_current_cpu()->process)
+// Threads share their leader's address space, files and working directory
+#define current_leader (current_process->leader)
+
 extern uint32_t irq_handler_end;
 
-process_t* current_process = NULL;
-sched_t* scheduler = NULL;
+extern void proc_switch_context(uintptr_t* prev_esp, uintptr_t next_esp,
+    uintptr_t directory, volatile uint32_t* prev_on_cpu);
+
+static uintptr_t proc_setup_kernel_stack(uintptr_t kernel_stack, uintptr_t eip,
+    uintptr_t user_stack);
+static void proc_add(process_t* process);
 
 static uint32_t next_pid = 1;
+static list_t processes; // Every live process, in creation order
+static list_t zombies; // Exited processes whose kernel stack isn't freed yet
+static spinlock_t proc_lock = SPINLOCK_INIT; // Guards the above
 
 void init_proc() {
-    scheduler = sched_robin();
+    processes = LIST_HEAD_INIT(processes);
+    zombies = LIST_HEAD_INIT(zombies);
+    smp_current_cpu()->scheduler = sched_robin();
+}
+
+/* Frees what remains of exited processes, once no CPU runs on their kernel
+ * stack anymore. Leaders are kept around as long as their threads are.
+ */
+static void proc_reap() {
+    list_t* iter;
+    list_t* next;
+
+    spinlock_acquire(&proc_lock);
+
+    list_for_each_safe(iter, next, &zombies) {
+        process_t* proc = list_entry(iter, process_t);
+
+        if (!proc->on_cpu && !proc->thread_refs) {
+            if (proc->leader != proc) {
+                proc->leader->thread_refs--;
+            }
+
+            list_del(iter);
+            kfree((void*) (proc->kernel_stack - 0x1000 * PROC_KERNEL_STACK_PAGES + 4));
+            kfree(proc);
+        }
+    }
+
+    spinlock_release(&proc_lock);
 }
 
-/* Creates a process running the code specified at `code` in raw instructions
- * and add it to the process queue, after the currently executing process.
+/* Creates a process running the executable of `image`, left for the caller
+ * to finish setting up and add to the process queue. The segments of the
+ * executable and of its libraries are only mapped when first touched, see
+ * `proc_handle_fault`.
  * `argv` is the array of arguments, NULL terminated.
  */
-process_t* proc_run_code(uint8_t* code, uint32_t size, char** argv) {
+process_t* proc_run_image(dl_image_t* image, char** argv) {
     static uintptr_t temp_page = 0;
 
+    proc_reap();
+
+    // Describe the segments, sbrk's heap starts after the executable's
+    list_t regions = LIST_HEAD_INIT(regions);
+    dl_object_t* executable = list_first_entry(&image->objects, dl_object_t);
+    uintptr_t image_end = 0x1000;
+    dl_object_t* object;
+
+    list_for_each_entry(object, &image->objects) {
+        const char* name = strrchr(object->name, '/') ? strrchr(object->name, '/') + 1 : object->name;
+
+        for (uint32_t i = 0; i < object->header.phnum; i++) {
+            elf_program_header_t* segment = &object->segments[i];
+            uintptr_t vaddr = object->base + segment->vaddr;
+
+            if (segment->type != ELF_PT_LOAD || !segment->memsz) {
+                continue;
+            }
+
+            // Objects are loaded at the same address in every process
+            proc_region_t* region = kmalloc(sizeof(proc_region_t));
+
+            *region = (proc_region_t) {
+                .start = vaddr & PAGE_FRAME,
+                .end = align_to(vaddr + segment->memsz, 0x1000),
+                .flags = PAGE_USER | (segment->flags & ELF_PF_W ? PAGE_RW : PAGE_SHARED),
+                .inode = object->inode,
+                .vaddr = vaddr,
+                .offset = segment->offset,
+                .file_size = segment->filesz,
+                .base = object->base,
+                .name = strdup(name)
+            };
+
+            if (object == executable && region->end > image_end) {
+                image_end = region->end;
+            }
+
+            list_add(&regions, region);
+        }
+    }
+
+    // `temp_page` and `next_pid` are shared
+    spinlock_acquire(&proc_lock);
+
     if (!temp_page) {
         temp_page = (uintptr_t) kamalloc(0x1000, 0x1000);
     }
@@ -44,11 +139,9 @@ process_t* proc_run_code(uint8_t* code, uint32_t size, char** argv) {
         argv++;
     }
 
-    // TODO: this assumes .bss sections are marked as progbits
-    uint32_t num_code_pages = divide_up(size, 0x1000);
     uint32_t num_stack_pages = PROC_STACK_PAGES;
 
-    process_t* process = kmalloc(sizeof(process_t));
+    process_t* process = kamalloc(sizeof(process_t), 16);
     uintptr_t kernel_stack = (uintptr_t) aligned_alloc(4, 0x1000 * PROC_KERNEL_STACK_PAGES);
     uintptr_t pd_phys = pmm_alloc_page();
 
@@ -68,19 +161,14 @@ process_t* proc_run_code(uint8_t* code, uint32_t size, char** argv) {
     uintptr_t previous_pd = *paging_get_page(0xFFFFF000, false, 0) & PAGE_FRAME;
     paging_switch_directory(pd_phys);
 
-    // Map the code and copy it to physical pages, zero out the excess memory
-    // for static variables
-    // TODO: don't require contiguous pages
-    uintptr_t code_phys = pmm_alloc_pages(num_code_pages);
-    paging_map_pages(0x00001000, code_phys, num_code_pages, PAGE_USER | PAGE_RW);
-    memcpy((void*) 0x00001000, (void*) code, size);
-    memset((uint8_t*) 0x1000 + size, 0, num_code_pages * 0x1000 - size);
-
     // Map the stack
     uintptr_t stack_phys = pmm_alloc_pages(num_stack_pages);
     paging_map_pages(0xC0000000 - 0x1000 * num_stack_pages, stack_phys,
         num_stack_pages, PAGE_USER | PAGE_RW);
 
+    // Map the kernel's time page, read-only
+    paging_map_page(TIME_PAGE_ADDR, timer_get_time_page(), PAGE_USER | PAGE_SHARED);
+
     /* Setup the (argc, argv) part of the userstack, start by copying the given
      * arguments on that stack. */
     list_t arglist = LIST_HEAD_INIT(arglist);
@@ -121,7 +209,7 @@ process_t* proc_run_code(uint8_t* code, uint32_t size, char** argv) {
 
     *process = (process_t) {
         .pid = next_pid++,
-        .code_len = num_code_pages,
+        .code_len = (image_end - 0x1000) / 0x1000,
         .stack_len = num_stack_pages,
         .directory = pd_phys,
         .kernel_stack = kernel_stack + PROC_KERNEL_STACK_PAGES * 0x1000 - 4,
@@ -129,10 +217,290 @@ process_t* proc_run_code(uint8_t* code, uint32_t size, char** argv) {
         .initial_user_stack = (uintptr_t) ustack_int,
         .mem_len = 0,
         .sleep_ticks = 0,
-        .filetable = LIST_HEAD_INIT(process->filetable),
-        .cwd = strdup("/")
+        .cwd = "/",
+        .resident_pages = num_stack_pages,
+        .on_cpu = 0,
+        .leader = process,
+        .num_threads = 1,
+        .regions = LIST_HEAD_INIT(process->regions),
+        .mem_lock = SPINLOCK_INIT
     };
 
+    list_splice(&regions, &process->regions);
+
+    spinlock_release(&proc_lock);
+
+    // Relocations are written to the new address space
+    paging_switch_directory(pd_phys);
+    dl_relocate(image, process);
+    paging_switch_directory(previous_pd);
+
+    process->saved_kernel_stack = proc_setup_kernel_stack(process->kernel_stack,
+        executable->header.entry, process->initial_user_stack);
+
+    return process;
+}
+
+/* Reads the contents of `page` for `leader`'s regions into `buf`, without
+ * holding locks during disk reads.
+ */
+static void proc_fill_page(process_t* leader, uintptr_t page, uint8_t* buf) {
+    proc_region_t* region;
+
+    memset(buf, 0, 0x1000);
+
+    list_for_each_entry(region, &leader->regions) {
+        uintptr_t from = page > region->vaddr ? page : region->vaddr;
+        uintptr_t to = region->vaddr + region->file_size;
+
+        if (to > page + 0x1000) {
+            to = page + 0x1000;
+        }
+
+        if (page >= region->start && page < region->end && from < to) {
+            fs_read(region->inode, region->offset + (from - region->vaddr),
+                buf + (from - page), to - from);
+        }
+    }
+}
+
+/* Returns a new frame holding a copy of `data`, or zeroes if NULL. The frame
+ * is filled through this CPU's window before being exposed to other threads.
+ */
+static uintptr_t proc_copy_page(uint8_t* data) {
+    cpu_t* cpu = smp_current_cpu();
+
+    if (!cpu->fault_window) {
+        cpu->fault_window = (uintptr_t) kamalloc(0x1000, 0x1000);
+    }
+
+    uintptr_t frame = pmm_alloc_page();
+    uint8_t* window = (uint8_t*) cpu->fault_window;
+
+    *paging_get_page(cpu->fault_window, false, 0) = frame | PAGE_PRESENT | PAGE_RW;
+    paging_invalidate_page(cpu->fault_window);
+
+    if (data) {
+        memcpy(window, data, 0x1000);
+    } else {
+        memset(window, 0, 0x1000);
+    }
+
+    return frame;
+}
+
+/* Maps `page` in the address space of `process` on its first access, filling
+ * it from every region it overlaps. File contents come from the exec cache,
+ * see `dl.c`: read-only pages map the cached frame directly, others get a
+ * copy. Returns whether `page` belongs to a region, i.e. whether the access is
+ * legitimate.
+ */
+static bool proc_populate_page(process_t* process, uintptr_t page) {
+    process_t* leader = process->leader;
+    proc_region_t* region;
+    inode_t* inode = NULL;
+    uint32_t flags = 0;
+    bool shareable = true;
+    bool cacheable = true;
+    bool in_file = false;
+
+    list_for_each_entry(region, &leader->regions) {
+        if (page >= region->start && page < region->end) {
+            flags |= region->flags;
+            shareable = shareable && (region->flags & PAGE_SHARED);
+            cacheable = cacheable && (!inode || inode == region->inode);
+            in_file = in_file || (page < region->vaddr + region->file_size &&
+                page + 0x1000 > region->vaddr);
+            inode = region->inode;
+        }
+    }
+
+    if (!flags) {
+        return false;
+    }
+
+    // Pages of bss only are just zeroes
+    cacheable = cacheable && in_file;
+    shareable = shareable && cacheable;
+
+    uint8_t* data = NULL;
+    uint8_t* read = NULL; // What we read ourselves, if it couldn't be cached
+    uint32_t generation;
+
+    if (cacheable) {
+        data = dl_cache_get_page(inode, page, shareable, &generation);
+    }
+
+    if (in_file && !data) {
+        read = kamalloc(0x1000, 0x1000);
+        proc_fill_page(leader, page, read);
+
+        if (cacheable) {
+            data = dl_cache_add_page(inode, page, read, shareable, generation);
+            read = data ? NULL : read;
+        }
+    }
+
+    uintptr_t frame;
+
+    if (data && shareable) {
+        frame = paging_virt_to_phys((uintptr_t) data);
+    } else {
+        frame = proc_copy_page(data ? data : read);
+        shareable = false;
+    }
+
+    kfree(read);
+
+    spinlock_acquire(&leader->mem_lock);
+
+    page_t* entry = paging_get_page(page, true, PAGE_USER | PAGE_RW);
+
+    // Another thread may have beaten us to it
+    if (*entry & PAGE_PRESENT) {
+        if (shareable) {
+            dl_cache_unmap_page(inode, page, frame);
+        } else {
+            pmm_free_page(frame);
+        }
+    } else {
+        *entry = frame | PAGE_PRESENT | (shareable ? flags : flags & ~PAGE_SHARED);
+        paging_invalidate_page(page);
+        leader->resident_pages++;
+    }
+
+    spinlock_release(&leader->mem_lock);
+
+    return true;
+}
+
+/* Called on page faults on unmapped user addresses, from user or kernel mode.
+ * Returns whether the fault was resolved by mapping a page of the executable
+ * or of a library, in which case the faulting instruction can be retried.
+ */
+bool proc_handle_fault(uintptr_t addr) {
+    if (!current_process || addr >= KERNEL_BASE_VIRT) {
+        return false;
+    }
+
+    return proc_populate_page(current_process, addr & PAGE_FRAME);
+}
+
+/* Maps the pages of `process` covering the `size` bytes at `addr`, so that the
+ * kernel can access them while the process's page directory is the current
+ * one but another process runs, see `dl_relocate`.
+ */
+void proc_populate(process_t* process, uintptr_t addr, uint32_t size) {
+    for (uintptr_t page = addr & PAGE_FRAME; page < addr + size; page += 0x1000) {
+        page_t* entry = paging_get_page(page, false, 0);
+
+        if (!entry || !(*entry & PAGE_PRESENT)) {
+            proc_populate_page(process, page);
+        }
+    }
+}
+
+/* Makes sure that the `size` bytes at `addr` are user memory of the current
+ * process, writable if `write`, before the kernel accesses them holding a
+ * lock: nothing may fault then, as a process can't be killed holding a lock.
+ * Pages that weren't touched yet are mapped now, as demand paging reads from
+ * the filesystem itself, and would overwrite its buffers halfway through a
+ * file operation.
+ * Returns false if the process can't access the range.
+ */
+bool proc_fault_in(const void* addr, uint32_t size, bool write) {
+    uintptr_t start = (uintptr_t) addr;
+
+    if (start + size < start || start + size > KERNEL_BASE_VIRT) {
+        return false;
+    }
+
+    for (uintptr_t page = start & PAGE_FRAME; page < start + size; page += 0x1000) {
+        page_t* entry = paging_get_page(page, false, 0);
+
+        if ((!entry || !(*entry & PAGE_PRESENT)) &&
+                !proc_populate_page(current_process, page)) {
+            return false;
+        }
+
+        entry = paging_get_page(page, false, 0);
+
+        if (!(*entry & PAGE_USER) || (write && !(*entry & PAGE_RW))) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* Creates a thread sharing the current process's address space and files,
+ * starting at `entry` with the user stack `stack`. The thread's entry point
+ * is called with `arg` as its argument, and must never return.
+ * If `tid_addr` isn't zero, the thread's id is written there right away, and
+ * the word is cleared and woken up through `futex_wake` when the thread exits.
+ * Returns the id of the new thread, or -1.
+ */
+int32_t proc_clone(uintptr_t entry, uintptr_t stack, uintptr_t arg, uintptr_t tid_addr) {
+    if (!entry || entry >= KERNEL_BASE_VIRT || stack >= KERNEL_BASE_VIRT ||
+            stack < 8 || tid_addr >= KERNEL_BASE_VIRT) {
+        return -1;
+    }
+
+    // We write the thread's argument on its stack, and its id
+    if (!proc_fault_in((void*) ((stack & ~0x3) - 8), 8, true) ||
+            (tid_addr && !proc_fault_in((void*) tid_addr, sizeof(uint32_t), true))) {
+        return -1;
+    }
+
+    proc_reap();
+
+    process_t* parent = current_process;
+    process_t* leader = parent->leader;
+    process_t* thread = kamalloc(sizeof(process_t), 16);
+    uintptr_t kernel_stack = (uintptr_t) aligned_alloc(4, 0x1000 * PROC_KERNEL_STACK_PAGES);
+
+    // Call `entry(arg)` with a null return address
+    uint32_t* ustack = (uint32_t*) (stack & ~0x3);
+    *(--ustack) = arg;
+    *(--ustack) = 0;
+
+    spinlock_acquire(&proc_lock);
+
+    *thread = (process_t) {
+        .pid = next_pid++,
+        .directory = parent->directory,
+        .kernel_stack = kernel_stack + PROC_KERNEL_STACK_PAGES * 0x1000 - 4,
+        .initial_user_stack = (uintptr_t) ustack,
+        .on_cpu = 0,
+        .leader = leader,
+        .clear_tid = tid_addr
+    };
+
+    memcpy(thread->name, parent->name, SYS_PROC_NAME_LEN);
+    leader->num_threads++;
+    leader->thread_refs++;
+
+    spinlock_release(&proc_lock);
+
+    if (tid_addr) {
+        *(uint32_t*) tid_addr = thread->pid;
+    }
+
+    thread->saved_kernel_stack = proc_setup_kernel_stack(thread->kernel_stack,
+        entry, thread->initial_user_stack);
+    proc_add(thread);
+
+    return thread->pid;
+}
+
+/* Prepares the kernel stack of a new process or thread as if it had already
+ * been interrupted, so that switching to it returns to userspace at `eip`,
+ * with `user_stack` as its stack. Returns the kernel stack pointer to save.
+ */
+static uintptr_t proc_setup_kernel_stack(uintptr_t kernel_stack, uintptr_t eip,
+        uintptr_t user_stack) {
+    uintptr_t saved_kernel_stack;
+
     // We use this label as the return address from `proc_switch_process`
     uint32_t* jmp = &irq_handler_end;
 
@@ -151,7 +519,7 @@ process_t* proc_run_code(uint8_t* code, uint32_t size, char** argv) {
         "push %%eax\n"         // %esp
         "push $0x202\n"        // %eflags with `IF` bit set
         "push $0x1B\n"         // user cs selector
-        "push $0x00001000\n"   // %eip
+        "push %[eip]\n"        // %eip
         // Push error code, interrupt number
         "sub $8, %%esp\n"
         // `pusha` equivalent
@@ -178,170 +546,440 @@ process_t* proc_run_code(uint8_t* code, uint32_t size, char** argv) {
         "mov %%ebx, %%esp\n"
         // Update the new process's %esp
         "mov %%eax, %[esp]\n"
-        : [esp] "=r" (process->saved_kernel_stack)
-        : [kstack] "r" (process->kernel_stack),
-          [ustack] "r" (process->initial_user_stack),
+        : [esp] "=r" (saved_kernel_stack)
+        : [kstack] "r" (kernel_stack),
+          [ustack] "r" (user_stack),
+          [eip] "r" (eip),
           [jmp] "r" (jmp)
         : "%eax", "%ebx"
     );
 
-    scheduler->sched_add(scheduler, process);
+    return saved_kernel_stack;
+}
 
-    return process;
+/* Makes a newly created process or thread runnable on the current CPU.
+ */
+static void proc_add(process_t* process) {
+    cpu_t* cpu = smp_current_cpu();
+
+    spinlock_acquire(&cpu->sched_lock);
+    cpu->scheduler->sched_add(cpu->scheduler, process);
+    spinlock_release(&cpu->sched_lock);
+
+    spinlock_acquire(&proc_lock);
+    list_add(&processes, process);
+    spinlock_release(&proc_lock);
 }
 
-/* Runs the scheduler. The scheduler may then decide to elect a new process, or
- * not.
+/* Takes a runnable process from another CPU's run queue and moves it to ours.
+ * Returns NULL if every other CPU is busy enough.
  */
-void proc_schedule() {
-    process_t* next = scheduler->sched_next(scheduler);
+static process_t* proc_steal(cpu_t* cpu) {
+    uint32_t num_cpus = smp_num_cpus();
+
+    for (uint32_t i = 1; i < num_cpus; i++) {
+        cpu_t* victim = smp_get_cpu((cpu->id + i) % num_cpus);
+
+        if (!victim->scheduler) {
+            continue;
+        }
+
+        // Never hold two run queue locks at once
+        spinlock_acquire(&victim->sched_lock);
+        process_t* proc = victim->scheduler->sched_steal(victim->scheduler);
+
+        if (proc) {
+            proc->on_cpu = 1;
+        }
+
+        spinlock_release(&victim->sched_lock);
+
+        if (proc) {
+            spinlock_acquire(&cpu->sched_lock);
+            cpu->scheduler->sched_add(cpu->scheduler, proc);
+            spinlock_release(&cpu->sched_lock);
+
+            return proc;
+        }
+    }
+
+    return NULL;
+}
+
+/* Runs the scheduler, and switches to the process it elects if it isn't the
+ * current one. When our run queue has nothing to offer, we try stealing work
+ * from other CPUs before falling back to idling.
+ * `preempted` tells whether the current process is giving up the CPU on its
+ * own, for accounting purposes.
+ */
+static void proc_reschedule(bool preempted) {
+    cpu_t* cpu = smp_current_cpu();
+    process_t* prev = cpu->process;
+
+    spinlock_acquire(&cpu->sched_lock);
+    process_t* next = cpu->scheduler->sched_next(cpu->scheduler);
+
+    // Claim it before other CPUs can steal it
+    if (next) {
+        next->on_cpu = 1;
+    }
+
+    spinlock_release(&cpu->sched_lock);
+
+    if (!next) {
+        next = proc_steal(cpu);
+    }
+
+    if (!next) {
+        next = cpu->idle;
+    }
 
-    if (next == current_process) {
+    if (next == prev) {
         return;
     }
 
-    fpu_switch(current_process, next);
+    if (preempted) {
+        prev->involuntary_switches++;
+    } else {
+        prev->voluntary_switches++;
+    }
+
+    fpu_switch(prev, next);
     proc_switch_process(next);
 }
 
-/* Called on clock ticks, calls the scheduler.
+/* Switches the calling CPU to `next`, which must have been claimed by setting
+ * its `on_cpu` flag. The current process can be picked up by other CPUs as
+ * soon as its context is saved.
+ */
+void proc_switch_process(process_t* next) {
+    cpu_t* cpu = smp_current_cpu();
+    process_t* prev = cpu->process;
+
+    TRACE(TRACE_SWITCH, TRACE_INSTANT, prev->pid, next->pid);
+
+    cpu->process = next;
+    gdt_set_kernel_stack(next->kernel_stack);
+
+    proc_switch_context(&prev->saved_kernel_stack, next->saved_kernel_stack,
+        next->directory, &prev->on_cpu);
+}
+
+/* Runs the scheduler. The scheduler may then decide to elect a new process, or
+ * not.
+ */
+void proc_schedule() {
+    proc_reschedule(false);
+}
+
+/* Called on clock ticks, charges the tick to the running process and calls
+ * the scheduler. The profiler samples what the tick interrupted first.
  */
 void proc_timer_callback(registers_t* regs) {
-    UNUSED(regs);
+    profile_sample(regs);
 
-    proc_schedule();
+    current_process->run_ticks++;
+    proc_reschedule(true);
 }
 
-/* Make the first jump to usermode.
- * A special function is needed as our first kernel stack isn't setup to return
- * to any interrupt handler; we have to `iret` ourselves.
+/* Turns the calling CPU's boot context into its idle process, then waits for
+ * the scheduler to elect something to run. Never returns.
+ * The idle process runs in the kernel's address space, with interrupts enabled;
+ * the first switch to a real process happens from a timer interrupt, whose
+ * frame the idle process resumes from later on.
  */
-void proc_enter_usermode() {
-    CLI(); // Interrupts will be reenabled by `iret`
+void proc_enter_scheduler() {
+    CLI();
+
+    cpu_t* cpu = smp_current_cpu();
+    process_t* idle = kamalloc(sizeof(process_t), 16);
+
+    *idle = (process_t) {
+        .pid = 0,
+        .directory = paging_get_kernel_directory(),
+        .name = "idle",
+        .on_cpu = 1,
+        .leader = idle,
+        .num_threads = 1
+    };
 
-    current_process = scheduler->sched_get_current(scheduler);
+    if (!cpu->scheduler) {
+        cpu->scheduler = sched_robin();
+    }
+
+    cpu->idle = idle;
+    cpu->process = idle;
 
-    if (!current_process) {
-        printke("no process to run");
-        abort();
+    // Other CPUs get their ticks from their local APIC, see `smp.c`
+    if (cpu->id == 0) {
+        timer_register_callback(&proc_timer_callback);
     }
 
-    timer_register_callback(&proc_timer_callback);
-    gdt_set_kernel_stack(current_process->kernel_stack);
-    paging_switch_directory(current_process->directory);
+    while (true) {
+        asm volatile (
+            "sti\n"
+            "hlt\n"
+            "cli\n");
 
-    asm volatile (
-        "mov $0x23, %%eax\n"
-        "mov %%eax, %%ds\n"
-        "mov %%eax, %%es\n"
-        "mov %%eax, %%fs\n"
-        "mov %%eax, %%gs\n"
-        "push %%eax\n"       // %ss
-        "mov %[ustack], %%eax\n"
-        "push %%eax\n"       // %esp
-        "push $0x202\n"      // %eflags with IF set
-        "push $0x1B\n"       // %cs
-        "push $0x00001000\n" // %eip
-        "iret\n"
-        :: [ustack] "r" (current_process->initial_user_stack)
-        : "%eax");
+        bcache_flush_old();
+    }
+}
+
+/* Takes a reference to a file table entry. Entries are shared by the tables
+ * of processes that don't share a lock, hence the atomics.
+ */
+static void proc_get_entry(ft_entry_t* ent) {
+    __atomic_add_fetch(&ent->refcount, 1, __ATOMIC_RELAXED);
+}
+
+/* Drops a reference to a file table entry, freeing it if it was the last.
+ */
+static void proc_put_entry(ft_entry_t* ent) {
+    if (ent && __atomic_sub_fetch(&ent->refcount, 1, __ATOMIC_ACQ_REL) == 0) {
+        /* TODO: this is out of place... the fs doesn't care about
+         * "open" or "close" */
+        fs_close(ent->inode);
+        kfree(ent);
+    }
 }
 
-/* Returns the filetable entry associated with fd, if any.
+/* Returns the filetable entry associated with fd, if any, with a reference
+ * the caller drops with `proc_put_entry` once done with it: the descriptor
+ * may be closed in the meantime.
  */
 ft_entry_t* proc_fd_to_entry(uint32_t fd) {
-    ft_entry_t* ent;
+    process_t* leader = current_leader;
+    ft_entry_t* ent = NULL;
 
-    list_for_each_entry(ent, &current_process->filetable) {
-        if (ent->fd == fd) {
-            return ent;
-        }
+    spinlock_acquire(&leader->fd_lock);
+
+    if (fd < leader->num_fds) {
+        ent = leader->fds[fd];
     }
 
-    return NULL;
+    if (ent) {
+        proc_get_entry(ent);
+    }
+
+    spinlock_release(&leader->fd_lock);
+
+    return ent;
 }
 
-/* Removes a file descriptor from the current process's list.
- * Frees it entirely if unused.
+/* Grows the file descriptor table of `leader` to hold at least `fd`. Returns
+ * false if `fd` is out of bounds. The caller holds the table's lock.
  */
-void proc_release_fd(uint32_t fd) {
-    ft_entry_t* ent;
-    list_t* iter;
+static bool proc_grow_fds(process_t* leader, uint32_t fd) {
+    if (fd >= PROC_MAX_FD) {
+        return false;
+    }
 
-    list_for_each(iter, ent, &current_process->filetable) {
-        if (ent->fd == fd) {
-            list_del(iter);
-            ent->refcount--;
+    if (fd < leader->num_fds) {
+        return true;
+    }
 
-            if (ent->refcount == 0) {
-                /* TODO: this is out of place... the fs doesn't care about
-                 * "open" or "close" */
-                fs_close(ent->inode);
-                free(ent);
-            }
+    uint32_t num = leader->num_fds ? leader->num_fds : 32;
+
+    while (num <= fd) {
+        num *= 2;
+    }
+
+    leader->fds = realloc(leader->fds, num * sizeof(ft_entry_t*));
+    leader->used_fds = realloc(leader->used_fds, num / 8);
+    memset(&leader->fds[leader->num_fds], 0,
+        (num - leader->num_fds) * sizeof(ft_entry_t*));
+    memset(&leader->used_fds[leader->num_fds / 32], 0, (num - leader->num_fds) / 8);
+    leader->num_fds = num;
+
+    return true;
+}
 
+/* Returns the lowest free descriptor of `leader` that is at least `min`, or
+ * -1 if the table is full. The caller holds the table's lock.
+ */
+static int32_t proc_alloc_fd(process_t* leader, uint32_t min) {
+    for (uint32_t fd = min; fd < PROC_MAX_FD; fd = align_to(fd + 1, 32)) {
+        if (!proc_grow_fds(leader, fd)) {
             break;
         }
+
+        // Skip slots below `min` in the first word
+        uint32_t free = ~leader->used_fds[fd / 32] & (0xFFFFFFFF << (fd % 32));
+
+        if (free) {
+            return (fd & ~31) + __builtin_ctz(free);
+        }
     }
+
+    return -1;
+}
+
+/* Points `fd` of `leader` at `entry`, or clears it if NULL. Returns the entry
+ * it replaces, whose reference the caller now holds. The caller holds the
+ * table's lock, and grew the table to fit `fd`.
+ */
+static ft_entry_t* proc_set_fd(process_t* leader, uint32_t fd, ft_entry_t* entry) {
+    ft_entry_t* previous = leader->fds[fd];
+
+    leader->fds[fd] = entry;
+
+    if (entry) {
+        leader->used_fds[fd / 32] |= 1u << (fd % 32);
+    } else {
+        leader->used_fds[fd / 32] &= ~(1u << (fd % 32));
+    }
+
+    return previous;
+}
+
+/* Removes a file descriptor from the current process's table.
+ * Frees its entry entirely if unused.
+ */
+void proc_release_fd(uint32_t fd) {
+    process_t* leader = current_leader;
+    ft_entry_t* ent = NULL;
+
+    spinlock_acquire(&leader->fd_lock);
+
+    if (fd < leader->num_fds) {
+        ent = proc_set_fd(leader, fd, NULL);
+    }
+
+    spinlock_release(&leader->fd_lock);
+
+    proc_put_entry(ent);
 }
 
 /* Adds or replaces a file descriptor for the current process.
  * Increments the refcount of the passed entry.
  */
-void proc_add_fd(ft_entry_t* entry) {
-    ft_entry_t* ent;
-    list_t* iter;
+void proc_add_fd(uint32_t fd, ft_entry_t* entry) {
+    process_t* leader = current_leader;
+    ft_entry_t* previous = NULL;
 
-    list_for_each(iter, ent, &current_process->filetable) {
-        if (ent->fd == entry->fd) {
-            proc_release_fd(ent->fd);
-            break;
-        }
+    spinlock_acquire(&leader->fd_lock);
+
+    if (proc_grow_fds(leader, fd)) {
+        proc_get_entry(entry);
+        previous = proc_set_fd(leader, fd, entry);
     }
 
-    entry->refcount++;
-    list_add_front(&current_process->filetable, entry);
+    spinlock_release(&leader->fd_lock);
+
+    proc_put_entry(previous);
 }
 
-/* Returns a new and unused fd for the current process.
- * TODO: make it use the lowest fd available.
+/* Releases every file descriptor of `leader`, and its table.
  */
-uint32_t proc_next_fd() {
-    static uint32_t avail = 3;
+static void proc_free_fds(process_t* leader) {
+    for (uint32_t fd = 0; fd < leader->num_fds; fd++) {
+        proc_put_entry(leader->fds[fd]);
+    }
 
-    return avail++;
+    kfree(leader->fds);
+    kfree(leader->used_fds);
+    leader->fds = NULL;
+    leader->used_fds = NULL;
+    leader->num_fds = 0;
 }
 
-/* Terminates the currently executing process.
+/* Terminates the currently executing thread. The address space and the files
+ * it shares with other threads are freed along with the last thread.
  * Implements the `exit` system call.
  */
 void proc_exit() {
-    // Free allocated pages: code, heap, stack, page directory
-    directory_entry_t* pd = (directory_entry_t*) 0xFFFFF000;
+    cpu_t* cpu = smp_current_cpu();
+    process_t* proc = cpu->process;
+    process_t* leader = proc->leader;
+    list_t* iter;
+    process_t* p;
 
-    for (uint32_t i = 0; i < 768; i++) {
-        if (!(pd[i] & PAGE_PRESENT)) {
-            continue;
+    fpu_exit_process(proc);
+
+    // Let `thread_join` know we're done; our user stack may be freed after this
+    if (proc->clear_tid) {
+        *(uint32_t*) proc->clear_tid = 0;
+        futex_wake((uint32_t*) proc->clear_tid, UINT32_MAX);
+    }
+
+    // We're still running on our kernel stack, it'll be freed by `proc_reap`
+    spinlock_acquire(&proc_lock);
+
+    list_for_each(iter, p, &processes) {
+        if (p == proc) {
+            list_del(iter);
+            break;
         }
+    }
+
+    list_add(&zombies, proc);
+
+    // The last thread must not free the address space under our feet
+    bool last = --leader->num_threads == 0;
 
-        uintptr_t page = pd[i] & PAGE_FRAME;
-        pmm_free_page(page);
+    if (!last) {
+        paging_switch_directory(paging_get_kernel_directory());
     }
 
-    uintptr_t pd_page = pd[1023] & PAGE_FRAME;
-    pmm_free_page(pd_page);
+    spinlock_release(&proc_lock);
 
-    // Free the kernel stack
-    kfree((void*) (current_process->kernel_stack - 0x1000 * PROC_KERNEL_STACK_PAGES + 4));
+    if (last) {
+        // Free the pages we own, then page tables
+        directory_entry_t* pd = (directory_entry_t*) 0xFFFFF000;
 
-    // Free the file descriptor list
-    while (!list_empty(&current_process->filetable)) {
-        ft_entry_t* ent = list_first_entry(&current_process->filetable, ft_entry_t);
-        proc_release_fd(ent->fd);
+        for (uint32_t i = 0; i < 768; i++) {
+            if (!(pd[i] & PAGE_PRESENT)) {
+                continue;
+            }
+
+            page_t* table = (page_t*) (0xFFC00000 + (i << 12));
+
+            for (uint32_t j = 0; j < 1024; j++) {
+                uintptr_t vaddr = (i << 22) | (j << 12);
+                uintptr_t frame = table[j] & PAGE_FRAME;
+
+                if (!(table[j] & PAGE_PRESENT)) {
+                    continue;
+                } else if (!(table[j] & PAGE_SHARED)) {
+                    pmm_free_page(frame);
+                    continue;
+                }
+
+                // Shared pages of files belong to the exec cache
+                proc_region_t* region;
+
+                list_for_each_entry(region, &leader->regions) {
+                    if (vaddr >= region->start && vaddr < region->end) {
+                        dl_cache_unmap_page(region->inode, vaddr, frame);
+                        break;
+                    }
+                }
+            }
+
+            uintptr_t page = pd[i] & PAGE_FRAME;
+            pmm_free_page(page);
+        }
+
+        // Another CPU may reuse the page directory as soon as it is freed
+        uintptr_t pd_page = pd[1023] & PAGE_FRAME;
+        paging_switch_directory(paging_get_kernel_directory());
+        pmm_free_page(pd_page);
+
+        while (!list_empty(&leader->regions)) {
+            proc_region_t* region = list_first_entry(&leader->regions, proc_region_t);
+
+            kfree(region->name);
+            kfree(region);
+            list_del(leader->regions.next);
+        }
+
+        proc_free_fds(leader);
     }
 
-    // This last line is actually safe, and necessary
-    scheduler->sched_exit(scheduler, current_process);
+    spinlock_acquire(&cpu->sched_lock);
+    cpu->scheduler->sched_exit(cpu->scheduler, proc);
+    spinlock_release(&cpu->sched_lock);
+
     proc_schedule();
 }
 
@@ -353,15 +991,96 @@ uint32_t proc_get_current_pid() {
     }
 }
 
-/* Returns a dynamically allocated copy of the current process's current working
- * directory.
+process_t* proc_get_current() {
+    return current_process;
+}
+
+/* Fills `buf` with the accounting information of at most `count` processes.
+ * Returns the total number of processes, which may be more than `count`.
+ */
+uint32_t proc_get_info(sys_proc_info_t* buf, uint32_t count) {
+    uint32_t n = 0;
+    process_t* proc;
+
+    spinlock_acquire(&proc_lock);
+
+    list_for_each_entry(proc, &processes) {
+        if (n < count) {
+            buf[n] = (sys_proc_info_t) {
+                .pid = proc->pid,
+                .run_ticks = proc->run_ticks,
+                .voluntary_switches = proc->voluntary_switches,
+                .involuntary_switches = proc->involuntary_switches,
+                .syscalls = proc->syscalls,
+                .page_faults = proc->page_faults,
+                .resident_pages = proc->leader->resident_pages
+            };
+
+            memcpy(buf[n].name, proc->name, SYS_PROC_NAME_LEN);
+        }
+
+        n++;
+    }
+
+    spinlock_release(&proc_lock);
+
+    return n;
+}
+
+/* Turns logging the system calls of the process `pid`, threads included, on or
+ * off. Returns false if there is no such process.
+ */
+bool proc_set_strace(uint32_t pid, bool enabled) {
+    process_t* proc;
+
+    spinlock_acquire(&proc_lock);
+
+    list_for_each_entry(proc, &processes) {
+        if (proc->pid == pid) {
+            if (enabled) {
+                proc->leader->strace |= PROC_STRACE;
+            } else {
+                proc->leader->strace &= ~PROC_STRACE;
+            }
+
+            spinlock_release(&proc_lock);
+            return true;
+        }
+    }
+
+    spinlock_release(&proc_lock);
+
+    return false;
+}
+
+/* Returns the number of processes whose system calls are logged.
+ */
+uint32_t proc_count_traced() {
+    uint32_t count = 0;
+    process_t* proc;
+
+    spinlock_acquire(&proc_lock);
+
+    list_for_each_entry(proc, &processes) {
+        if (proc == proc->leader && (proc->strace & PROC_STRACE)) {
+            count++;
+        }
+    }
+
+    spinlock_release(&proc_lock);
+
+    return count;
+}
+
+/* Returns the current process's current working directory, which stays valid
+ * until the process changes it.
  */
-char* proc_get_cwd() {
-    return strdup(current_process->cwd);
+const char* proc_get_cwd() {
+    return current_leader->cwd;
 }
 
 void proc_sleep(uint32_t ms) {
-    current_process->sleep_ticks = (uint32_t) ((ms*TIMER_FREQ)/1000.0);
+    current_process->sleep_ticks = ms*TIMER_FREQ/1000;
     proc_schedule();
 }
 
@@ -370,7 +1089,9 @@ void proc_sleep(uint32_t ms) {
  * details.
  */
 void* proc_sbrk(intptr_t size) {
-    uintptr_t end = 0x1000 + 0x1000*current_process->code_len + current_process->mem_len;
+    spinlock_acquire(&current_leader->mem_lock);
+
+    uintptr_t end = 0x1000 + 0x1000*current_leader->code_len + current_leader->mem_len;
 
     // Bytes available in the last allocated page
     int32_t remaining_bytes = (end % 0x1000) ? (0x1000 - (end % 0x1000)) : 0;
@@ -381,12 +1102,18 @@ void* proc_sbrk(intptr_t size) {
             uint32_t needed_size = size - remaining_bytes;
             uint32_t num = divide_up(needed_size, 0x1000);
 
-            if (!paging_alloc_pages(align_to(end, 0x1000), num)) {
+            // The heap mustn't run into shared libraries
+            if (align_to(end, 0x1000) + num * 0x1000 > DL_BASE ||
+                    !paging_alloc_pages(align_to(end, 0x1000), num)) {
+                spinlock_release(&current_leader->mem_lock);
                 return (void*) -1;
             }
+
+            current_leader->resident_pages += num;
         }
     } else if (size < 0) {
-        if (end + size < 0x1000*current_process->code_len) {
+        if (end + size < 0x1000*current_leader->code_len) {
+            spinlock_release(&current_leader->mem_lock);
             return (void*) -1; // Can't deallocate the code
         }
 
@@ -403,124 +1130,231 @@ void* proc_sbrk(intptr_t size) {
             for (uint32_t i = 0; i < num; i++) {
                 paging_unmap_page(virt - 0x1000*i);
             }
+
+            current_leader->resident_pages -= num;
         }
     }
 
-    current_process->mem_len += size;
+    current_leader->mem_len += size;
+
+    spinlock_release(&current_leader->mem_lock);
 
     return (void*) end;
 }
 
 int32_t proc_exec(const char* path, char** argv) {
-    /* Read the executable */
-    inode_t* in = fs_open(path, O_RDONLY);
+    // Only headers and what's needed to link are read now, segments are paged
+    // in on demand. Both come from the exec cache if the program ran before.
+    dl_image_t* image = dl_load(path);
 
-    if (!in || in->type != DENT_FILE) {
+    if (!image) {
         return -1;
     }
 
-    uint8_t* data = kmalloc(in->size);
-    uint32_t read = fs_read(in, 0, data, in->size);
+    process_t* p = proc_run_image(image, argv);
+    const char* name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+
+    dl_release(image);
+    strncpy(p->name, name, SYS_PROC_NAME_LEN - 1);
+
+    // Before the process is enqueued, or its first system calls could go unlogged
+    if (proc_get_current_pid() && (current_leader->strace & PROC_STRACE_CHILDREN)) {
+        p->strace = PROC_STRACE;
+    }
+
+    // Share file descriptors with the new process
+    if (proc_get_current_pid()) {
+        process_t* leader = current_leader;
 
-    if (read == in->size && in->size) {
-        process_t* p = proc_run_code(data, in->size, argv);
+        spinlock_acquire(&leader->fd_lock);
 
-        // Clone file descriptors
-        if (proc_get_current_pid()) {
-            ft_entry_t* ent;
+        p->num_fds = leader->num_fds;
+        p->fds = kmalloc(p->num_fds * sizeof(ft_entry_t*));
+        p->used_fds = kmalloc(p->num_fds / 8);
+        memcpy(p->fds, leader->fds, p->num_fds * sizeof(ft_entry_t*));
+        memcpy(p->used_fds, leader->used_fds, p->num_fds / 8);
 
-            list_for_each_entry(ent, &current_process->filetable) {
-                ent->refcount++;
-                list_add_front(&p->filetable, ent);
+        for (uint32_t fd = 0; fd < p->num_fds; fd++) {
+            if (p->fds[fd]) {
+                proc_get_entry(p->fds[fd]);
             }
         }
-    } else {
-        printke("exec failed while reading the executable");
-        return -1;
+
+        spinlock_release(&leader->fd_lock);
     }
 
+    // Only now may the process run, on any CPU
+    proc_add(p);
+
     return 0;
 }
 
 uint32_t proc_open(const char* path, uint32_t flags) {
+    process_t* leader = current_leader;
     inode_t* in = fs_open((char*) path, flags); // TODO
 
-    if (in) {
-        ft_entry_t* ent = kmalloc(sizeof(ft_entry_t));
+    if (!in) {
+        return FS_INVALID_FD;
+    }
+
+    ft_entry_t* ent = kmalloc(sizeof(ft_entry_t));
 
-        ent->fd = proc_next_fd();
-        ent->inode = in;
-        ent->mode = 0; // TODO: make use of this or delete it?
-        ent->offset = 0;
-        ent->size = in->size;
-        ent->index = 0;
-        ent->refcount = 1;
+    ent->inode = in;
+    ent->mode = 0; // TODO: make use of this or delete it?
+    ent->offset = 0;
+    ent->size = in->size;
+    ent->cursor = (fs_dir_cursor_t) { 0 };
+    ent->refcount = 1;
 
-        list_add_front(&current_process->filetable, ent);
+    spinlock_acquire(&leader->fd_lock);
 
-        return ent->fd;
+    int32_t fd = proc_alloc_fd(leader, PROC_FIRST_FD);
+
+    if (fd != -1) {
+        proc_set_fd(leader, fd, ent);
     }
 
-    return 0;
+    spinlock_release(&leader->fd_lock);
+
+    if (fd == -1) {
+        proc_put_entry(ent);
+        return FS_INVALID_FD;
+    }
+
+    return fd;
 }
 
 void proc_close(uint32_t fd) {
-    list_t* iter;
-    ft_entry_t* ent;
-    list_for_each(iter, ent, &current_process->filetable) {
-        if (ent->fd == fd) {
-            // TODO: At some point, we'll want to have a fs-layer writelock
-            fs_close(ent->inode);
-            list_del(iter);
-            return;
+    // TODO: At some point, we'll want to have a fs-layer writelock
+    proc_release_fd(fd);
+}
+
+/* Makes a new descriptor, the lowest available, for the file open as `fd`.
+ * Returns it, or -1 on error.
+ */
+int32_t proc_dup(uint32_t fd) {
+    process_t* leader = current_leader;
+    int32_t new_fd = -1;
+
+    spinlock_acquire(&leader->fd_lock);
+
+    if (fd < leader->num_fds && leader->fds[fd]) {
+        new_fd = proc_alloc_fd(leader, PROC_FIRST_FD);
+    }
+
+    if (new_fd != -1) {
+        proc_get_entry(leader->fds[fd]);
+        proc_set_fd(leader, new_fd, leader->fds[fd]);
+    }
+
+    spinlock_release(&leader->fd_lock);
+
+    return new_fd;
+}
+
+/* Makes `new_fd` refer to the file open as `fd`, closing what `new_fd` was
+ * open on. Returns `new_fd`, or -1 on error.
+ */
+int32_t proc_dup2(uint32_t fd, uint32_t new_fd) {
+    process_t* leader = current_leader;
+    ft_entry_t* previous = NULL;
+    int32_t ret = -1;
+
+    spinlock_acquire(&leader->fd_lock);
+
+    if (fd < leader->num_fds && leader->fds[fd] &&
+            (fd == new_fd || proc_grow_fds(leader, new_fd))) {
+        if (fd != new_fd) {
+            proc_get_entry(leader->fds[fd]);
+            previous = proc_set_fd(leader, new_fd, leader->fds[fd]);
         }
+
+        ret = new_fd;
     }
+
+    spinlock_release(&leader->fd_lock);
+
+    proc_put_entry(previous);
+
+    return ret;
 }
 
 uint32_t proc_read(uint32_t fd, uint8_t* buf, uint32_t size) {
     ft_entry_t* ent = proc_fd_to_entry(fd);
+    uint32_t read = 0;
 
-    if (ent) {
-        uint32_t read = fs_read(ent->inode, ent->offset, buf, size);
+    if (ent && proc_fault_in(buf, size, true)) {
+        read = fs_read(ent->inode, ent->offset, buf, size);
         ent->offset += read;
-        return read;
     }
 
-    return 0;
+    proc_put_entry(ent);
+
+    return read;
 }
 
 int32_t proc_readdir(uint32_t fd, sos_directory_entry_t* dent) {
     ft_entry_t* ent = proc_fd_to_entry(fd);
+    int32_t ret = -1;
 
-    if (ent) {
-        uint32_t read = fs_readdir(ent->inode, ent->index, dent, dent->entry_size);
+    if (ent && proc_fault_in(dent, sizeof(sos_directory_entry_t), true) &&
+            proc_fault_in(dent, dent->entry_size, true)) {
+        uint32_t read = fs_readdir(ent->inode, &ent->cursor, dent, dent->entry_size);
         ent->offset += read;
 
-        if (read) {
-            ent->index++;
-            return 1;
-        }
+        ret = read ? 1 : 0;
+    }
 
-        return 0;
+    proc_put_entry(ent);
+
+    return ret;
+}
+
+int32_t proc_getdents(uint32_t fd, sos_dirent_t* buf, uint32_t size, uint32_t flags) {
+    ft_entry_t* ent = proc_fd_to_entry(fd);
+    int32_t ret = -1;
+
+    if (ent && proc_fault_in(buf, size, true)) {
+        ret = fs_getdents(ent->inode, &ent->cursor, buf, size, flags);
     }
 
-    return -1;
+    proc_put_entry(ent);
+
+    return ret;
 }
 
 uint32_t proc_write(uint32_t fd, uint8_t* buf, uint32_t size) {
     ft_entry_t* ent = proc_fd_to_entry(fd);
+    uint32_t written = 0;
 
-    if (ent) {
-        uint32_t written = fs_write(ent->inode, buf, size);
+    if (ent && proc_fault_in(buf, size, false)) {
+        written = fs_write(ent->inode, buf, size);
         ent->offset += written;
-        return written;
     }
 
-    return 0;
+    proc_put_entry(ent);
+
+    return written;
+}
+
+/* Writes at `offset` in the file, leaving the offset of the descriptor as is.
+ */
+uint32_t proc_pwrite(uint32_t fd, uint8_t* buf, uint32_t size, uint32_t offset) {
+    ft_entry_t* ent = proc_fd_to_entry(fd);
+    uint32_t written = 0;
+
+    if (ent && offset + size >= offset && proc_fault_in(buf, size, false)) {
+        written = fs_pwrite(ent->inode, offset, buf, size);
+    }
+
+    proc_put_entry(ent);
+
+    return written;
 }
 
 int32_t proc_fseek(uint32_t fd, int32_t offset, uint32_t whence) {
     ft_entry_t* ent = proc_fd_to_entry(fd);
+    int32_t ret = 0;
 
     if (!ent) {
         return -1;
@@ -537,10 +1371,12 @@ int32_t proc_fseek(uint32_t fd, int32_t offset, uint32_t whence) {
         ent->offset = ent->size + offset;
         break;
     default:
-        return -1;
+        ret = -1;
     }
 
-    return 0;
+    proc_put_entry(ent);
+
+    return ret;
 }
 
 int32_t proc_ftell(uint32_t fd) {
@@ -550,21 +1386,26 @@ int32_t proc_ftell(uint32_t fd) {
         return -1;
     }
 
-    return ent->offset;
+    int32_t offset = ent->offset;
+    proc_put_entry(ent);
+
+    return offset;
 }
 
 int32_t proc_chdir(const char* path) {
-    // TODO: replace existence check with `stat` to validate path
-    char* npath = fs_normalize_path(path);
+    char npath[MAX_PATH];
+
+    if (!fs_normalize_path(path, npath)) {
+        return -1;
+    }
+
     inode_t* in = fs_open(npath, O_RDONLY);
 
-    if (in) {
-        kfree(npath);
+    if (!in || in->type != DENT_DIRECTORY) {
         return -1;
     }
 
-    kfree(current_process->cwd);
-    current_process->cwd = npath;
+    strcpy(current_leader->cwd, npath);
 
     return 0;
 }
\ No newline at end of file
@@ -50,49 +50,55 @@ process_t* sched_robin_next(sched_t* sched) {
     sched_robin_t* sc = (sched_robin_t*) sched;
     proc_node_t* p = sc->processes;
 
-    // Avoid switching to a sleeping process if possible
+    if (!p) {
+        return NULL;
+    }
+
+    // Avoid switching to a sleeping process if possible, never switch to a
+    // blocked one
     do {
         if (p->next->process->sleep_ticks > 0) {
             p->next->process->sleep_ticks--;
-        } else {
+        } else if (!p->next->process->blocked) {
             // We don't need to switch process
             if (p->next == sc->processes) {
                 return sc->processes->process;
             }
 
-            // We don't need to modify the process queue
-            if (p->next == sc->processes->next) {
-                break;
+            // Unless it's already next in line, we insert the next process
+            // between the current one and the one previously scheduled to be
+            // switched to.
+            if (p->next != sc->processes->next) {
+                proc_node_t* previous = p;
+                proc_node_t* next_proc = p->next;
+                proc_node_t* moved = sc->processes->next;
+
+                previous->next = next_proc->next;
+                next_proc->next = moved;
+                sc->processes->next = next_proc;
             }
 
-            // We insert the next process between the current one and the one
-            // previously scheduled to be switched to.
-            proc_node_t* previous = p;
-            proc_node_t* next_proc = p->next;
-            proc_node_t* moved = sc->processes->next;
-
-            previous->next = next_proc->next;
-            next_proc->next = moved;
-            sc->processes->next = next_proc;
+            sc->processes = sc->processes->next;
 
-            break;
+            return sc->processes->process;
         }
 
         p = p->next;
     } while (p != sc->processes);
 
-    sc->processes = sc->processes->next;
-
-    return sc->processes->process;
+    // Every process is sleeping or blocked
+    return NULL;
 }
 
 void sched_robin_exit(sched_t* sched, process_t* process) {
     sched_robin_t* sc = (sched_robin_t*) sched;
     proc_node_t* p = sc->processes;
 
+    // The CPU will idle or steal work from others
     if (sc->processes == sc->processes->next) {
-        printke("exiting from the last process");
-        abort();
+        kfree(sc->processes);
+        sc->processes = NULL;
+        return;
     }
 
     while (p->next->process != process) {
@@ -107,6 +113,43 @@ void sched_robin_exit(sched_t* sched, process_t* process) {
     kfree(to_remove);
 }
 
+/* Takes a process out of the ring for another CPU, see `sched_t`.
+ */
+process_t* sched_robin_steal(sched_t* sched) {
+    sched_robin_t* sc = (sched_robin_t*) sched;
+    proc_node_t* p = sc->processes;
+
+    if (!p) {
+        return NULL;
+    }
+
+    do {
+        proc_node_t* node = p->next;
+        process_t* process = node->process;
+
+        if (!process->on_cpu && !process->sleep_ticks && !process->blocked &&
+                !process->fpu_live) {
+            if (node == p) {
+                sc->processes = NULL;
+            } else {
+                p->next = node->next;
+
+                if (node == sc->processes) {
+                    sc->processes = p;
+                }
+            }
+
+            kfree(node);
+
+            return process;
+        }
+
+        p = p->next;
+    } while (p != sc->processes);
+
+    return NULL;
+}
+
 /* Allocates a round robin scheduler.
  */
 sched_t* sched_robin() {
@@ -116,7 +159,8 @@ sched_t* sched_robin() {
         .sched_get_current = sched_robin_get_current,
         .sched_add = sched_robin_add,
         .sched_next = sched_robin_next,
-        .sched_exit = sched_robin_exit
+        .sched_exit = sched_robin_exit,
+        .sched_steal = sched_robin_steal
     };
 
     sched->processes = NULL;
@@ -0,0 +1,55 @@
+#include <kernel/spinlock.h>
+#include <kernel/smp.h>
+
+/* Takes `lock`, spinning until it is available.
+ * While spinning, we keep servicing TLB shootdowns aimed at us: the CPU holding
+ * the lock may well be waiting on us to acknowledge one.
+ */
+void spinlock_acquire(spinlock_t* lock) {
+    uint32_t eflags;
+
+    asm volatile (
+        "pushf\n"
+        "pop %0\n"
+        "cli\n" : "=r" (eflags) :: "memory");
+
+    uint32_t cpu = smp_cpu_id();
+
+    if (lock->locked && lock->owner == cpu) {
+        lock->depth++;
+        return;
+    }
+
+    while (__atomic_exchange_n(&lock->locked, 1, __ATOMIC_ACQUIRE)) {
+        while (lock->locked) {
+            smp_handle_tlb_shootdown();
+            asm volatile ("pause");
+        }
+    }
+
+    lock->owner = cpu;
+    lock->depth = 1;
+    lock->eflags = eflags;
+    smp_get_cpu(cpu)->locks_held++;
+}
+
+/* Releases `lock` once it has been released as many times as it was taken, and
+ * restores the interrupt flag to its state prior to the first acquisition.
+ */
+void spinlock_release(spinlock_t* lock) {
+    if (--lock->depth) {
+        return;
+    }
+
+    uint32_t eflags = lock->eflags;
+
+    smp_get_cpu(lock->owner)->locks_held--;
+
+    // Nobody may mistake itself for the owner once the lock is up for grabs
+    lock->owner = SPINLOCK_NO_OWNER;
+    __atomic_store_n(&lock->locked, 0, __ATOMIC_RELEASE);
+
+    asm volatile (
+        "push %0\n"
+        "popf\n" :: "r" (eflags) : "memory", "cc");
+}
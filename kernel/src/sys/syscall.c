@@ -8,16 +8,22 @@
 #include <kernel/wm.h>
 #include <kernel/serial.h>
 #include <kernel/pipe.h>
+#include <kernel/profile.h>
+#include <kernel/futex.h>
+#include <kernel/fpu.h>
+#include <kernel/gdt.h>
+#include <kernel/smp.h>
+#include <kernel/spinlock.h>
+#include <kernel/trace.h>
 #include <kernel/sys.h> // for UNUSED macro
 
+#include <ringbuffer.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include <kernel/uapi/uapi_syscall.h>
 
-static void syscall_handler(registers_t* regs);
-
 static void syscall_yield(registers_t* regs);
 static void syscall_exit(registers_t* regs);
 static void syscall_sleep(registers_t* regs);
@@ -40,11 +46,41 @@ static void syscall_unlink(registers_t* regs);
 static void syscall_rename(registers_t* regs);
 static void syscall_maketty(registers_t* regs);
 static void syscall_stat(registers_t* regs);
+static void syscall_procinfo(registers_t* regs);
+static void syscall_clone(registers_t* regs);
+static void syscall_futex(registers_t* regs);
+static void syscall_getpid(registers_t* regs);
+static void syscall_dup(registers_t* regs);
+static void syscall_dup2(registers_t* regs);
+static void syscall_ring_enter(registers_t* regs);
+static void syscall_trace(registers_t* regs);
+static void syscall_profile(registers_t* regs);
+static void syscall_strace(registers_t* regs);
+static void syscall_getdents(registers_t* regs);
+static void syscall_sync(registers_t* regs);
+static void syscall_pwrite(registers_t* regs);
+
+#define MSR_SYSENTER_CS 0x174
+#define MSR_SYSENTER_ESP 0x175
+#define MSR_SYSENTER_EIP 0x176
+
+#define CPUID_FEAT_EDX_SEP (1 << 11)
+
+// System calls kept for `SYS_STRACE_READ`, older ones are overwritten
+#define STRACE_LOG_ENTRIES 512
+
+extern void syscall_sysenter_entry();
 
 handler_t syscall_handlers[SYSCALL_NUM] = { 0 };
 
+// Each CPU only updates its own statistics, see `syscall_account`
+static sys_syscall_stats_t syscall_stats[SMP_MAX_CPUS][SYS_MAX];
+static ringbuffer_t* strace_log;
+static spinlock_t strace_lock = SPINLOCK_INIT; // Guards the above
+
 void init_syscall() {
     isr_register_handler(48, syscall_handler);
+    syscall_init_cpu();
 
     syscall_handlers[SYS_YIELD] = syscall_yield;
     syscall_handlers[SYS_EXIT] = syscall_exit;
@@ -68,13 +104,135 @@ void init_syscall() {
     syscall_handlers[SYS_RENAME] = syscall_rename;
     syscall_handlers[SYS_MAKETTY] = syscall_maketty;
     syscall_handlers[SYS_STAT] = syscall_stat;
+    syscall_handlers[SYS_PROCINFO] = syscall_procinfo;
+    syscall_handlers[SYS_CLONE] = syscall_clone;
+    syscall_handlers[SYS_FUTEX] = syscall_futex;
+    syscall_handlers[SYS_GETPID] = syscall_getpid;
+    syscall_handlers[SYS_DUP] = syscall_dup;
+    syscall_handlers[SYS_DUP2] = syscall_dup2;
+    syscall_handlers[SYS_RING_ENTER] = syscall_ring_enter;
+    syscall_handlers[SYS_TRACE] = syscall_trace;
+    syscall_handlers[SYS_PROFILE] = syscall_profile;
+    syscall_handlers[SYS_STRACE] = syscall_strace;
+    syscall_handlers[SYS_GETDENTS] = syscall_getdents;
+    syscall_handlers[SYS_SYNC] = syscall_sync;
+    syscall_handlers[SYS_PWRITE] = syscall_pwrite;
+
+    strace_log = ringbuffer_new(STRACE_LOG_ENTRIES*sizeof(sys_strace_entry_t));
+}
+
+/* Returns whether the processor supports `sysenter` and `sysexit`. Early
+ * Pentium Pros claim to, but don't.
+ */
+static bool syscall_sysenter_available() {
+    uint32_t eax, ebx, ecx, edx;
+
+    asm volatile ("cpuid"
+        : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
+        : "a" (1));
+
+    uint32_t family = (eax >> 8) & 0xF;
+    uint32_t model = (eax >> 4) & 0xF;
+    uint32_t stepping = eax & 0xF;
+
+    if (family == 6 && model < 3 && stepping < 3) {
+        return false;
+    }
+
+    return edx & CPUID_FEAT_EDX_SEP;
+}
+
+static void syscall_write_msr(uint32_t msr, uint32_t value) {
+    asm volatile ("wrmsr" :: "c" (msr), "a" (value), "d" (0));
+}
+
+/* Sets up the fast system call path on the calling CPU, if supported.
+ * Userspace picks `sysenter` over `int $0x30` by checking `cpuid` as well.
+ * `sysenter` loads its stack pointer from an MSR that can't follow context
+ * switches cheaply, so we point it to the CPU's TSS, which does.
+ */
+void syscall_init_cpu() {
+    if (!syscall_sysenter_available()) {
+        return;
+    }
+
+    uintptr_t stack = gdt_get_kernel_stack_pointer(smp_cpu_id());
+
+    syscall_write_msr(MSR_SYSENTER_CS, 0x08);
+    syscall_write_msr(MSR_SYSENTER_ESP, stack);
+    syscall_write_msr(MSR_SYSENTER_EIP, (uintptr_t) syscall_sysenter_entry);
+}
+
+/* Adds a call to `num` that took `cycles`, blocking included, to the calling
+ * CPU's statistics.
+ */
+static void syscall_account(uint32_t num, uint64_t cycles) {
+    // System calls run with interrupts off, we can't be moved to another CPU
+    sys_syscall_stats_t* stats = &syscall_stats[smp_current_cpu()->id][num];
+    uint32_t high = cycles >> 32;
+    uint32_t low = cycles;
+    uint32_t bucket = high ? 32 + 31 - __builtin_clz(high) : (low ? 31 - __builtin_clz(low) : 0);
+
+    stats->count++;
+    stats->cycles += cycles;
+    stats->histogram[bucket < SYS_STRACE_BUCKETS ? bucket : SYS_STRACE_BUCKETS - 1]++;
+
+    if (cycles > stats->max_cycles) {
+        stats->max_cycles = cycles;
+    }
+}
+
+/* Appends a call made by a traced process to the strace log.
+ */
+static void syscall_log(uint32_t pid, uint32_t num, uint32_t* args, uint32_t result,
+        uint64_t cycles) {
+    sys_strace_entry_t entry = {
+        .pid = pid,
+        .syscall = num,
+        .args = { args[0], args[1], args[2] },
+        .result = result,
+        .cycles = cycles > 0xFFFFFFFF ? 0xFFFFFFFF : cycles
+    };
+
+    // Entries are all written whole, and the log is a multiple of their size,
+    // so overwriting old ones keeps the next to read aligned
+    spinlock_acquire(&strace_lock);
+    ringbuffer_write(strace_log, sizeof(entry), (uint8_t*) &entry);
+    spinlock_release(&strace_lock);
+}
+
+/* Runs the handler of system call `num` with the arguments in `regs`, timing
+ * it for the statistics and the strace log. `num` must have a handler.
+ */
+static void syscall_dispatch(uint32_t num, registers_t* regs) {
+    process_t* proc = proc_get_current();
+    uint32_t args[3] = { regs->ebx, regs->ecx, regs->edx };
+    bool has_tsc = timer_get_time_info()->tsc_mult;
+    uint64_t start = has_tsc ? rdtsc() : 0;
+
+    TRACE(TRACE_SYSCALL, TRACE_BEGIN, num, regs->ebx);
+
+    regs->eax = 0;
+    syscall_handlers[num](regs);
+
+    TRACE(TRACE_SYSCALL, TRACE_END, num, regs->eax);
+
+    uint64_t cycles = has_tsc ? rdtsc() - start : 0;
+
+    syscall_account(num, cycles);
+
+    if (proc->leader->strace & PROC_STRACE) {
+        syscall_log(proc->pid, num, args, regs->eax, cycles);
+    }
 }
 
-static void syscall_handler(registers_t* regs) {
+/* Dispatches a system call, made either through `int $0x30` or `sysenter`.
+ */
+void syscall_handler(registers_t* regs) {
+    proc_get_current()->syscalls++;
+
     if (regs->eax < SYS_MAX && syscall_handlers[regs->eax]) {
-        handler_t handler = syscall_handlers[regs->eax];
-        regs->eax = 0;
-        handler(regs);
+        syscall_dispatch(regs->eax, regs);
     } else {
         printke("unknown syscall %d", regs->eax);
     }
@@ -144,16 +302,7 @@ static void syscall_wm(registers_t* regs) {
             /* TODO: replace by a combination of cursor events and their
              * handling in the titlebar widget.
              */
-            list_t* item = wm_get_window(regs->ecx);
-
-            if (item != NULL) {
-                wm_window_t* win = list_entry(item, wm_window_t);
-                regs->eax = wm_is_titlebar_being_hovered(win);
-            } else {
-                printke("the given window id (%d) is unknown", regs->ecx);
-                regs->eax = false;
-                break;
-            }
+            regs->eax = wm_is_window_titlebar_hovered(regs->ecx);
         } break;
         default:
             printke("wrong command: %d", cmd);
@@ -176,7 +325,9 @@ static void syscall_info(registers_t* regs) {
     }
 
     if (request & SYS_INFO_UPTIME) {
+        fpu_kernel_begin();
         info->uptime = timer_get_time();
+        fpu_kernel_end();
     }
 
     if (request & SYS_INFO_LOG && info->kernel_log) {
@@ -219,6 +370,34 @@ static void syscall_readdir(registers_t* regs) {
     regs->eax = proc_readdir(fd, d_ent);
 }
 
+/* Lists as many entries of a directory as fit in `buf`, resuming where the
+ * previous listing of that descriptor stopped:
+ *     int32_t syscall_getdents(fd, sos_dirent_t* buf, size, flags);
+ * `flags` can be `GETDENTS_STAT`. Returns the number of bytes written, zero
+ * at the end of the directory, or -1 on error.
+ */
+static void syscall_getdents(registers_t* regs) {
+    sos_dirent_t* buf = (sos_dirent_t*) regs->ecx;
+    uint32_t size = regs->edx;
+    uintptr_t end = (uintptr_t) buf + size;
+
+    if (end < (uintptr_t) buf || end > KERNEL_BASE_VIRT) {
+        regs->eax = -1;
+        return;
+    }
+
+    regs->eax = proc_getdents(regs->ebx, buf, size, regs->esi);
+}
+
+/* Writes cached filesystem changes to disk:
+ *     void syscall_sync();
+ */
+static void syscall_sync(registers_t* regs) {
+    UNUSED(regs);
+
+    fs_sync();
+}
+
 static void syscall_write(registers_t* regs) {
     uint32_t fd = regs->ebx;
     uint8_t* buf = (uint8_t*) regs->ecx;
@@ -227,6 +406,18 @@ static void syscall_write(registers_t* regs) {
     regs->eax = proc_write(fd, buf, size);
 }
 
+/* Writes at an offset, without moving that of the file:
+ *     int pwrite(int fd, const void* buf, size_t size, size_t offset);
+ */
+static void syscall_pwrite(registers_t* regs) {
+    uint32_t fd = regs->ebx;
+    uint8_t* buf = (uint8_t*) regs->ecx;
+    uint32_t size = regs->edx;
+    uint32_t offset = regs->esi;
+
+    regs->eax = proc_pwrite(fd, buf, size, offset);
+}
+
 static void syscall_mkdir(registers_t* regs) {
     const char* path = (const char*) regs->ebx;
     uint32_t mode = regs->ecx;
@@ -258,15 +449,13 @@ static void syscall_getcwd(registers_t* regs) {
     char* buf = (char*) regs->ebx;
     uint32_t size = regs->ecx;
 
-    char* cwd = proc_get_cwd();
+    const char* cwd = proc_get_cwd();
 
     if (strlen(cwd) + 1 > size) {
         regs->eax = (uintptr_t) NULL;
     } else {
         regs->eax = (uintptr_t) strcpy(buf, cwd);
     }
-
-    kfree(cwd);
 }
 
 static void syscall_unlink(registers_t* regs) {
@@ -285,10 +474,9 @@ static void syscall_rename(registers_t* regs) {
 static void syscall_maketty(registers_t* regs) {
     ft_entry_t* entry = zalloc(sizeof(ft_entry_t));
 
-    entry->fd = FS_STDOUT_FILENO;
     entry->inode = pipe_new();
 
-    proc_add_fd(entry);
+    proc_add_fd(FS_STDOUT_FILENO, entry);
 
     regs->eax = 0;
 }
@@ -298,4 +486,287 @@ static void syscall_stat(registers_t* regs) {
     stat_t* buf = (stat_t*) regs->ecx;
 
     regs->eax = fs_stat(path, buf);
-}
\ No newline at end of file
+}
+
+static void syscall_procinfo(registers_t* regs) {
+    sys_proc_info_t* buf = (sys_proc_info_t*) regs->ebx;
+    uint32_t count = regs->ecx;
+
+    regs->eax = proc_get_info(buf, count);
+}
+
+/* Creates a thread in the current process:
+ *     int32_t syscall_clone(entry, stack, arg, tid_addr);
+ */
+static void syscall_clone(registers_t* regs) {
+    regs->eax = proc_clone(regs->ebx, regs->ecx, regs->edx, regs->esi);
+}
+
+/* Waits on or wakes up threads waiting on a user address:
+ *     int32_t syscall_futex(op, uaddr, val);
+ */
+static void syscall_futex(registers_t* regs) {
+    uint32_t op = regs->ebx;
+    uint32_t* uaddr = (uint32_t*) regs->ecx;
+    uint32_t val = regs->edx;
+
+    if ((uintptr_t) uaddr >= KERNEL_BASE_VIRT || (uintptr_t) uaddr % 4) {
+        regs->eax = -1;
+        return;
+    }
+
+    switch (op) {
+    case SYS_FUTEX_WAIT:
+        regs->eax = futex_wait(uaddr, val);
+        break;
+    case SYS_FUTEX_WAKE:
+        regs->eax = futex_wake(uaddr, val);
+        break;
+    default:
+        regs->eax = -1;
+        break;
+    }
+}
+
+/* Returns the id of the calling thread. Cheap enough to measure the cost of
+ * system calls themselves.
+ */
+static void syscall_getpid(registers_t* regs) {
+    regs->eax = proc_get_current_pid();
+}
+
+/* Duplicates a file descriptor:
+ *     int32_t syscall_dup(fd);
+ */
+static void syscall_dup(registers_t* regs) {
+    regs->eax = proc_dup(regs->ebx);
+}
+
+/* Duplicates a file descriptor to a given one, closing it first if needed:
+ *     int32_t syscall_dup2(fd, new_fd);
+ */
+static void syscall_dup2(registers_t* regs) {
+    regs->eax = proc_dup2(regs->ebx, regs->ecx);
+}
+
+/* Returns whether `sqe` is a system call rings can submit.
+ */
+static bool syscall_ring_allowed(sys_ring_sqe_t* sqe) {
+    switch (sqe->syscall) {
+    case SYS_READ:
+    case SYS_WRITE:
+    case SYS_READDIR:
+    case SYS_STAT:
+    case SYS_OPEN:
+    case SYS_CLOSE:
+        return true;
+    case SYS_WM:
+        return sqe->args[0] == WM_CMD_RENDER || sqe->args[0] == WM_CMD_EVENT;
+    default:
+        return false;
+    }
+}
+
+/* Runs the system calls queued in a ring, in order, posting a completion for
+ * each; stops early if the completion ring fills up. Calls complete before
+ * this returns, so the process reaps them without entering the kernel again:
+ *     int32_t syscall_ring_enter(ring);
+ * Returns the number of submissions consumed, or -1 if the ring is invalid.
+ */
+static void syscall_ring_enter(registers_t* regs) {
+    sys_ring_t* ring = (sys_ring_t*) regs->ebx;
+    uintptr_t end = (uintptr_t) ring + sizeof(sys_ring_t);
+
+    if (end < (uintptr_t) ring || end > KERNEL_BASE_VIRT) {
+        regs->eax = -1;
+        return;
+    }
+
+    // Read once: the process may change them under our feet
+    uint32_t size = ring->size;
+    sys_ring_sqe_t* sqes = ring->sqes;
+    sys_ring_cqe_t* cqes = ring->cqes;
+    uintptr_t sqes_end = (uintptr_t) sqes + size * sizeof(sys_ring_sqe_t);
+    uintptr_t cqes_end = (uintptr_t) cqes + size * sizeof(sys_ring_cqe_t);
+
+    if (!size || size > SYS_RING_MAX_SIZE || (size & (size - 1)) ||
+            sqes_end < (uintptr_t) sqes || sqes_end > KERNEL_BASE_VIRT ||
+            cqes_end < (uintptr_t) cqes || cqes_end > KERNEL_BASE_VIRT) {
+        regs->eax = -1;
+        return;
+    }
+
+    uint32_t sq_head = ring->sq_head;
+    uint32_t sq_tail = ring->sq_tail;
+    uint32_t cq_tail = ring->cq_tail;
+    uint32_t count = 0;
+
+    while (sq_head != sq_tail && cq_tail - ring->cq_head < size) {
+        sys_ring_sqe_t sqe = sqes[sq_head % size];
+        registers_t call = {
+            .eax = 0,
+            .ebx = sqe.args[0],
+            .ecx = sqe.args[1],
+            .edx = sqe.args[2]
+        };
+
+        // Accounted and logged like calls made one at a time
+        if (syscall_ring_allowed(&sqe)) {
+            proc_get_current()->syscalls++;
+            syscall_dispatch(sqe.syscall, &call);
+        } else {
+            call.eax = -1;
+        }
+
+        cqes[cq_tail % size] = (sys_ring_cqe_t) {
+            .user_data = sqe.user_data,
+            .result = call.eax
+        };
+
+        sq_head++;
+        cq_tail++;
+        count++;
+
+        // Publish as we go, a submission may block on the window manager
+        ring->sq_head = sq_head;
+        ring->cq_tail = cq_tail;
+    }
+
+    regs->eax = count;
+}
+
+/* Controls the kernel tracer:
+ *     uint32_t syscall_trace(SYS_TRACE_SET_MASK, mask);
+ * enables the categories of events in `mask` and returns the previous mask,
+ *     syscall_trace(SYS_TRACE_DUMP);
+ * writes the recorded events to the serial port, see `trace.c`.
+ */
+static void syscall_trace(registers_t* regs) {
+    switch (regs->ebx) {
+    case SYS_TRACE_SET_MASK:
+        regs->eax = trace_set_mask(regs->ecx);
+        break;
+    case SYS_TRACE_DUMP:
+        trace_dump();
+        break;
+    default:
+        regs->eax = -1;
+        break;
+    }
+}
+
+/* Controls the sampling profiler:
+ *     syscall_profile(SYS_PROFILE_START, flags);
+ * clears the samples and starts sampling, walking stacks if `flags` has
+ * `SYS_PROFILE_STACKS`,
+ *     syscall_profile(SYS_PROFILE_STOP);
+ *     syscall_profile(SYS_PROFILE_DUMP);
+ * writes the samples to the serial port, see `profile.c`.
+ */
+static void syscall_profile(registers_t* regs) {
+    switch (regs->ebx) {
+    case SYS_PROFILE_START:
+        profile_start(regs->ecx & SYS_PROFILE_STACKS);
+        break;
+    case SYS_PROFILE_STOP:
+        profile_stop();
+        break;
+    case SYS_PROFILE_DUMP:
+        profile_dump();
+        break;
+    default:
+        regs->eax = -1;
+        break;
+    }
+}
+
+/* Gives access to system call statistics and to the strace log:
+ *     uint32_t syscall_strace(SYS_STRACE_STATS, sys_syscall_stats_t* buf, count);
+ * fills `buf` with the statistics of at most `count` system calls, indexed
+ * by number, and returns `SYS_MAX`,
+ *     syscall_strace(SYS_STRACE_RESET);
+ *     int32_t syscall_strace(SYS_STRACE_ATTACH or SYS_STRACE_DETACH, pid);
+ * starts or stops logging the system calls of process `pid`,
+ *     syscall_strace(SYS_STRACE_CHILDREN, enabled);
+ * does the same for the processes the caller starts with `exec` from now on,
+ *     uint32_t syscall_strace(SYS_STRACE_READ, sys_strace_entry_t* buf, count);
+ * moves at most `count` logged calls to `buf` and returns how many,
+ *     uint32_t syscall_strace(SYS_STRACE_TRACED);
+ * returns the number of processes being traced.
+ */
+static void syscall_strace(registers_t* regs) {
+    process_t* leader = proc_get_current()->leader;
+    uint32_t count = regs->edx;
+
+    switch (regs->ebx) {
+    case SYS_STRACE_STATS: {
+        sys_syscall_stats_t* buf = (sys_syscall_stats_t*) regs->ecx;
+
+        for (uint32_t num = 0; num < SYS_MAX && num < count; num++) {
+            sys_syscall_stats_t total = { 0 };
+
+            for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+                sys_syscall_stats_t* stats = &syscall_stats[cpu][num];
+
+                total.count += stats->count;
+                total.cycles += stats->cycles;
+
+                if (stats->max_cycles > total.max_cycles) {
+                    total.max_cycles = stats->max_cycles;
+                }
+
+                for (uint32_t i = 0; i < SYS_STRACE_BUCKETS; i++) {
+                    total.histogram[i] += stats->histogram[i];
+                }
+            }
+
+            buf[num] = total;
+        }
+
+        regs->eax = SYS_MAX;
+        break;
+    }
+    case SYS_STRACE_RESET:
+        memset(syscall_stats, 0, sizeof(syscall_stats));
+        break;
+    case SYS_STRACE_ATTACH:
+    case SYS_STRACE_DETACH:
+        regs->eax = proc_set_strace(regs->ecx, regs->ebx == SYS_STRACE_ATTACH) ? 0 : -1;
+        break;
+    case SYS_STRACE_CHILDREN:
+        if (regs->ecx) {
+            leader->strace |= PROC_STRACE_CHILDREN;
+        } else {
+            leader->strace &= ~PROC_STRACE_CHILDREN;
+        }
+
+        break;
+    case SYS_STRACE_READ: {
+        sys_strace_entry_t* buf = (sys_strace_entry_t*) regs->ecx;
+        sys_strace_entry_t entry;
+        uint32_t n = 0;
+
+        // Entries go through the stack: writing to `buf` may fault
+        while (n < count) {
+            spinlock_acquire(&strace_lock);
+            uint32_t read = ringbuffer_read(strace_log, sizeof(entry), (uint8_t*) &entry);
+            spinlock_release(&strace_lock);
+
+            if (!read) {
+                break;
+            }
+
+            buf[n++] = entry;
+        }
+
+        regs->eax = n;
+        break;
+    }
+    case SYS_STRACE_TRACED:
+        regs->eax = proc_count_traced();
+        break;
+    default:
+        regs->eax = -1;
+        break;
+    }
+}
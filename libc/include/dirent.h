@@ -5,22 +5,31 @@
 
 #include <kernel/uapi/uapi_fs.h>
 
+#define DIR_BUFFER_SIZE 2048
+
 typedef uint32_t ino_t;
 
 typedef struct {
     int32_t fd;
     char name[MAX_PATH];
     FILE* stream;
+    uint32_t flags; // Passed to `SYS_GETDENTS`
+    uint32_t pos; // Offset of the next entry in `buf`
+    uint32_t len; // Bytes of entries in `buf`
+    uint8_t buf[DIR_BUFFER_SIZE] __attribute__((aligned(4)));
 } DIR;
 
 struct dirent {
     ino_t d_ino;
     char d_name[MAX_PATH];
     uint32_t d_type;
+    uint32_t d_size; // Only filled in for directories opened with `opendir_stat`
+    uint32_t d_mode; // Same
 };
 
 #ifndef _KERNEL_
 DIR* opendir(const char* path);
+DIR* opendir_stat(const char* path);
 struct dirent* readdir(DIR* dir);
 int closedir(DIR* dir);
 #endif
\ No newline at end of file
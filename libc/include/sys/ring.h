@@ -0,0 +1,19 @@
+#pragma once
+
+#include <kernel/uapi/uapi_syscall.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Batched system calls: queue several with `ring_push`, run them all with a
+ * single `ring_submit`, then read their results with `ring_pop`.
+ */
+
+#ifndef _KERNEL_
+sys_ring_t* ring_new(uint32_t size);
+void ring_free(sys_ring_t* ring);
+bool ring_push(sys_ring_t* ring, uint32_t syscall, uint32_t arg0, uint32_t arg1,
+    uint32_t arg2, uint32_t user_data);
+int32_t ring_submit(sys_ring_t* ring);
+bool ring_pop(sys_ring_t* ring, sys_ring_cqe_t* cqe);
+#endif
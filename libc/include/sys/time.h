@@ -1 +1,12 @@
-#pragma once
\ No newline at end of file
+#pragma once
+
+#include <time.h>
+
+struct timeval {
+    time_t tv_sec;
+    int32_t tv_usec;
+};
+
+#ifndef _KERNEL_
+int gettimeofday(struct timeval* tv, void* tz);
+#endif
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdint.h>
+
+#define THREAD_STACK_SIZE 0x4000
+
+/* A thread of the current process, sharing its memory and files.
+ */
+typedef struct {
+    volatile uint32_t tid; // Cleared by the kernel when the thread exits
+    void* (*func)(void*);
+    void* arg;
+    void* ret;
+    uint8_t* stack;
+} thread_t;
+
+/* States: 0 when unlocked, 1 when locked, 2 when locked with waiters.
+ */
+typedef struct {
+    volatile uint32_t state;
+} mutex_t;
+
+typedef struct {
+    volatile uint32_t seq;
+} cond_t;
+
+#define MUTEX_INIT { 0 }
+#define COND_INIT { 0 }
+
+#ifndef _KERNEL_
+int32_t thread_create(thread_t* thread, void* (*func)(void*), void* arg);
+void* thread_join(thread_t* thread);
+void thread_exit();
+
+void mutex_lock(mutex_t* mutex);
+void mutex_unlock(mutex_t* mutex);
+
+void cond_wait(cond_t* cond, mutex_t* mutex);
+void cond_signal(cond_t* cond);
+void cond_broadcast(cond_t* cond);
+#endif
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdint.h>
+
+typedef int32_t time_t;
+typedef uint32_t clockid_t;
+
+struct timespec {
+    time_t tv_sec;
+    int32_t tv_nsec;
+};
+
+// There is no wall clock: both clocks count from boot
+#define CLOCK_REALTIME 0
+#define CLOCK_MONOTONIC 1
+
+#ifndef _KERNEL_
+int clock_gettime(clockid_t clock, struct timespec* ts);
+#endif
@@ -11,5 +11,9 @@
 int chdir(const char* path);
 char* getcwd(char* buf, size_t size);
 int unlink(const char* path);
+int dup(int fd);
+int dup2(int fd, int new_fd);
+void sync();
+int pwrite(int fd, const void* buf, size_t size, size_t offset);
 
 #endif
\ No newline at end of file
@@ -8,8 +8,7 @@
 #include <string.h>
 #include <stdio.h>
 
-extern int32_t syscall1(uint32_t eax, uint32_t ebx);
-extern int32_t syscall2(uint32_t eax, uint32_t ebx, uint32_t ecx);
+extern int32_t syscall4(uint32_t eax, uint32_t ebx, uint32_t ecx, uint32_t edx, uint32_t esi);
 
 /* Opens the directory pointed to by `path` and returns a directory handle.
  * This handle can later be freed by calling `closedir`.
@@ -33,32 +32,52 @@ DIR* opendir(const char* path) {
 
     strcpy(dir->name, path);
     dir->fd = dir->stream->fd;
+    dir->flags = 0;
+    dir->pos = 0;
+    dir->len = 0;
+
+    return dir;
+}
+
+/* Same as `opendir`, but entries also come with their size and mode, which
+ * saves a `stat` per entry.
+ */
+DIR* opendir_stat(const char* path) {
+    DIR* dir = opendir(path);
+
+    if (dir) {
+        dir->flags = GETDENTS_STAT;
+    }
 
     return dir;
 }
 
 /* Returns the next entry in the given directory stream.
  * Returns NULL when no more entries are present.
+ * Entries are fetched from the kernel as many at a time as `buf` holds.
  */
 struct dirent* readdir(DIR* dir) {
-    uint32_t ent_size = sizeof(sos_directory_entry_t) + MAX_PATH;
-    sos_directory_entry_t* dir_entry = malloc(ent_size);
-    dir_entry->entry_size = ent_size;
-
-    uint32_t read = syscall2(SYS_READDIR, dir->fd, (uintptr_t) dir_entry);
+    if (dir->pos >= dir->len) {
+        int32_t read = syscall4(SYS_GETDENTS, dir->fd, (uintptr_t) dir->buf,
+            DIR_BUFFER_SIZE, dir->flags);
 
-    if (!read) {
-        free(dir_entry);
+        if (read <= 0) {
+            return NULL;
+        }
 
-        return NULL;
+        dir->pos = 0;
+        dir->len = read;
     }
 
+    sos_dirent_t* dir_entry = (sos_dirent_t*) &dir->buf[dir->pos];
+    dir->pos += dir_entry->entry_size;
+
     struct dirent* d_ent = zalloc(sizeof(struct dirent));
     d_ent->d_ino = dir_entry->inode;
     strcpy(d_ent->d_name, dir_entry->name);
     d_ent->d_type = dir_entry->type;
-
-    free(dir_entry);
+    d_ent->d_size = dir_entry->size;
+    d_ent->d_mode = dir_entry->mode;
 
     return d_ent;
 }
@@ -71,7 +90,6 @@ int closedir(DIR* dir) {
     }
 
     fclose(dir->stream);
-    free(dir->name);
     free(dir);
 
     return 0;
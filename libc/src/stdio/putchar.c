@@ -3,6 +3,10 @@
 #ifdef _KERNEL_
 #include <kernel/term.h>
 #include <kernel/serial.h>
+#include <kernel/spinlock.h>
+
+// CPUs print concurrently, the terminal and serial log can't handle that
+static spinlock_t console_lock = SPINLOCK_INIT;
 #else
 #include <kernel/uapi/uapi_syscall.h>
 #endif
@@ -12,8 +16,10 @@ extern int32_t syscall1(uint32_t eax, uint32_t ebx);
 /* Nothing to do with libc's putchar; this writes to serial output */
 int putchar(int c) {
 #ifdef _KERNEL_
+    spinlock_acquire(&console_lock);
     serial_write(c);
     term_putchar(c);
+    spinlock_release(&console_lock);
 #else
     syscall1(SYS_PUTCHAR, c);
 #endif
@@ -6,6 +6,7 @@
 #ifdef _KERNEL_
 #include <kernel/paging.h>
 #include <kernel/pmm.h>
+#include <kernel/spinlock.h>
 #include <kernel/sys.h>
 #endif
 
@@ -21,6 +22,20 @@ static mem_block_t* bottom = NULL;
 static mem_block_t* top = NULL;
 static uint32_t used_memory = 0;
 
+#ifdef _KERNEL_
+// The kernel heap is shared by every CPU
+static spinlock_t heap_lock = SPINLOCK_INIT;
+#define HEAP_LOCK() spinlock_acquire(&heap_lock)
+#define HEAP_UNLOCK() spinlock_release(&heap_lock)
+#else
+#include <thread.h>
+
+// Threads of a process share its heap
+static mutex_t heap_lock = MUTEX_INIT;
+#define HEAP_LOCK() mutex_lock(&heap_lock)
+#define HEAP_UNLOCK() mutex_unlock(&heap_lock)
+#endif
+
 #ifndef _KERNEL_
 
 /* Returns the next multiple of `s` greater than `a`, or `a` if it is a
@@ -195,9 +210,13 @@ void free(void* pointer) {
         return;
     }
 
+    HEAP_LOCK();
+
     mem_block_t* block = mem_get_block(pointer);
     block->size &= ~1;
     used_memory -= block->size;
+
+    HEAP_UNLOCK();
 }
 
 /* Returns `size` bytes of memory at an address multiple of `align`.
@@ -206,6 +225,8 @@ void* aligned_alloc(size_t align, size_t size) {
     const uint32_t header_size = offsetof(mem_block_t, data);
     size = align_to(size, 8);
 
+    HEAP_LOCK();
+
     // If this is the first allocation, setup the block list:
     // it starts with an empty, used block, in order to avoid edge cases.
     if (!top) {
@@ -228,6 +249,8 @@ void* aligned_alloc(size_t align, size_t size) {
         used_memory += block->size;
         block->size |= 1;
 
+        HEAP_UNLOCK();
+
         return block->data;
     } else {
         // We'll have to allocate a new block, so we check if we haven't
@@ -247,6 +270,8 @@ void* aligned_alloc(size_t align, size_t size) {
             if (sbrk(end - brk) == (void*) -1) {
                 printf("[mem] Allocation failure\n");
 
+                HEAP_UNLOCK();
+
                 return NULL;
             }
         }
@@ -257,6 +282,8 @@ void* aligned_alloc(size_t align, size_t size) {
 
     used_memory += size;
 
+    HEAP_UNLOCK();
+
     return block->data;
 }
 
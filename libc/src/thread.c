@@ -0,0 +1,135 @@
+#ifndef _KERNEL_
+
+#include <kernel/uapi/uapi_syscall.h>
+
+#include <thread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+extern int32_t syscall1(uint32_t eax, uint32_t ebx);
+extern int32_t syscall3(uint32_t eax, uint32_t ebx, uint32_t ecx, uint32_t edx);
+
+static int32_t futex_wait(volatile uint32_t* addr, uint32_t val) {
+    return syscall3(SYS_FUTEX, SYS_FUTEX_WAIT, (uintptr_t) addr, val);
+}
+
+static int32_t futex_wake(volatile uint32_t* addr, uint32_t count) {
+    return syscall3(SYS_FUTEX, SYS_FUTEX_WAKE, (uintptr_t) addr, count);
+}
+
+static int32_t clone(void (*entry)(thread_t*), uintptr_t stack, thread_t* arg,
+        volatile uint32_t* tid_addr) {
+    int32_t tid;
+
+    asm volatile (
+        "int $0x30\n"
+        : "=a" (tid)
+        : "a" (SYS_CLONE), "b" (entry), "c" (stack), "d" (arg), "S" (tid_addr)
+        : "memory"
+    );
+
+    return tid;
+}
+
+/* Entry point of every thread, as the kernel can't return to userspace.
+ */
+static void thread_start(thread_t* thread) {
+    thread->ret = thread->func(thread->arg);
+    thread_exit();
+}
+
+/* Starts a thread running `func(arg)`. `thread` must stay valid until the
+ * thread is joined.
+ * Returns the id of the thread, or -1 on error.
+ */
+int32_t thread_create(thread_t* thread, void* (*func)(void*), void* arg) {
+    thread->func = func;
+    thread->arg = arg;
+    thread->ret = NULL;
+    thread->stack = malloc(THREAD_STACK_SIZE);
+
+    if (!thread->stack) {
+        return -1;
+    }
+
+    uintptr_t stack_top = (uintptr_t) thread->stack + THREAD_STACK_SIZE;
+    int32_t tid = clone(thread_start, stack_top, thread, &thread->tid);
+
+    if (tid < 0) {
+        free(thread->stack);
+    }
+
+    return tid;
+}
+
+/* Waits for `thread` to exit, frees its stack and returns the value its
+ * function returned.
+ */
+void* thread_join(thread_t* thread) {
+    uint32_t tid;
+
+    while ((tid = thread->tid)) {
+        futex_wait(&thread->tid, tid);
+    }
+
+    free(thread->stack);
+
+    return thread->ret;
+}
+
+/* Terminates the calling thread. The process goes on until its last thread
+ * exits.
+ */
+void thread_exit() {
+    syscall1(SYS_EXIT, 0);
+    __builtin_unreachable();
+}
+
+void mutex_lock(mutex_t* mutex) {
+    uint32_t state = 0;
+
+    // Uncontended case: no system call
+    if (__atomic_compare_exchange_n(&mutex->state, &state, 1, false,
+            __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return;
+    }
+
+    // Let the owner know it has to wake us up
+    if (state != 2) {
+        state = __atomic_exchange_n(&mutex->state, 2, __ATOMIC_ACQUIRE);
+    }
+
+    while (state != 0) {
+        futex_wait(&mutex->state, 2);
+        state = __atomic_exchange_n(&mutex->state, 2, __ATOMIC_ACQUIRE);
+    }
+}
+
+void mutex_unlock(mutex_t* mutex) {
+    if (__atomic_exchange_n(&mutex->state, 0, __ATOMIC_RELEASE) == 2) {
+        futex_wake(&mutex->state, 1);
+    }
+}
+
+/* Unlocks `mutex` and waits for the condition to be signaled, then locks
+ * `mutex` again. Wakeups can be spurious.
+ */
+void cond_wait(cond_t* cond, mutex_t* mutex) {
+    uint32_t seq = cond->seq;
+
+    mutex_unlock(mutex);
+    futex_wait(&cond->seq, seq);
+    mutex_lock(mutex);
+}
+
+void cond_signal(cond_t* cond) {
+    __atomic_fetch_add(&cond->seq, 1, __ATOMIC_RELEASE);
+    futex_wake(&cond->seq, 1);
+}
+
+void cond_broadcast(cond_t* cond) {
+    __atomic_fetch_add(&cond->seq, 1, __ATOMIC_RELEASE);
+    futex_wake(&cond->seq, UINT32_MAX);
+}
+
+#endif
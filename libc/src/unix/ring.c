@@ -0,0 +1,75 @@
+#ifndef _KERNEL_
+
+#include <sys/ring.h>
+
+#include <stdlib.h>
+
+extern int32_t syscall1(uint32_t eax, uint32_t ebx);
+
+/* Allocates a ring of `size` entries, a power of two.
+ * Returns NULL on error.
+ */
+sys_ring_t* ring_new(uint32_t size) {
+    if (!size || size > SYS_RING_MAX_SIZE || (size & (size - 1))) {
+        return NULL;
+    }
+
+    sys_ring_t* ring = zalloc(sizeof(sys_ring_t));
+
+    ring->size = size;
+    ring->sqes = malloc(size * sizeof(sys_ring_sqe_t));
+    ring->cqes = malloc(size * sizeof(sys_ring_cqe_t));
+
+    return ring;
+}
+
+void ring_free(sys_ring_t* ring) {
+    free(ring->sqes);
+    free(ring->cqes);
+    free(ring);
+}
+
+/* Queues a system call, to run on the next `ring_submit`. Returns false if the
+ * ring is full, in which case submitting and reaping makes room.
+ */
+bool ring_push(sys_ring_t* ring, uint32_t syscall, uint32_t arg0, uint32_t arg1,
+        uint32_t arg2, uint32_t user_data) {
+    // Completions need room too, as the kernel won't overwrite unreaped ones
+    uint32_t pending = ring->sq_tail - ring->sq_head;
+
+    if (pending + (ring->cq_tail - ring->cq_head) >= ring->size) {
+        return false;
+    }
+
+    ring->sqes[ring->sq_tail % ring->size] = (sys_ring_sqe_t) {
+        .syscall = syscall,
+        .args = { arg0, arg1, arg2 },
+        .user_data = user_data
+    };
+
+    ring->sq_tail++;
+
+    return true;
+}
+
+/* Runs the queued system calls. Returns how many ran, or -1 on error.
+ */
+int32_t ring_submit(sys_ring_t* ring) {
+    return syscall1(SYS_RING_ENTER, (uintptr_t) ring);
+}
+
+/* Takes the oldest completion, without entering the kernel. Returns false if
+ * there is none.
+ */
+bool ring_pop(sys_ring_t* ring, sys_ring_cqe_t* cqe) {
+    if (ring->cq_head == ring->cq_tail) {
+        return false;
+    }
+
+    *cqe = ring->cqes[ring->cq_head % ring->size];
+    ring->cq_head++;
+
+    return true;
+}
+
+#endif
@@ -6,8 +6,10 @@
 #include <kernel/uapi/uapi_syscall.h>
 #include <kernel/uapi/uapi_fs.h>
 
+extern int32_t syscall(uint32_t eax);
 extern int32_t syscall1(uint32_t eax, uint32_t ebx);
 extern int32_t syscall2(uint32_t eax, uint32_t ebx, uint32_t ecx);
+extern int32_t syscall4(uint32_t eax, uint32_t ebx, uint32_t ecx, uint32_t edx, uint32_t esi);
 
 int mkdir(const char* pathname, mode_t mode) {
     uint32_t inode = syscall2(SYS_MKDIR, (uintptr_t) pathname, mode);
@@ -31,6 +33,22 @@ int unlink(const char* path) {
     return syscall1(SYS_UNLINK, (uintptr_t) path);
 }
 
+int dup(int fd) {
+    return syscall1(SYS_DUP, fd);
+}
+
+int dup2(int fd, int new_fd) {
+    return syscall2(SYS_DUP2, fd, new_fd);
+}
+
+void sync() {
+    syscall(SYS_SYNC);
+}
+
+int pwrite(int fd, const void* buf, size_t size, size_t offset) {
+    return syscall4(SYS_PWRITE, fd, (uintptr_t) buf, size, offset);
+}
+
 int stat(const char* path, struct stat* buf) {
     stat_t statbuf;
     int ret = syscall2(SYS_STAT, (uintptr_t) path, (uintptr_t) &statbuf);
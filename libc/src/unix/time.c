@@ -0,0 +1,60 @@
+#ifndef _KERNEL_
+
+#include <sys/time.h>
+#include <time.h>
+
+#include <kernel/uapi/uapi_time.h>
+
+#include <stddef.h>
+
+static inline uint64_t rdtsc() {
+    uint32_t low, high;
+
+    asm volatile ("rdtsc" : "=a" (low), "=d" (high));
+
+    return ((uint64_t) high << 32) | low;
+}
+
+/* Returns the number of nanoseconds since boot, read from the time page
+ * without entering the kernel.
+ */
+static uint64_t time_page_ns() {
+    const sys_time_page_t* page = (const sys_time_page_t*) TIME_PAGE_ADDR;
+
+    if (!page->tsc_mult) {
+        return (uint64_t) page->ticks * (1000000000 / page->tick_freq);
+    }
+
+    // A 64x32 bits multiplication, keeping the bits we need from the product
+    uint64_t delta = rdtsc() - page->tsc_base;
+    uint64_t low = (delta & 0xFFFFFFFF) * page->tsc_mult;
+    uint64_t high = (delta >> 32) * page->tsc_mult;
+
+    return (high << (32 - page->tsc_shift)) + (low >> page->tsc_shift);
+}
+
+int clock_gettime(clockid_t clock, struct timespec* ts) {
+    if (clock != CLOCK_REALTIME && clock != CLOCK_MONOTONIC) {
+        return -1;
+    }
+
+    uint64_t ns = time_page_ns();
+
+    ts->tv_sec = ns / 1000000000;
+    ts->tv_nsec = ns % 1000000000;
+
+    return 0;
+}
+
+int gettimeofday(struct timeval* tv, void* tz) {
+    (void) tz;
+
+    uint64_t us = time_page_ns() / 1000;
+
+    tv->tv_sec = us / 1000000;
+    tv->tv_usec = us % 1000000;
+
+    return 0;
+}
+
+#endif
@@ -0,0 +1,9 @@
+#!/usr/bin/bash
+
+# Extracts the symbols of the linker map "$1" to "$2", as "address name" lines
+# sorted by address, see `stacktrace.c`. Linkers print addresses with 8 or 16
+# digits depending on the host, only the low 32 bits are kept.
+awk '$1 ~ /^0x[0-9a-f]+$/ && (length($1) == 10 || length($1) == 18) &&
+        $2 ~ /^[^0-9]/ && $3 != "=" && $2 != "PROVIDE" {
+    print substr($1, length($1) - 7), $2
+}' "$1" | sort > "$2"
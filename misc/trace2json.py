@@ -0,0 +1,120 @@
+#!/usr/bin/env python3
+
+# Converts kernel trace dumps, as written to the serial port by `trace dump`,
+# to the Chrome trace event format, for chrome://tracing or Perfetto:
+#     ./misc/trace2json.py serial.log > trace.json
+# Only the last dump of the log is converted.
+
+import json
+import re
+import sys
+
+IRQ, SYSCALL, SWITCH, FAULT, RENDER, BLOCK = (1 << i for i in range(6))
+PHASES = ["B", "E", "i"]
+
+
+def syscall_names(path):
+    names = {}
+
+    try:
+        with open(path) as f:
+            for line in f:
+                m = re.match(r"#define SYS_([A-Z_]+) (\d+)", line)
+
+                if m and m.group(1) != "MAX" and not m.group(1).startswith(("INFO_", "FUTEX_", "TRACE_", "RING_MAX")):
+                    names[int(m.group(2))] = m.group(1).lower()
+    except OSError:
+        pass
+
+    return names
+
+
+def event_name(category, args, syscalls):
+    if category == IRQ:
+        return f"irq {args[0]}"
+    elif category == SYSCALL:
+        return syscalls.get(args[0], f"syscall {args[0]}")
+    elif category == SWITCH:
+        return f"switch {args[0]} -> {args[1]}"
+    elif category == FAULT:
+        return "page fault"
+    elif category == RENDER:
+        return f"render window {args[0]}"
+    elif category == BLOCK:
+        return f"block {'write' if args[1] else 'read'}"
+
+    return f"category {category}"
+
+
+def event_args(category, phase, args):
+    if category == SYSCALL:
+        return {"arg": args[1]} if phase == 0 else {"result": args[1] - (1 << 32) * (args[1] >> 31)}
+    elif category == FAULT:
+        return {"address": hex(args[0]), "error" if phase == 0 else "handled": args[1]}
+    elif category == BLOCK:
+        return {"block": args[0]}
+
+    return {}
+
+
+def main():
+    if len(sys.argv) < 2:
+        print(f"usage: {sys.argv[0]} serial.log [uapi_syscall.h]", file=sys.stderr)
+        sys.exit(1)
+
+    header = sys.argv[2] if len(sys.argv) > 2 else "kernel/include/kernel/uapi/uapi_syscall.h"
+    syscalls = syscall_names(header)
+    lines = open(sys.argv[1], errors="replace").read().splitlines()
+    begins = [i for i, l in enumerate(lines) if l.startswith("trace: begin")]
+
+    if not begins:
+        print("no trace found", file=sys.stderr)
+        sys.exit(1)
+
+    start = begins[-1]
+    base, mult, shift = (int(x, 16) for x in lines[start].split()[2:5])
+    events = []
+
+    for line in lines[start + 1:]:
+        if line.startswith("trace: end"):
+            lost = int(line.split()[2], 16)
+
+            if lost:
+                print(f"{lost} events were overwritten", file=sys.stderr)
+
+            break
+
+        fields = line.split()
+
+        if len(fields) != 7:
+            continue
+
+        tsc, cpu, pid, category, phase, arg0, arg1 = (int(x, 16) for x in fields)
+        args = [arg0, arg1]
+
+        # Without a calibrated time stamp counter, cycles stand for nanoseconds
+        ns = ((tsc - base) * mult) >> shift if mult else tsc - base
+        event = {
+            "name": event_name(category, args, syscalls),
+            "ph": PHASES[phase],
+            "ts": ns / 1000,
+            "pid": 0,
+            "tid": pid,
+            "args": dict(event_args(category, phase, args), cpu=cpu),
+        }
+
+        if phase == 2:
+            event["s"] = "g" if category == SWITCH else "t"
+
+        events.append(event)
+
+    # Name rows after the processes they show, the kernel being pid 0
+    for tid in sorted({e["tid"] for e in events}):
+        name = "kernel" if tid == 0 else f"pid {tid}"
+        events.append({"name": "thread_name", "ph": "M", "pid": 0, "tid": tid, "args": {"name": name}})
+
+    json.dump({"traceEvents": events, "displayTimeUnit": "ns"}, sys.stdout)
+
+
+if __name__ == "__main__":
+    main()
@@ -3,6 +3,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <time.h>
 
 int main() {
     fb_t scr;
@@ -35,10 +36,10 @@ int main() {
             syscall2(SYS_EXEC, (uintptr_t) "terminal", (uintptr_t) NULL);
         }
 
-        sys_info_t info;
-        syscall2(SYS_INFO, SYS_INFO_UPTIME, (uintptr_t) &info);
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
 
-        uint32_t time = info.uptime;
+        uint32_t time = ts.tv_sec;
         uint32_t m = time / 60;
         uint32_t s = time % 60;
         itoa(m, time_text+8, 10);
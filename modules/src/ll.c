@@ -2,7 +2,6 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/stat.h>
 #include <unistd.h>
 
 #define STATR 4
@@ -25,9 +24,8 @@ int main(int argc, char* argv[]) {
         getcwd(dir, MAX_PATH);
     }
 
-    DIR* d = opendir(dir);
+    DIR* d = opendir_stat(dir);
     struct dirent* dent = NULL;
-    struct stat statent;
     char sec[11] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
 
     if (!d) {
@@ -38,20 +36,19 @@ int main(int argc, char* argv[]) {
     printf("\n");
 
     while ((dent = readdir(d))) {
-        stat(dent->d_name, &statent);
         sec[0] = dent->d_type == 2 ? 'd' : '-';
-        sec[1] = statent.st_mode & (STATR << 6) ? 'r' : '-';
-        sec[4] = statent.st_mode & (STATR << 3) ? 'r' : '-';
-        sec[7] = statent.st_mode & STATR ? 'r' : '-';
-        sec[2] = statent.st_mode & (STATW << 6) ? 'w' : '-';
-        sec[5] = statent.st_mode & (STATW << 3) ? 'w' : '-';
-        sec[8] = statent.st_mode & STATW ? 'w' : '-';
-        sec[3] = statent.st_mode & (STATX << 6) ? 'x' : '-';
-        sec[6] = statent.st_mode & (STATX << 3) ? 'x' : '-';
-        sec[9] = statent.st_mode & STATX ? 'x' : '-';
+        sec[1] = dent->d_mode & (STATR << 6) ? 'r' : '-';
+        sec[4] = dent->d_mode & (STATR << 3) ? 'r' : '-';
+        sec[7] = dent->d_mode & STATR ? 'r' : '-';
+        sec[2] = dent->d_mode & (STATW << 6) ? 'w' : '-';
+        sec[5] = dent->d_mode & (STATW << 3) ? 'w' : '-';
+        sec[8] = dent->d_mode & STATW ? 'w' : '-';
+        sec[3] = dent->d_mode & (STATX << 6) ? 'x' : '-';
+        sec[6] = dent->d_mode & (STATX << 3) ? 'x' : '-';
+        sec[9] = dent->d_mode & STATX ? 'x' : '-';
         sec[10] = 0;
 
-        printf("%-11s %-16s %10u\n", sec, dent->d_name, statent.st_size);
+        printf("%-11s %-16s %10u\n", sec, dent->d_name, dent->d_size);
         free(dent);
     }
 
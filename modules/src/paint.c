@@ -166,7 +166,9 @@ void save() {
         }
     }
 
-    fwrite(buf, 3, r.w*r.h, fd);
+    // From the start, so that saving again replaces the drawing: files opened
+    // for writing are appended to
+    pwrite(fd->fd, buf, 3*r.w*r.h, 0);
     free(buf);
     fclose(fd);
 }
\ No newline at end of file
@@ -0,0 +1,34 @@
+#include <snow.h>
+#include <stdio.h>
+#include <string.h>
+
+void usage() {
+    printf("usage: prof start [stacks] | stop | dump\n");
+}
+
+/* Controls the sampling profiler. `dump` writes folded stacks to the serial
+ * port; from the serial log, on the host:
+ *     sed -n '/^profile: begin/,/^profile: end/{//!p}' serial.log | flamegraph.pl
+ */
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        usage();
+        return 1;
+    }
+
+    if (!strcmp(argv[1], "start")) {
+        uint32_t flags = argc > 2 && !strcmp(argv[2], "stacks") ? SYS_PROFILE_STACKS : 0;
+
+        syscall2(SYS_PROFILE, SYS_PROFILE_START, flags);
+    } else if (!strcmp(argv[1], "stop")) {
+        syscall1(SYS_PROFILE, SYS_PROFILE_STOP);
+    } else if (!strcmp(argv[1], "dump")) {
+        syscall1(SYS_PROFILE, SYS_PROFILE_DUMP);
+        printf("prof: samples written to the serial port\n");
+    } else {
+        usage();
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,357 @@
+#include <snow.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ring.h>
+
+#define CHUNK_SIZE 4096
+#define BATCH 8 // Files copied at once through the ring
+#define RING_SIZE 64 // Enough for a read, a write and two closes per file
+#define MAX_PROCS 64
+#define SYSCALL_COUNT_COST 2
+
+#define DEST_ROOT "/ringbench"
+#define IGNORED 0xFFFFFFFF // User data of completions we don't look at
+
+static inline uint64_t rdtsc() {
+    uint32_t low, high;
+
+    asm volatile ("rdtsc" : "=a" (low), "=d" (high));
+
+    return ((uint64_t) high << 32) | low;
+}
+
+/* What a copy did, to compare both methods.
+ */
+typedef struct {
+    uint32_t files;
+    uint32_t bytes;
+} stats_t;
+
+/* A directory entry as returned by `SYS_READDIR`, with room for its name.
+ */
+typedef struct {
+    sos_directory_entry_t ent;
+    char name[MAX_PATH];
+} dir_entry_t;
+
+/* A file being copied through the ring.
+ */
+typedef struct {
+    char src[MAX_PATH];
+    char dst[MAX_PATH];
+    int32_t src_fd;
+    int32_t dst_fd;
+    uint8_t buf[CHUNK_SIZE];
+} copy_t;
+
+/* Returns the number of system calls made by this process so far, the
+ * `SYSCALL_COUNT_COST` this takes included.
+ */
+uint32_t syscall_count() {
+    static sys_proc_info_t procs[MAX_PROCS];
+    uint32_t pid = syscall(SYS_GETPID);
+    uint32_t count = syscall2(SYS_PROCINFO, (uintptr_t) procs, MAX_PROCS);
+
+    for (uint32_t i = 0; i < count && i < MAX_PROCS; i++) {
+        if (procs[i].pid == pid) {
+            return procs[i].syscalls;
+        }
+    }
+
+    return 0;
+}
+
+void join(char* path, const char* dir, const char* name) {
+    snprintf(path, MAX_PATH, "%s/%s", dir, name);
+}
+
+bool skip_entry(dir_entry_t* dent) {
+    return !strcmp(dent->ent.name, ".") || !strcmp(dent->ent.name, "..") ||
+        !strcmp(dent->ent.name, "lost+found");
+}
+
+void entry_init(dir_entry_t* dent) {
+    dent->ent.entry_size = sizeof(dir_entry_t);
+}
+
+/* Copies the file `src` to `dst` with a system call per operation.
+ */
+void copy_file_plain(const char* src, const char* dst, stats_t* stats) {
+    static uint8_t buf[CHUNK_SIZE];
+    uint32_t src_fd = syscall2(SYS_OPEN, (uintptr_t) src, O_RDONLY);
+    uint32_t dst_fd = syscall2(SYS_OPEN, (uintptr_t) dst, O_WRONLY | O_CREAT | O_APPEND);
+
+    while (src_fd && dst_fd) {
+        int32_t read = syscall3(SYS_READ, src_fd, (uintptr_t) buf, CHUNK_SIZE);
+
+        if (read > 0) {
+            stats->bytes += syscall3(SYS_WRITE, dst_fd, (uintptr_t) buf, read);
+        }
+
+        if (read < CHUNK_SIZE) {
+            break;
+        }
+    }
+
+    syscall1(SYS_CLOSE, src_fd);
+    syscall1(SYS_CLOSE, dst_fd);
+    stats->files++;
+}
+
+/* Copies the tree at `src` to `dst` with plain system calls.
+ */
+void copy_plain(const char* src, const char* dst, stats_t* stats) {
+    dir_entry_t dent;
+    char src_path[MAX_PATH];
+    char dst_path[MAX_PATH];
+
+    syscall2(SYS_MKDIR, (uintptr_t) dst, 0);
+    uint32_t fd = syscall2(SYS_OPEN, (uintptr_t) src, O_RDONLY);
+
+    if (!fd) {
+        return;
+    }
+
+    entry_init(&dent);
+
+    while (syscall2(SYS_READDIR, fd, (uintptr_t) &dent) == 1) {
+        if (skip_entry(&dent)) {
+            continue;
+        }
+
+        join(src_path, src, dent.ent.name);
+        join(dst_path, dst, dent.ent.name);
+
+        if (dent.ent.type == DENT_DIRECTORY) {
+            copy_plain(src_path, dst_path, stats);
+        } else {
+            copy_file_plain(src_path, dst_path, stats);
+        }
+    }
+
+    syscall1(SYS_CLOSE, fd);
+}
+
+/* Submits what's queued in `ring` and returns the result of the only
+ * completion, for calls whose result we need right away.
+ */
+int32_t ring_run(sys_ring_t* ring) {
+    sys_ring_cqe_t cqe = { 0, -1 };
+
+    ring_submit(ring);
+
+    while (ring_pop(ring, &cqe));
+
+    return cqe.result;
+}
+
+/* Copies `count` files at once: every submission writes the chunk each file
+ * just read and reads the next one, so a round costs a single system call.
+ */
+void copy_files_ring(sys_ring_t* ring, copy_t* copies, uint32_t count, stats_t* stats) {
+    sys_ring_cqe_t cqe;
+
+    if (!count) {
+        return;
+    }
+
+    // Open everything, user data is the index of the file and which end
+    for (uint32_t i = 0; i < count; i++) {
+        ring_push(ring, SYS_OPEN, (uintptr_t) copies[i].src, O_RDONLY, 0, 2*i);
+        ring_push(ring, SYS_OPEN, (uintptr_t) copies[i].dst,
+            O_WRONLY | O_CREAT | O_APPEND, 0, 2*i + 1);
+    }
+
+    ring_submit(ring);
+
+    while (ring_pop(ring, &cqe)) {
+        copy_t* copy = &copies[cqe.user_data / 2];
+
+        if (cqe.user_data % 2) {
+            copy->dst_fd = cqe.result;
+        } else {
+            copy->src_fd = cqe.result;
+        }
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        ring_push(ring, SYS_READ, copies[i].src_fd, (uintptr_t) copies[i].buf, CHUNK_SIZE, i);
+        stats->files++;
+    }
+
+    // Calls of a file run in the order they're queued: its write is done
+    // before the next read reuses the buffer
+    while (ring->sq_head != ring->sq_tail) {
+        ring_submit(ring);
+
+        while (ring_pop(ring, &cqe)) {
+            if (cqe.user_data == IGNORED) {
+                continue;
+            }
+
+            copy_t* copy = &copies[cqe.user_data];
+
+            if (cqe.result > 0) {
+                ring_push(ring, SYS_WRITE, copy->dst_fd, (uintptr_t) copy->buf,
+                    cqe.result, IGNORED);
+                stats->bytes += cqe.result;
+            }
+
+            if (cqe.result < CHUNK_SIZE) {
+                ring_push(ring, SYS_CLOSE, copy->src_fd, 0, 0, IGNORED);
+                ring_push(ring, SYS_CLOSE, copy->dst_fd, 0, 0, IGNORED);
+            } else {
+                ring_push(ring, SYS_READ, copy->src_fd, (uintptr_t) copy->buf,
+                    CHUNK_SIZE, cqe.user_data);
+            }
+        }
+    }
+}
+
+/* Copies the tree at `src` to `dst`, batching system calls through `ring`.
+ */
+void copy_ring(sys_ring_t* ring, const char* src, const char* dst, stats_t* stats) {
+    static copy_t copies[BATCH];
+    dir_entry_t dents[BATCH]; // Entries are read a batch at a time too
+    char src_path[MAX_PATH];
+    char dst_path[MAX_PATH];
+    uint32_t num_copies = 0;
+    sys_ring_cqe_t cqe;
+
+    syscall2(SYS_MKDIR, (uintptr_t) dst, 0);
+    ring_push(ring, SYS_OPEN, (uintptr_t) src, O_RDONLY, 0, 0);
+    int32_t fd = ring_run(ring);
+
+    if (fd <= 0) {
+        return;
+    }
+
+    bool more = true;
+
+    while (more) {
+        int32_t results[BATCH];
+
+        for (uint32_t i = 0; i < BATCH; i++) {
+            entry_init(&dents[i]);
+            ring_push(ring, SYS_READDIR, fd, (uintptr_t) &dents[i], 0, i);
+        }
+
+        // Reap the whole batch before recursing reuses the ring
+        ring_submit(ring);
+
+        while (ring_pop(ring, &cqe)) {
+            results[cqe.user_data] = cqe.result;
+        }
+
+        for (uint32_t i = 0; i < BATCH && more; i++) {
+            dir_entry_t* dent = &dents[i];
+
+            if (results[i] != 1) {
+                more = false;
+                continue;
+            }
+
+            if (skip_entry(dent)) {
+                continue;
+            }
+
+            join(src_path, src, dent->ent.name);
+            join(dst_path, dst, dent->ent.name);
+
+            if (dent->ent.type == DENT_DIRECTORY) {
+                // `copies` is shared with the subdirectory, empty it first
+                copy_files_ring(ring, copies, num_copies, stats);
+                num_copies = 0;
+                copy_ring(ring, src_path, dst_path, stats);
+                continue;
+            }
+
+            strcpy(copies[num_copies].src, src_path);
+            strcpy(copies[num_copies].dst, dst_path);
+            num_copies++;
+
+            if (num_copies == BATCH) {
+                copy_files_ring(ring, copies, num_copies, stats);
+                num_copies = 0;
+            }
+        }
+    }
+
+    copy_files_ring(ring, copies, num_copies, stats);
+
+    ring_push(ring, SYS_CLOSE, fd, 0, 0, 0);
+    ring_run(ring);
+}
+
+/* Deletes the files under `dir`; directories stay, there's no `rmdir`.
+ */
+void remove_files(const char* dir) {
+    dir_entry_t dent;
+    char path[MAX_PATH];
+    uint32_t fd = syscall2(SYS_OPEN, (uintptr_t) dir, O_RDONLY);
+
+    if (!fd) {
+        return;
+    }
+
+    entry_init(&dent);
+
+    while (syscall2(SYS_READDIR, fd, (uintptr_t) &dent) == 1) {
+        if (skip_entry(&dent)) {
+            continue;
+        }
+
+        join(path, dir, dent.ent.name);
+
+        if (dent.ent.type == DENT_DIRECTORY) {
+            remove_files(path);
+        } else {
+            syscall1(SYS_UNLINK, (uintptr_t) path);
+        }
+    }
+
+    syscall1(SYS_CLOSE, fd);
+}
+
+void report(const char* method, stats_t* stats, uint64_t cycles, uint32_t syscalls) {
+    printf("  %-8s %d files, %d bytes, %d kcycles, %d syscalls\n", method,
+        stats->files, stats->bytes, (uint32_t) (cycles / 1000), syscalls);
+}
+
+/* Copies a directory tree twice, once with a system call per operation and
+ * once through a submission ring, and compares the costs.
+ */
+int main(int argc, char* argv[]) {
+    const char* src = argc > 1 ? argv[1] : "/lib";
+    sys_ring_t* ring = ring_new(RING_SIZE);
+
+    syscall2(SYS_MKDIR, (uintptr_t) DEST_ROOT, 0);
+    remove_files(DEST_ROOT);
+
+    printf("copying %s:\n", src);
+
+    stats_t plain = { 0, 0 };
+    uint32_t syscalls = syscall_count();
+    uint64_t start = rdtsc();
+
+    copy_plain(src, DEST_ROOT "/plain", &plain);
+
+    uint64_t cycles = rdtsc() - start;
+    report("syscalls", &plain, cycles, syscall_count() - syscalls - SYSCALL_COUNT_COST);
+
+    stats_t batched = { 0, 0 };
+    syscalls = syscall_count();
+    start = rdtsc();
+
+    copy_ring(ring, src, DEST_ROOT "/ring", &batched);
+
+    cycles = rdtsc() - start;
+    report("ring", &batched, cycles, syscall_count() - syscalls - SYSCALL_COUNT_COST);
+
+    remove_files(DEST_ROOT);
+    ring_free(ring);
+
+    return 0;
+}
@@ -0,0 +1,138 @@
+#include <snow.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BATCH 16
+#define POLL_MS 100
+
+static const char* names[SYS_MAX] = {
+    [SYS_YIELD] = "yield", [SYS_EXIT] = "exit", [SYS_SLEEP] = "sleep",
+    [SYS_PUTCHAR] = "putchar", [SYS_SBRK] = "sbrk", [SYS_WM] = "wm",
+    [SYS_INFO] = "info", [SYS_EXEC] = "exec", [SYS_OPEN] = "open",
+    [SYS_CLOSE] = "close", [SYS_READ] = "read", [SYS_READDIR] = "readdir",
+    [SYS_WRITE] = "write", [SYS_MKDIR] = "mkdir", [SYS_FSEEK] = "fseek",
+    [SYS_FTELL] = "ftell", [SYS_CHDIR] = "chdir", [SYS_GETCWD] = "getcwd",
+    [SYS_UNLINK] = "unlink", [SYS_RENAME] = "rename", [SYS_MAKETTY] = "maketty",
+    [SYS_STAT] = "stat", [SYS_PROCINFO] = "procinfo", [SYS_CLONE] = "clone",
+    [SYS_FUTEX] = "futex", [SYS_GETPID] = "getpid", [SYS_DUP] = "dup",
+    [SYS_DUP2] = "dup2", [SYS_RING_ENTER] = "ring_enter", [SYS_TRACE] = "trace",
+    [SYS_PROFILE] = "profile", [SYS_STRACE] = "strace", [SYS_GETDENTS] = "getdents",
+    [SYS_SYNC] = "sync", [SYS_PWRITE] = "pwrite",
+};
+
+void usage() {
+    printf("usage: strace -c | -r | -p <pid> [count] | <command> [args...]\n");
+}
+
+const char* syscall_name(uint32_t num) {
+    static char buf[16];
+
+    if (num < SYS_MAX && names[num]) {
+        return names[num];
+    }
+
+    snprintf(buf, sizeof(buf), "syscall%d", num);
+
+    return buf;
+}
+
+/* Prints how many times each system call was made and how long they took,
+ * with the distribution of their latencies in powers of two of cycles.
+ */
+void print_stats() {
+    static sys_syscall_stats_t stats[SYS_MAX];
+    uint32_t count = syscall3(SYS_STRACE, SYS_STRACE_STATS, (uintptr_t) stats, SYS_MAX);
+
+    printf("%-11s %8s %10s %10s (cycles)\n", "syscall", "calls", "average", "max");
+
+    for (uint32_t num = 0; num < count && num < SYS_MAX; num++) {
+        sys_syscall_stats_t* s = &stats[num];
+
+        if (!s->count) {
+            continue;
+        }
+
+        printf("%-11s %8d %10d %10d\n", syscall_name(num), s->count,
+            (uint32_t) (s->cycles / s->count), (uint32_t) s->max_cycles);
+        printf("           ");
+
+        for (uint32_t i = 0; i < SYS_STRACE_BUCKETS; i++) {
+            if (s->histogram[i]) {
+                printf(" 2^%d:%d", i, s->histogram[i]);
+            }
+        }
+
+        printf("\n");
+    }
+}
+
+void print_entry(sys_strace_entry_t* e) {
+    printf("[%d] %s(%x, %x, %x) = %d, %d cycles\n", e->pid, syscall_name(e->syscall),
+        e->args[0], e->args[1], e->args[2], e->result, e->cycles);
+}
+
+/* Prints logged system calls as they come, until no process is traced anymore
+ * or `max` calls were printed, if it isn't zero.
+ */
+void follow(uint32_t max) {
+    sys_strace_entry_t entries[BATCH];
+    uint32_t printed = 0;
+
+    while (!max || printed < max) {
+        uint32_t n = syscall3(SYS_STRACE, SYS_STRACE_READ, (uintptr_t) entries, BATCH);
+
+        for (uint32_t i = 0; i < n && (!max || printed < max); i++, printed++) {
+            print_entry(&entries[i]);
+        }
+
+        if (!n) {
+            if (!syscall1(SYS_STRACE, SYS_STRACE_TRACED)) {
+                break;
+            }
+
+            syscall1(SYS_SLEEP, POLL_MS);
+        }
+    }
+}
+
+/* Shows which system calls processes make: either a summary of all calls
+ * since boot, or each call of a process along with its arguments, result and
+ * duration.
+ */
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        usage();
+        return 1;
+    }
+
+    if (!strcmp(argv[1], "-c")) {
+        print_stats();
+    } else if (!strcmp(argv[1], "-r")) {
+        syscall1(SYS_STRACE, SYS_STRACE_RESET);
+    } else if (!strcmp(argv[1], "-p")) {
+        uint32_t pid = argc > 2 ? atoi(argv[2]) : 0;
+
+        if (syscall2(SYS_STRACE, SYS_STRACE_ATTACH, pid)) {
+            printf("strace: no process %d\n", pid);
+            return 1;
+        }
+
+        follow(argc > 3 ? atoi(argv[3]) : 0);
+        syscall2(SYS_STRACE, SYS_STRACE_DETACH, pid);
+    } else {
+        // Only the command is traced, not us
+        syscall2(SYS_STRACE, SYS_STRACE_CHILDREN, 1);
+        int32_t ret = syscall2(SYS_EXEC, (uintptr_t) argv[1], (uintptr_t) &argv[1]);
+        syscall2(SYS_STRACE, SYS_STRACE_CHILDREN, 0);
+
+        if (ret) {
+            printf("strace: can't run %s\n", argv[1]);
+            return 1;
+        }
+
+        follow(0);
+    }
+
+    return 0;
+}
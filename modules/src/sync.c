@@ -0,0 +1,9 @@
+#include <unistd.h>
+
+/* Writes the filesystem changes still in the kernel's buffer cache to disk.
+ */
+int main() {
+    sync();
+
+    return 0;
+}
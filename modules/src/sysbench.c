@@ -0,0 +1,113 @@
+#include <snow.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#define ITERATIONS 100000
+#define BATCHES 10
+
+#define CPUID_FEAT_EDX_SEP (1 << 11)
+
+static inline uint64_t rdtsc() {
+    uint32_t low, high;
+
+    asm volatile ("rdtsc" : "=a" (low), "=d" (high));
+
+    return ((uint64_t) high << 32) | low;
+}
+
+/* Mirrors the check done by the kernel before enabling `sysenter`.
+ */
+bool sysenter_available() {
+    uint32_t eax, ebx, ecx, edx;
+
+    asm volatile ("cpuid"
+        : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
+        : "a" (1));
+
+    uint32_t family = (eax >> 8) & 0xF;
+    uint32_t model = (eax >> 4) & 0xF;
+    uint32_t stepping = eax & 0xF;
+
+    if (family == 6 && model < 3 && stepping < 3) {
+        return false;
+    }
+
+    return edx & CPUID_FEAT_EDX_SEP;
+}
+
+uint32_t getpid_int() {
+    uint32_t pid;
+
+    asm volatile ("int $0x30" : "=a" (pid) : "a" (SYS_GETPID) : "memory");
+
+    return pid;
+}
+
+/* See `syscall_enter` in `snow_syscall.S` for the convention.
+ */
+uint32_t getpid_sysenter() {
+    uint32_t pid;
+
+    asm volatile (
+        "push %%ebp\n"
+        "mov %%esp, %%ebp\n"
+        "mov $1f, %%edi\n"
+        "sysenter\n"
+        "1:\n"
+        "pop %%ebp\n"
+        : "=a" (pid)
+        : "a" (SYS_GETPID)
+        : "ecx", "edx", "edi", "memory");
+
+    return pid;
+}
+
+/* Returns the average number of cycles taken by a call to `func`, over the
+ * fastest of `BATCHES` batches: slower ones were hit by timer interrupts or
+ * preempted, which isn't what we're measuring.
+ */
+uint32_t measure(uint32_t (*func)()) {
+    uint32_t best = 0xFFFFFFFF;
+
+    // Warm up caches
+    for (uint32_t i = 0; i < ITERATIONS / 10; i++) {
+        func();
+    }
+
+    for (uint32_t batch = 0; batch < BATCHES; batch++) {
+        uint64_t start = rdtsc();
+
+        for (uint32_t i = 0; i < ITERATIONS / BATCHES; i++) {
+            func();
+        }
+
+        uint32_t cycles = (rdtsc() - start) / (ITERATIONS / BATCHES);
+
+        if (cycles < best) {
+            best = cycles;
+        }
+    }
+
+    return best;
+}
+
+/* Measures the latency of a system call doing nothing, through both kernel
+ * entry points.
+ */
+int main() {
+    uint32_t int_cycles = measure(getpid_int);
+
+    printf("null system call, best of %d batches of %d:\n", BATCHES, ITERATIONS / BATCHES);
+    printf("  int $0x30: %d cycles\n", int_cycles);
+
+    if (sysenter_available()) {
+        uint32_t sysenter_cycles = measure(getpid_sysenter);
+
+        printf("  sysenter:  %d cycles\n", sysenter_cycles);
+        printf("  sysenter saves %d cycles per call\n", (int32_t) (int_cycles - sysenter_cycles));
+    } else {
+        printf("  sysenter:  unsupported by this CPU\n");
+    }
+
+    return 0;
+}
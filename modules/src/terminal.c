@@ -3,6 +3,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <time.h>
 #include <ui.h>
 
 typedef struct {
@@ -30,7 +31,7 @@ const uint32_t max_line = theight / char_height - 2;
 const char* prompt = "snowflakeos $ ";
 const uint32_t margin = UI_DEFAULT_PADDING;
 const uint32_t text_color = 0xE0E0E0;
-const float cursor_blink_time = 1;
+const uint32_t cursor_blink_time = 1; // In seconds
 
 window_t* win;
 bool cursor = true;
@@ -67,10 +68,10 @@ int main() {
 
         // Time & cursor blinks
         if (focused) {
-            sys_info_t info;
-            syscall2(SYS_INFO, SYS_INFO_UPTIME, (uintptr_t) &info);
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
 
-            uint32_t time = (uint32_t) (info.uptime / cursor_blink_time);
+            uint32_t time = ts.tv_sec / cursor_blink_time;
 
             if (time != last_time) {
                 last_time = time;
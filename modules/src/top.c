@@ -0,0 +1,120 @@
+#include <snow.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_PROCS 32
+#define LINE_SIZE 64
+#define TIME_STEP_MS 1000
+
+static const uint32_t win_w = 480;
+static const uint32_t win_h = 300;
+static const uint32_t line_h = 16;
+static const uint32_t txt_color = 0xCCCCCC;
+static const uint32_t header_color = 0x00FF00;
+
+/* A process's CPU usage over the last sampling period, in ticks.
+ */
+typedef struct {
+    sys_proc_info_t* info;
+    uint32_t ticks;
+} row_t;
+
+/* Returns the number of ticks `info` ran for since the previous sample.
+ */
+uint32_t ticks_since(sys_proc_info_t* info, sys_proc_info_t* prev, uint32_t prev_count) {
+    for (uint32_t i = 0; i < prev_count; i++) {
+        if (prev[i].pid == info->pid) {
+            return info->run_ticks - prev[i].run_ticks;
+        }
+    }
+
+    return info->run_ticks;
+}
+
+/* Sorts rows by decreasing CPU usage, ties broken by pid.
+ */
+void sort_rows(row_t* rows, uint32_t count) {
+    for (uint32_t i = 1; i < count; i++) {
+        row_t row = rows[i];
+        uint32_t j = i;
+
+        while (j > 0 && (rows[j-1].ticks < row.ticks ||
+                (rows[j-1].ticks == row.ticks && rows[j-1].info->pid > row.info->pid))) {
+            rows[j] = rows[j-1];
+            j--;
+        }
+
+        rows[j] = row;
+    }
+}
+
+int main() {
+    window_t* win = snow_open_window("top", win_w, win_h, WM_NORMAL);
+
+    sys_proc_info_t procs[2][MAX_PROCS];
+    row_t rows[MAX_PROCS];
+    char line[LINE_SIZE];
+    uint32_t counts[2] = { 0, 0 };
+    uint32_t cur = 0;
+
+    while (true) {
+        wm_event_t evt = snow_get_event(win);
+
+        if (evt.type == WM_EVENT_KBD && evt.kbd.keycode == KBD_ESCAPE) {
+            break;
+        }
+
+        /* Sample, and compare to the previous sample */
+        sys_proc_info_t* now = procs[cur];
+        sys_proc_info_t* prev = procs[1 - cur];
+        uint32_t total = syscall2(SYS_PROCINFO, (uintptr_t) now, MAX_PROCS);
+        uint32_t count = total < MAX_PROCS ? total : MAX_PROCS;
+        uint32_t total_ticks = 0;
+
+        counts[cur] = count;
+
+        for (uint32_t i = 0; i < count; i++) {
+            rows[i].info = &now[i];
+            rows[i].ticks = ticks_since(&now[i], prev, counts[1 - cur]);
+            total_ticks += rows[i].ticks;
+        }
+
+        sort_rows(rows, count);
+
+        /* Draw the table */
+        snow_draw_window(win);
+
+        uint32_t y = WM_TB_HEIGHT + 4;
+
+        sprintf(line, "%d processes", total);
+        snow_draw_string(win->fb, line, 4, y, txt_color);
+        y += line_h;
+
+        sprintf(line, "%4s %-12s %4s %7s %6s %6s %5s %6s",
+            "PID", "NAME", "CPU", "SYSCALL", "VCSW", "ICSW", "PGF", "RES");
+        snow_draw_string(win->fb, line, 4, y, header_color);
+        y += line_h;
+
+        for (uint32_t i = 0; i < count && y + line_h < win_h; i++) {
+            sys_proc_info_t* p = rows[i].info;
+            uint32_t cpu = total_ticks ? 100 * rows[i].ticks / total_ticks : 0;
+
+            sprintf(line, "%4d %-12.12s %3d%% %7d %6d %6d %5d %5dK",
+                p->pid, p->name, cpu, p->syscalls, p->voluntary_switches,
+                p->involuntary_switches, p->page_faults, p->resident_pages * 4);
+            snow_draw_string(win->fb, line, 4, y, txt_color);
+            y += line_h;
+        }
+
+        snow_render_window(win);
+
+        cur = 1 - cur;
+        snow_sleep(TIME_STEP_MS);
+    }
+
+    snow_close_window(win);
+
+    return 0;
+}
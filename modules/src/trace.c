@@ -0,0 +1,68 @@
+#include <kernel/uapi/uapi_trace.h>
+
+#include <snow.h>
+#include <stdio.h>
+#include <string.h>
+
+typedef struct {
+    const char* name;
+    uint32_t mask;
+} category_t;
+
+static const category_t categories[] = {
+    { "irq", TRACE_IRQ },
+    { "syscall", TRACE_SYSCALL },
+    { "switch", TRACE_SWITCH },
+    { "fault", TRACE_FAULT },
+    { "render", TRACE_RENDER },
+    { "block", TRACE_BLOCK },
+    { "all", TRACE_ALL },
+};
+
+#define NUM_CATEGORIES (sizeof(categories)/sizeof(categories[0]))
+
+void usage() {
+    printf("usage: trace start [category...] | stop | dump\n");
+    printf("categories: irq syscall switch fault render block all\n");
+}
+
+/* Controls the kernel tracer. `dump` writes the events to the serial port,
+ * `misc/trace2json.py` turns them into something a trace viewer can open.
+ */
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        usage();
+        return 1;
+    }
+
+    if (!strcmp(argv[1], "start")) {
+        uint32_t mask = argc > 2 ? 0 : TRACE_ALL;
+
+        for (int i = 2; i < argc; i++) {
+            uint32_t j = 0;
+
+            while (j < NUM_CATEGORIES && strcmp(argv[i], categories[j].name)) {
+                j++;
+            }
+
+            if (j == NUM_CATEGORIES) {
+                printf("trace: unknown category %s\n", argv[i]);
+                return 1;
+            }
+
+            mask |= categories[j].mask;
+        }
+
+        syscall2(SYS_TRACE, SYS_TRACE_SET_MASK, mask);
+    } else if (!strcmp(argv[1], "stop")) {
+        syscall2(SYS_TRACE, SYS_TRACE_SET_MASK, 0);
+    } else if (!strcmp(argv[1], "dump")) {
+        syscall1(SYS_TRACE, SYS_TRACE_DUMP);
+        printf("trace: events written to the serial port\n");
+    } else {
+        usage();
+        return 1;
+    }
+
+    return 0;
+}
@@ -18,9 +18,9 @@ typedef struct {
  * Who knows how it's called.
  */
 
-uint32_t font_len = 4100;
+const uint32_t font_len = 4100;
 
-uint8_t font_psf[] = {
+const uint8_t font_psf[] = {
     0x36, 0x04, 0x00, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
     0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x7e, 0x81,
     0xa5, 0x81, 0x81, 0xbd, 0x99, 0x81, 0x81, 0x7e, 0x00, 0x00, 0x00, 0x00,
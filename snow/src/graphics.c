@@ -1,5 +1,5 @@
 #include <snow.h>
-#include <font.h> // TODO: move to kernel, ask the kernel to map into process
+#include <font.h> // Shared between processes as part of libsnow.so
 
 #include <stdlib.h>
 #include <string.h>
@@ -151,7 +151,7 @@ void snow_draw_border(fb_t fb, int x, int y, int w, int h, uint32_t col) {
  * Does not draw the background.
  */
 void snow_draw_character(fb_t fb, char c, int x, int y, uint32_t col) {
-    uint8_t* offset = font_psf + sizeof(font_header_t) + 16*c;
+    const uint8_t* offset = font_psf + sizeof(font_header_t) + 16*c;
 
     for (int i = 0; i < 16; i++) {
         for (int j = 0; j < 8; j++) {